@@ -0,0 +1,206 @@
+#ifndef JOYCOND_BENCH_FAKE_IO_H
+#define JOYCOND_BENCH_FAKE_IO_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <initializer_list>
+#include <libevdev/libevdev.h>
+#include <linux/input.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <vector>
+
+#include "clock.h"
+#include "ctlr_id.h"
+#include "event_sink.h"
+#include "event_source.h"
+#include "phys_ctlr.h"
+#include "virt_device.h"
+
+static inline void enable_keys(struct libevdev *evdev,
+                               std::initializer_list<unsigned int> codes) {
+    for (unsigned int code : codes)
+        libevdev_enable_event_code(evdev, EV_KEY, code, NULL);
+}
+
+static inline void enable_sticks(struct libevdev *evdev,
+                                 std::initializer_list<unsigned int> codes) {
+    struct input_absinfo abs = {0};
+
+    abs.minimum = -32767;
+    abs.maximum = 32767;
+    abs.fuzz = 250;
+    abs.flat = 500;
+    for (unsigned int code : codes)
+        libevdev_enable_event_code(evdev, EV_ABS, code, &abs);
+}
+
+// Gives evdev the name, ids, MAC and codes hid-nintendo exposes for model
+static inline void describe_ctlr(struct libevdev *evdev,
+                                 phys_ctlr::Model model, uint64_t mac) {
+    libevdev_set_id_bustype(evdev, BUS_BLUETOOTH);
+    libevdev_set_id_vendor(evdev, 0x057e);
+    libevdev_set_uniq(evdev, format_mac(mac).c_str());
+    libevdev_enable_event_type(evdev, EV_KEY);
+
+    switch (model) {
+    case phys_ctlr::Model::Left_Joycon:
+        libevdev_set_name(evdev, "Nintendo Switch Left Joy-Con");
+        libevdev_set_id_product(evdev, 0x2006);
+        enable_keys(evdev, {BTN_DPAD_UP, BTN_DPAD_DOWN, BTN_DPAD_LEFT,
+                            BTN_DPAD_RIGHT, BTN_TL, BTN_TL2, BTN_SELECT,
+                            BTN_THUMBL, BTN_Z, BTN_TR, BTN_TR2});
+        enable_sticks(evdev, {ABS_X, ABS_Y});
+        break;
+    case phys_ctlr::Model::Right_Joycon:
+        libevdev_set_name(evdev, "Nintendo Switch Right Joy-Con");
+        libevdev_set_id_product(evdev, 0x2007);
+        enable_keys(evdev, {BTN_SOUTH, BTN_EAST, BTN_NORTH, BTN_WEST, BTN_TR,
+                            BTN_TR2, BTN_START, BTN_THUMBR, BTN_MODE, BTN_TL,
+                            BTN_TL2});
+        enable_sticks(evdev, {ABS_RX, ABS_RY});
+        break;
+    case phys_ctlr::Model::Snescon:
+        libevdev_set_name(evdev, "Nintendo Switch SNES Controller");
+        libevdev_set_id_product(evdev, 0x2017);
+        enable_keys(evdev, {BTN_SOUTH, BTN_EAST, BTN_NORTH, BTN_WEST, BTN_TL,
+                            BTN_TR, BTN_TL2, BTN_TR2, BTN_SELECT, BTN_START,
+                            BTN_DPAD_UP, BTN_DPAD_DOWN, BTN_DPAD_LEFT,
+                            BTN_DPAD_RIGHT});
+        break;
+    default:
+        libevdev_set_name(evdev, "Nintendo Switch Pro Controller");
+        libevdev_set_id_product(evdev, 0x2009);
+        enable_keys(evdev, {BTN_SOUTH, BTN_EAST, BTN_NORTH, BTN_WEST, BTN_TL,
+                            BTN_TR, BTN_TL2, BTN_TR2, BTN_SELECT, BTN_START,
+                            BTN_THUMBL, BTN_THUMBR, BTN_MODE, BTN_Z,
+                            BTN_DPAD_UP, BTN_DPAD_DOWN, BTN_DPAD_LEFT,
+                            BTN_DPAD_RIGHT});
+        enable_sticks(evdev, {ABS_X, ABS_Y, ABS_RX, ABS_RY});
+        break;
+    }
+}
+
+// An event_source that hands out a prepared stream one SYN_REPORT frame per
+// wakeup, the way the poll thread sees a controller: each call into
+// relay_events() drains one frame and then gets -EAGAIN. The fd is readable
+// from load() until the stream runs out, so an epoll_mgr loop drains it
+// too. The evdev is a describe_ctlr() one, and its state follows the stream
+// like libevdev's would.
+class memory_source : public event_source {
+  private:
+    struct libevdev *evdev;
+    int fd;
+    std::vector<struct input_event> events;
+    size_t next;
+    bool frame_done;
+
+    void set_readable(bool readable) {
+        uint64_t count = 1;
+        ssize_t ret;
+
+        if (readable)
+            ret = write(fd, &count, sizeof(count));
+        else
+            ret = read(fd, &count, sizeof(count));
+        (void)ret;
+    }
+
+  public:
+    memory_source(phys_ctlr::Model model, uint64_t mac)
+        : evdev(libevdev_new()),
+          fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), next(0),
+          frame_done(false) {
+        describe_ctlr(evdev, model, mac);
+    }
+
+    ~memory_source() {
+        libevdev_free(evdev);
+        close(fd);
+    }
+
+    // Keeps only the events this device could have sent, so one stream can
+    // be fed to either Joy-Con
+    void load(const std::vector<struct input_event> &stream) {
+        events.clear();
+        for (const auto &ev : stream) {
+            if (ev.type == EV_SYN) {
+                if (!events.empty() && events.back().type != EV_SYN)
+                    events.push_back(ev);
+            } else if (libevdev_has_event_code(evdev, ev.type, ev.code)) {
+                events.push_back(ev);
+            }
+        }
+        rewind();
+    }
+
+    // Restamps the stream with the current time, so relay latency stays
+    // sane across passes
+    void rewind() {
+        uint64_t now_us = monotonic_ns() / 1000;
+
+        for (auto &ev : events) {
+            ev.input_event_sec = now_us / 1000000;
+            ev.input_event_usec = now_us % 1000000;
+        }
+        next = 0;
+        frame_done = false;
+        set_readable(!events.empty());
+    }
+
+    bool done() const { return next == events.size(); }
+    size_t size() const { return events.size(); }
+
+    struct libevdev *get_evdev() override { return evdev; }
+    int get_fd() override { return fd; }
+    int next_event(unsigned int flags, struct input_event *ev) override {
+        if (frame_done || next == events.size()) {
+            if (!frame_done)
+                set_readable(false);
+            frame_done = false;
+            return -EAGAIN;
+        }
+
+        *ev = events[next++];
+        if (ev->type == EV_KEY || ev->type == EV_ABS)
+            libevdev_set_event_value(evdev, ev->type, ev->code, ev->value);
+        frame_done = ev->type == EV_SYN && ev->code == SYN_REPORT;
+        return LIBEVDEV_READ_STATUS_SUCCESS;
+    }
+    void grab(bool grab) override {}
+};
+
+// Swallows everything; the fd is an eventfd that never becomes readable, so
+// there's nothing to answer. Only the owning device's thread writes, so the
+// count needs no read-modify-write.
+class null_sink : public event_sink {
+  private:
+    int fd;
+    std::atomic<uint64_t> writes;
+
+  public:
+    null_sink() : fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), writes(0) {}
+    ~null_sink() { close(fd); }
+
+    void write_event(unsigned int type, unsigned int code,
+                     int value) override {
+        writes.store(writes.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_relaxed);
+    }
+    int get_fd() override { return fd; }
+    uint64_t get_writes() const { return writes.load(); }
+};
+
+// virt_device_factory that makes null_sink devices
+static inline bool create_null_device(const virt_caps &caps,
+                                      struct virt_device *dev) {
+    dev->caps = caps;
+    dev->evdev = nullptr;
+    dev->uidev = nullptr;
+    dev->sink = new null_sink();
+    dev->pooled = false;
+    return true;
+}
+
+#endif
@@ -0,0 +1,673 @@
+// End-to-end latency through uinput. Fakes hid-nintendo controllers with
+// uinput source devices, lets joycond detect and pair them, then presses
+// buttons on them and reads the result back from the virtual controllers
+// it makes. Needs /dev/uinput and the rights to create devices on it.
+//
+//   joycond_loopback_bench [--external] [--json] [--model MODEL]
+//                          [--counts N,N...] [--seconds S] [--period-ms MS]
+//                          [--announce-ms MS]
+//
+// MODEL is pro, snes, joycons (a left and right pair, combined) or mixed,
+// which cycles through those three. For each count (1,2,4,8,16 by default)
+// that many controllers are plugged in one after another, each is then
+// unplugged and plugged back once, and finally all of them send a frame
+// every --period-ms for --seconds, evenly staggered. Reported per count:
+//  - pairing: source device created to its first frame coming out
+//  - hotplug: the same, after replugging a paired controller; a Pro or
+//    SNES controller's virtual device goes away with it, so for those this
+//    is a fresh pairing, while a joy-con pair keeps its device
+//  - latency: source write to the event time on the virtual device
+// Pairing and hotplug times are in ms, latencies in us.
+//
+// The fake controllers have no HID device, so the daemon gets no warning
+// that they are coming and pairs them into freshly made devices. With
+// --announce-ms each one is announced to the in-process daemon that long
+// before it's plugged, the way its HID uevent would, so pairing uses the
+// devices the uinput pool made for it meanwhile.
+//
+// The daemon core runs in this process unless --external is given, in
+// which case an already running joycond does the pairing. Frames are told
+// apart by stepping a few buttons through a Gray code: every frame changes
+// exactly one of them, and their state says which frame it was. Those
+// buttons have to come out unremapped, so run without a layout.txt.
+
+#include <algorithm>
+#include <android-base/properties.h>
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <functional>
+#include <libevdev/libevdev-uinput.h>
+#include <libevdev/libevdev.h>
+#include <memory>
+#include <poll.h>
+#include <pthread.h>
+#include <string>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "clock.h"
+#include "ctlr_detector.h"
+#include "ctlr_mgr.h"
+#include "epoll_mgr.h"
+#include "fake_io.h"
+#include "latency_histogram.h"
+#include "mapping.h"
+
+using android::base::GetIntProperty;
+using android::base::SetProperty;
+
+static const uint64_t MS = 1000000;
+// how often a controller that hasn't come out yet is poked
+static const uint64_t PROBE_NS = 2 * MS;
+static const uint64_t PAIR_TIMEOUT_NS = 5000 * MS;
+// time for the daemon to notice an unplug before the replug
+static const uint64_t SETTLE_NS = 500 * MS;
+static const uint64_t MAC = 0x98b6e9000000;
+
+// One source device and the buttons that carry its frame number
+struct lane {
+    phys_ctlr::Model model;
+    uint64_t mac;
+    struct libevdev *evdev;
+    struct libevdev_uinput *uidev;
+    std::vector<unsigned int> codes;
+    uint32_t seq;
+    // send time of each frame number still in flight, 0 once seen
+    uint64_t sent_ns[16];
+    uint64_t next_ns;
+    uint64_t sent;
+    uint64_t seen;
+};
+
+struct controller {
+    std::vector<lane> lanes;
+    // output the frames come out of, -1 until paired
+    int output;
+};
+
+struct output {
+    int id;
+    int fd;
+    struct libevdev *evdev;
+    std::vector<unsigned int> frame_keys;
+};
+
+struct options {
+    bool external;
+    bool json;
+    std::string model;
+    std::vector<int> counts;
+    double seconds;
+    double period_ms;
+    double announce_ms;
+    std::function<void(uint64_t, phys_ctlr::Model)> announce;
+};
+
+static uint32_t gray(uint32_t n) { return n ^ (n >> 1); }
+
+static uint32_t from_gray(uint32_t g) {
+    g ^= g >> 1;
+    g ^= g >> 2;
+    g ^= g >> 4;
+    return g;
+}
+
+static uint32_t lane_period(const lane &l) { return 1u << l.codes.size(); }
+
+static bool plug(lane *l) {
+    l->evdev = libevdev_new();
+    describe_ctlr(l->evdev, l->model, l->mac);
+    int ret = libevdev_uinput_create_from_device(
+        l->evdev, LIBEVDEV_UINPUT_OPEN_MANAGED, &l->uidev);
+    if (ret) {
+        fprintf(stderr, "Failed to create uinput device: %s\n",
+                strerror(-ret));
+        libevdev_free(l->evdev);
+        l->evdev = nullptr;
+        l->uidev = nullptr;
+        return false;
+    }
+
+    // A fresh node starts with everything released
+    l->seq = 0;
+    memset(l->sent_ns, 0, sizeof(l->sent_ns));
+    return true;
+}
+
+static void unplug(lane *l) {
+    if (l->uidev)
+        libevdev_uinput_destroy(l->uidev);
+    if (l->evdev)
+        libevdev_free(l->evdev);
+    l->uidev = nullptr;
+    l->evdev = nullptr;
+}
+
+// Steps to the next frame number, which flips exactly one button
+static void send_frame(lane *l) {
+    uint32_t period = lane_period(*l);
+    uint32_t prev = gray(l->seq % period);
+    uint32_t next = gray(++l->seq % period);
+    int bit = __builtin_ctz(prev ^ next);
+
+    l->sent_ns[l->seq % period] = monotonic_ns();
+    libevdev_uinput_write_event(l->uidev, EV_KEY, l->codes[bit],
+                                (next >> bit) & 1);
+    libevdev_uinput_write_event(l->uidev, EV_SYN, SYN_REPORT, 0);
+    l->sent++;
+}
+
+static lane make_lane(phys_ctlr::Model model, uint64_t mac) {
+    lane l = {};
+
+    l.model = model;
+    l.mac = mac;
+    // Buttons every layer of the relay passes through as they are
+    if (model == phys_ctlr::Model::Left_Joycon)
+        l.codes = {BTN_TL, BTN_SELECT, BTN_THUMBL};
+    else
+        l.codes = {BTN_SOUTH, BTN_EAST, BTN_NORTH, BTN_WEST};
+    return l;
+}
+
+class loopback {
+  private:
+    std::vector<output> outputs;
+    std::vector<controller> controllers;
+    int inotify_fd;
+    int next_output_id;
+
+    // the controller being paired, which is looked for on every output,
+    // and the one source of it that matters if not all of them
+    controller *probing;
+    lane *probing_lane;
+    uint64_t hit_ns;
+    latency_histogram *recording;
+
+    void open_output(const std::string &node);
+    void scan_outputs();
+    void handle_inotify();
+    void handle_frame(output &out, uint64_t ev_ns);
+    void read_output(output &out);
+    void pump_until(uint64_t deadline_ns);
+    uint64_t probe(controller &c, lane *only, uint64_t start_ns);
+
+  public:
+    loopback();
+    ~loopback();
+
+    bool run(int count, const options &opts);
+};
+
+// private
+void loopback::open_output(const std::string &node) {
+    struct output out = {next_output_id, -1, nullptr, {}};
+
+    out.fd = open(node.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (out.fd < 0)
+        return;
+    if (libevdev_new_from_fd(out.fd, &out.evdev)) {
+        close(out.fd);
+        return;
+    }
+
+    // The virtual pro controller and combined joy-cons share these ids
+    if (libevdev_get_id_vendor(out.evdev) != 0x057e ||
+        libevdev_get_id_product(out.evdev) != 0x2008) {
+        libevdev_free(out.evdev);
+        close(out.fd);
+        return;
+    }
+
+    libevdev_set_clock_id(out.evdev, CLOCK_MONOTONIC);
+    outputs.push_back(out);
+    next_output_id++;
+}
+
+void loopback::scan_outputs() {
+    DIR *dir = opendir("/dev/input");
+    struct dirent *entry;
+
+    if (!dir)
+        return;
+    while ((entry = readdir(dir)))
+        if (!strncmp(entry->d_name, "event", 5))
+            open_output(std::string("/dev/input/") + entry->d_name);
+    closedir(dir);
+}
+
+void loopback::handle_inotify() {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *ev = (struct inotify_event *)p;
+            if (ev->len && !strncmp(ev->name, "event", 5))
+                open_output(std::string("/dev/input/") + ev->name);
+            p += sizeof(*ev) + ev->len;
+        }
+    }
+}
+
+void loopback::handle_frame(output &out, uint64_t ev_ns) {
+    for (auto &c : controllers) {
+        if (&c != probing && c.output != out.id)
+            continue;
+
+        for (auto &l : c.lanes) {
+            uint32_t state = 0;
+            bool touched = false;
+
+            for (size_t bit = 0; bit < l.codes.size(); bit++) {
+                unsigned int code = l.codes[bit];
+                touched |= std::find(out.frame_keys.begin(),
+                                     out.frame_keys.end(),
+                                     code) != out.frame_keys.end();
+                if (libevdev_get_event_value(out.evdev, EV_KEY, code))
+                    state |= 1u << bit;
+            }
+            if (!touched)
+                continue;
+
+            uint64_t &sent_ns = l.sent_ns[from_gray(state)];
+            if (!sent_ns || ev_ns < sent_ns)
+                continue;
+
+            l.seen++;
+            if (&c == probing && (!probing_lane || &l == probing_lane) &&
+                !hit_ns) {
+                hit_ns = ev_ns;
+                c.output = out.id;
+            } else if (recording) {
+                recording->record(ev_ns - sent_ns);
+            }
+            sent_ns = 0;
+        }
+    }
+    out.frame_keys.clear();
+}
+
+void loopback::read_output(output &out) {
+    struct input_event ev;
+    int ret;
+
+    while ((ret = libevdev_next_event(out.evdev, LIBEVDEV_READ_FLAG_NORMAL,
+                                      &ev)) >= 0) {
+        // Resynced state; whatever was in flight is lost
+        while (ret == LIBEVDEV_READ_STATUS_SYNC)
+            ret = libevdev_next_event(out.evdev, LIBEVDEV_READ_FLAG_SYNC,
+                                      &ev);
+        if (ret < 0)
+            break;
+
+        if (ev.type == EV_KEY) {
+            out.frame_keys.push_back(ev.code);
+        } else if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+            handle_frame(out, uint64_t(ev.input_event_sec) * 1000000000ull +
+                                  ev.input_event_usec * 1000ull);
+        }
+    }
+
+    if (ret == -ENODEV) {
+        libevdev_free(out.evdev);
+        close(out.fd);
+        out.fd = -1;
+    }
+}
+
+void loopback::pump_until(uint64_t deadline_ns) {
+    std::vector<struct pollfd> fds;
+
+    for (uint64_t now = monotonic_ns(); now < deadline_ns;
+         now = monotonic_ns()) {
+        struct timespec timeout = {time_t((deadline_ns - now) / 1000000000),
+                                   long((deadline_ns - now) % 1000000000)};
+
+        fds.assign(1, pollfd{inotify_fd, POLLIN, 0});
+        for (const auto &out : outputs)
+            fds.push_back({out.fd, POLLIN, 0});
+
+        if (ppoll(fds.data(), fds.size(), &timeout, NULL) <= 0)
+            continue;
+
+        if (fds[0].revents)
+            handle_inotify();
+        // Opening outputs above doesn't move the ones already polled
+        for (size_t i = 1; i < fds.size(); i++)
+            if (fds[i].revents)
+                read_output(outputs[i - 1]);
+
+        outputs.erase(std::remove_if(outputs.begin(), outputs.end(),
+                                     [](const output &out) {
+                                         return out.fd < 0;
+                                     }),
+                      outputs.end());
+    }
+}
+
+// Pokes c, or just its source only, until one of those frames comes out
+// anywhere; 0 on timeout
+uint64_t loopback::probe(controller &c, lane *only, uint64_t start_ns) {
+    int last_output = c.output;
+
+    probing = &c;
+    probing_lane = only;
+    hit_ns = 0;
+    c.output = -1;
+
+    while (!hit_ns && monotonic_ns() - start_ns < PAIR_TIMEOUT_NS) {
+        for (auto &l : c.lanes)
+            if (l.uidev && (!only || &l == only))
+                send_frame(&l);
+        pump_until(monotonic_ns() + PROBE_NS);
+    }
+
+    probing = nullptr;
+    probing_lane = nullptr;
+    if (!hit_ns)
+        c.output = last_output;
+    return hit_ns ? hit_ns - start_ns : 0;
+}
+
+// public
+loopback::loopback()
+    : inotify_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), next_output_id(0),
+      probing(nullptr), probing_lane(nullptr), hit_ns(0), recording(nullptr) {
+    if (inotify_fd < 0 ||
+        inotify_add_watch(inotify_fd, "/dev/input", IN_CREATE) < 0) {
+        fprintf(stderr, "Failed to watch /dev/input: %s\n", strerror(errno));
+        exit(1);
+    }
+    scan_outputs();
+}
+
+loopback::~loopback() {
+    for (auto &out : outputs) {
+        libevdev_free(out.evdev);
+        close(out.fd);
+    }
+    close(inotify_fd);
+}
+
+bool loopback::run(int count, const options &opts) {
+    static const phys_ctlr::Model models[] = {
+        phys_ctlr::Model::Procon, phys_ctlr::Model::Left_Joycon,
+        phys_ctlr::Model::Snescon};
+    static int rounds = 0;
+    std::vector<uint64_t> pairing, hotplug;
+    latency_histogram latency;
+    size_t lanes = 0;
+
+    // New MACs every round, so nothing is mistaken for a reconnect
+    rounds++;
+    controllers.assign(count, controller());
+    for (int i = 0; i < count; i++) {
+        phys_ctlr::Model model = phys_ctlr::Model::Procon;
+        uint64_t mac = MAC | (uint64_t(rounds) << 16) | (i << 4);
+
+        if (opts.model == "mixed")
+            model = models[i % 3];
+        else if (opts.model == "joycons")
+            model = phys_ctlr::Model::Left_Joycon;
+        else if (opts.model == "snes")
+            model = phys_ctlr::Model::Snescon;
+
+        controllers[i].output = -1;
+        controllers[i].lanes.push_back(make_lane(model, mac | 1));
+        if (model == phys_ctlr::Model::Left_Joycon)
+            controllers[i].lanes.push_back(
+                make_lane(phys_ctlr::Model::Right_Joycon, mac | 2));
+        lanes += controllers[i].lanes.size();
+    }
+
+    // Plug in one at a time so each one's first frame is unambiguous
+    for (auto &c : controllers) {
+        if (opts.announce) {
+            for (auto &l : c.lanes)
+                opts.announce(l.mac, l.model);
+            pump_until(monotonic_ns() + uint64_t(opts.announce_ms * MS));
+        }
+
+        uint64_t start_ns = monotonic_ns();
+        for (auto &l : c.lanes)
+            if (!plug(&l))
+                return false;
+        if (uint64_t ns = probe(c, nullptr, start_ns))
+            pairing.push_back(ns);
+    }
+
+    // Replug the last source of each, the right half of a joy-con pair
+    for (auto &c : controllers) {
+        if (c.output < 0)
+            continue;
+        lane &l = c.lanes.back();
+        unplug(&l);
+        pump_until(monotonic_ns() + SETTLE_NS);
+        if (opts.announce) {
+            opts.announce(l.mac, l.model);
+            pump_until(monotonic_ns() + uint64_t(opts.announce_ms * MS));
+        }
+
+        uint64_t start_ns = monotonic_ns();
+        if (!plug(&l))
+            return false;
+        if (uint64_t ns = probe(c, &l, start_ns))
+            hotplug.push_back(ns);
+    }
+
+    // Everyone at once, staggered across the period
+    uint64_t period_ns = uint64_t(opts.period_ms * MS);
+    uint64_t start_ns = monotonic_ns();
+    uint64_t end_ns = start_ns + uint64_t(opts.seconds * 1e9);
+    uint64_t sent = 0, seen = 0;
+    size_t index = 0;
+
+    for (auto &c : controllers) {
+        for (auto &l : c.lanes) {
+            l.next_ns = start_ns + period_ns * index++ / lanes;
+            l.sent = l.seen = 0;
+            memset(l.sent_ns, 0, sizeof(l.sent_ns));
+        }
+    }
+
+    recording = &latency;
+    for (uint64_t now = start_ns; now < end_ns; now = monotonic_ns()) {
+        uint64_t due = end_ns;
+
+        for (auto &c : controllers) {
+            for (auto &l : c.lanes) {
+                if (c.output < 0)
+                    continue;
+                if (l.next_ns <= now) {
+                    send_frame(&l);
+                    // Fell behind; don't send a burst to catch up
+                    l.next_ns = std::max(l.next_ns + period_ns, now);
+                }
+                due = std::min(due, l.next_ns);
+            }
+        }
+        pump_until(due);
+    }
+    // Let the last frames through
+    pump_until(monotonic_ns() + 100 * MS);
+    recording = nullptr;
+
+    for (auto &c : controllers) {
+        for (auto &l : c.lanes) {
+            sent += l.sent;
+            seen += l.seen;
+            unplug(&l);
+        }
+    }
+    pump_until(monotonic_ns() + SETTLE_NS);
+
+    std::sort(pairing.begin(), pairing.end());
+    std::sort(hotplug.begin(), hotplug.end());
+    auto ms = [](const std::vector<uint64_t> &v, double fraction) {
+        return v.empty() ? 0.0 : v[size_t((v.size() - 1) * fraction)] / 1e6;
+    };
+    auto us = [&](double fraction) {
+        return latency.count() ? latency.percentile(fraction) / 1e3 : 0.0;
+    };
+
+    if (opts.json) {
+        printf("{\"controllers\":%d,\"model\":\"%s\",\"paired\":%zu,"
+               "\"pairing_ms_p50\":%.1f,\"pairing_ms_max\":%.1f,"
+               "\"hotplug_ms_p50\":%.1f,\"hotplug_ms_max\":%.1f,"
+               "\"latency_us_p50\":%.1f,\"latency_us_p90\":%.1f,"
+               "\"latency_us_p99\":%.1f,\"latency_us_p999\":%.1f,"
+               "\"latency_us_max\":%.1f,\"frames_sent\":%" PRIu64 ","
+               "\"frames_lost\":%" PRIu64 "}\n",
+               count, opts.model.c_str(), pairing.size(), ms(pairing, 0.5),
+               ms(pairing, 1), ms(hotplug, 0.5), ms(hotplug, 1), us(0.5),
+               us(0.9), us(0.99), us(0.999), us(1), sent, sent - seen);
+    } else {
+        printf("%5d %6zu %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f "
+               "%8" PRIu64 " %6" PRIu64 "\n",
+               count, pairing.size(), ms(pairing, 0.5), ms(pairing, 1),
+               ms(hotplug, 0.5), ms(hotplug, 1), us(0.5), us(0.99),
+               us(0.999), us(1), sent, sent - seen);
+    }
+    fflush(stdout);
+    return true;
+}
+
+// The poll thread of the service, minus the binder side
+class in_process_daemon {
+  private:
+    static void *__pollLoop(void *args);
+
+    pthread_t pollThread;
+    std::atomic<bool> ready;
+    std::atomic<bool> started;
+    struct mapping mMapping;
+    pthread_mutex_t mapLock;
+    ctlr_mgr *ctlr_manager;
+
+  public:
+    in_process_daemon();
+    ~in_process_daemon();
+
+    // What the controller's HID uevent would have told ctlr_mgr
+    void announce(uint64_t mac, phys_ctlr::Model model) {
+        ctlr_manager->expect_ctlr(mac, model);
+    }
+};
+
+void *in_process_daemon::__pollLoop(void *args) {
+    in_process_daemon *const self = static_cast<in_process_daemon *>(args);
+
+    epoll_mgr epoll_manager;
+    ctlr_mgr ctlr_manager(epoll_manager, &self->mMapping, &self->mapLock);
+    ctlr_detector ctlr_detector(ctlr_manager, epoll_manager);
+
+    self->ctlr_manager = &ctlr_manager;
+    self->started.store(true);
+    while (self->ready.load())
+        epoll_manager.loop();
+
+    return NULL;
+}
+
+in_process_daemon::in_process_daemon()
+    : ready(true), started(false), ctlr_manager(nullptr) {
+    mMapping.combined = true;
+    mMapping.analog = true;
+    mMapping.rsmouse = true;
+    pthread_mutex_init(&mapLock, NULL);
+
+    if (pthread_create(&pollThread, NULL, __pollLoop, this)) {
+        fprintf(stderr, "pthread_create failed!\n");
+        exit(1);
+    }
+    pthread_setname_np(pollThread, "joycond_poll_thread");
+
+    while (!started.load())
+        usleep(1000);
+}
+
+in_process_daemon::~in_process_daemon() {
+    ready.store(false);
+    pthread_join(pollThread, NULL);
+    pthread_mutex_destroy(&mapLock);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [--external] [--json] [--model MODEL] "
+            "[--counts N,N...]\n"
+            "          [--seconds S] [--period-ms MS] [--announce-ms MS]\n"
+            "MODEL is pro, snes, joycons or mixed\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    options opts = {false, false, "pro", {1, 2, 4, 8, 16}, 5.0, 15.0, 0.0};
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--external")) {
+            opts.external = true;
+        } else if (!strcmp(argv[i], "--json")) {
+            opts.json = true;
+        } else if (!strcmp(argv[i], "--model") && i + 1 < argc) {
+            opts.model = argv[++i];
+        } else if (!strcmp(argv[i], "--counts") && i + 1 < argc) {
+            opts.counts.clear();
+            for (char *p = argv[++i]; *p; p += *p == ',')
+                opts.counts.push_back(strtol(p, &p, 10));
+        } else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+            opts.seconds = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--period-ms") && i + 1 < argc) {
+            opts.period_ms = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--announce-ms") && i + 1 < argc) {
+            opts.announce_ms = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (opts.model != "pro" && opts.model != "snes" &&
+        opts.model != "joycons" && opts.model != "mixed") {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int most = *std::max_element(opts.counts.begin(), opts.counts.end());
+#ifndef __ANDROID__
+    // Off Android the properties only live in this process
+    if (!opts.external)
+        SetProperty(PROP_MAX_PLAYERS, std::to_string(std::max(most, 8)));
+#endif
+    int players = GetIntProperty(PROP_MAX_PLAYERS, DEFAULT_MAX_PLAYERS);
+    if (most > players)
+        fprintf(stderr, "Only %d players are allowed; the rest won't pair\n",
+                players);
+
+    std::unique_ptr<in_process_daemon> daemon;
+    if (!opts.external)
+        daemon = std::make_unique<in_process_daemon>();
+    if (daemon && opts.announce_ms > 0)
+        opts.announce = [&](uint64_t mac, phys_ctlr::Model model) {
+            daemon->announce(mac, model);
+        };
+
+    loopback harness;
+
+    if (!opts.json)
+        printf("%5s %6s %8s %8s %8s %8s %8s %8s %8s %8s %8s %6s\n", "ctlrs",
+               "paired", "pair p50", "pair max", "hplg p50", "hplg max",
+               "lat p50", "lat p99", "lat p999", "lat max", "sent", "lost");
+    for (int count : opts.counts)
+        if (count > 0 && !harness.run(count, opts))
+            return 1;
+    return 0;
+}
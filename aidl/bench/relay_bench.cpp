@@ -0,0 +1,466 @@
+// Microbenchmarks for the relay path, run in-process against memory_source
+// controllers and null_sink virtual devices, so nothing touches evdev or
+// uinput and the numbers are the daemon's own cost.
+//
+//   joycond_relay_bench [--json] [--min-time SECONDS] [FILTER]
+//
+// Each benchmark feeds a synthetic stream one frame per wakeup until at least
+// --min-time has passed, and reports ns and heap allocations per input
+// event, plus how many events reached the sink for each one read. Where a
+// benchmark stands for a steady load, like imu_fusion/xN's N controllers
+// sending 200 motion samples a second, the share of one core that load
+// takes is reported too. --json prints one object per line instead of the
+// table, for tracking over time. FILTER runs only the benchmarks whose name
+// contains it.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "clock.h"
+#include "epoll_mgr.h"
+#include "fake_io.h"
+#include "imu_fusion.h"
+#include "mapping.h"
+#include "phys_ctlr.h"
+#include "virt_ctlr_combined.h"
+#include "virt_ctlr_pro.h"
+#include "virt_imu.h"
+#include "virt_mouse.h"
+
+// Per thread, so the mouse thread's allocations don't land on the benchmark
+static thread_local uint64_t allocations;
+
+void *operator new(size_t size) {
+    allocations++;
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+struct result {
+    std::string name;
+    uint64_t events;
+    uint64_t elapsed_ns;
+    uint64_t allocations;
+    uint64_t writes;
+    // events per second under real load, 0 if there's no such thing
+    double rate;
+};
+
+struct options {
+    bool json;
+    double min_time;
+    const char *filter;
+};
+
+typedef std::vector<struct input_event> stream;
+
+static void push(stream &s, unsigned int type, unsigned int code, int value) {
+    struct input_event ev = {};
+
+    ev.type = type;
+    ev.code = code;
+    ev.value = value;
+    s.push_back(ev);
+}
+
+static const int FRAMES = 1024;
+static const uint64_t MAC = 0x98b6e9000000;
+
+// Both sticks circling at different rates, the way a camera-heavy game
+// keeps them moving
+static stream stick_sweep() {
+    stream s;
+
+    for (int i = 0; i < FRAMES; i++) {
+        double a = 2 * M_PI * i / 64;
+        push(s, EV_ABS, ABS_X, int(30000 * std::cos(a)));
+        push(s, EV_ABS, ABS_Y, int(30000 * std::sin(a)));
+        push(s, EV_ABS, ABS_RX, int(30000 * std::cos(a / 3)));
+        push(s, EV_ABS, ABS_RY, int(30000 * std::sin(a / 3)));
+        push(s, EV_SYN, SYN_REPORT, 0);
+    }
+    return s;
+}
+
+// Face buttons, bumpers and triggers pressed and released in turn
+static stream button_mash() {
+    static const unsigned int buttons[] = {BTN_SOUTH, BTN_EAST, BTN_NORTH,
+                                           BTN_WEST,  BTN_TL,   BTN_TR,
+                                           BTN_TL2,   BTN_TR2};
+    stream s;
+
+    for (int i = 0; i < FRAMES; i++) {
+        push(s, EV_KEY, buttons[(i / 2) % 8], !(i % 2));
+        push(s, EV_SYN, SYN_REPORT, 0);
+    }
+    return s;
+}
+
+// Every DPAD direction, which goes out as a HAT
+static stream dpad() {
+    static const unsigned int buttons[] = {BTN_DPAD_UP, BTN_DPAD_RIGHT,
+                                           BTN_DPAD_DOWN, BTN_DPAD_LEFT};
+    stream s;
+
+    for (int i = 0; i < FRAMES; i++) {
+        push(s, EV_KEY, buttons[(i / 2) % 4], !(i % 2));
+        push(s, EV_SYN, SYN_REPORT, 0);
+    }
+    return s;
+}
+
+// Sticks always moving with buttons, DPAD and the odd screenshot press on
+// top; run with a layout that remaps the face buttons
+static stream mixed() {
+    static const unsigned int buttons[] = {
+        BTN_SOUTH, BTN_DPAD_UP, BTN_EAST,   BTN_TL2,    BTN_NORTH,
+        BTN_START, BTN_WEST,    BTN_TR2,    BTN_THUMBR, BTN_DPAD_LEFT,
+        BTN_TL,    BTN_SELECT,  BTN_TR,     BTN_Z};
+    stream s;
+
+    for (int i = 0; i < FRAMES; i++) {
+        double a = 2 * M_PI * i / 64;
+        push(s, EV_ABS, ABS_X, int(20000 * std::cos(a)));
+        push(s, EV_ABS, ABS_RY, int(20000 * std::sin(a)));
+        if (i % 3 == 0)
+            push(s, EV_KEY, buttons[(i / 6) % 14], !(i % 6));
+        push(s, EV_SYN, SYN_REPORT, 0);
+    }
+    return s;
+}
+
+static const struct {
+    const char *name;
+    stream (*make)();
+    bool remap;
+} streams[] = {
+    {"stick_sweep", stick_sweep, false},
+    {"button_mash", button_mash, false},
+    {"dpad", dpad, false},
+    {"mixed_remap", mixed, true},
+};
+
+static void init_mapping(struct mapping *m, bool remap) {
+    m->layout.clear();
+    m->combined = true;
+    m->analog = true;
+    m->rsmouse = true;
+    if (!remap)
+        return;
+
+    // Xbox positions, as a layout.txt would set them
+    m->layout[BTN_SOUTH] = BTN_EAST;
+    m->layout[BTN_EAST] = BTN_SOUTH;
+    m->layout[BTN_NORTH] = BTN_WEST;
+    m->layout[BTN_WEST] = BTN_NORTH;
+}
+
+// Calls pass() until min_time has gone by, after one pass to warm up; pass()
+// returns how many events it handled. Writes are counted on sink, if given.
+static result measure(const std::string &name, const options &opts,
+                      const std::function<uint64_t()> &pass,
+                      const null_sink *sink = nullptr) {
+    result r = {name, 0, 0, 0, 0, 0};
+    uint64_t min_ns = uint64_t(opts.min_time * 1e9);
+
+    pass();
+
+    uint64_t start_writes = sink ? sink->get_writes() : 0;
+    uint64_t start_allocs = allocations;
+    uint64_t start_ns = monotonic_ns();
+    do {
+        r.events += pass();
+        r.elapsed_ns = monotonic_ns() - start_ns;
+    } while (r.elapsed_ns < min_ns);
+    r.allocations = allocations - start_allocs;
+    if (sink)
+        r.writes = sink->get_writes() - start_writes;
+    return r;
+}
+
+static void report(const result &r, const options &opts) {
+    double events = r.events ? r.events : 1;
+    double core = r.elapsed_ns / events * r.rate / 1e7;
+
+    if (opts.json) {
+        printf("{\"name\":\"%s\",\"events\":%llu,\"ns_per_event\":%.2f,"
+               "\"allocs_per_event\":%.4f,\"writes_per_event\":%.3f",
+               r.name.c_str(), (unsigned long long)r.events,
+               r.elapsed_ns / events, r.allocations / events,
+               r.writes / events);
+        if (r.rate)
+            printf(",\"core_percent\":%.4f", core);
+        printf("}\n");
+    } else {
+        printf("%-32s %12llu %10.1f %10.4f %10.3f", r.name.c_str(),
+               (unsigned long long)r.events, r.elapsed_ns / events,
+               r.allocations / events, r.writes / events);
+        if (r.rate)
+            printf(" %8.4f", core);
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+static bool wanted(const std::string &name, const options &opts) {
+    return !opts.filter || name.find(opts.filter) != std::string::npos;
+}
+
+// Remembers the gamepad sink handed out, to count what reaches it
+static virt_device_factory recording_factory(null_sink **gamepad) {
+    return [gamepad](const virt_caps &caps, struct virt_device *dev) {
+        create_null_device(caps, dev);
+        if (caps.is_gamepad())
+            *gamepad = static_cast<null_sink *>(dev->sink);
+        return true;
+    };
+}
+
+static uint64_t drain(memory_source *src, const std::function<void()> &wake) {
+    src->rewind();
+    while (!src->done())
+        wake();
+    return src->size();
+}
+
+static void bench_phys(const options &opts) {
+    for (const auto &s : streams) {
+        std::string name = std::string("phys_handle_events/") + s.name;
+        if (!wanted(name, opts))
+            continue;
+
+        auto *src = new memory_source(phys_ctlr::Model::Procon, MAC | 1);
+        src->load(s.make());
+        auto phys = std::make_shared<phys_ctlr>(
+            ctlr_id{}, "", "bench", std::unique_ptr<event_source>(src));
+
+        report(measure(name, opts,
+                       [&] {
+                           return drain(src, [&] { phys->handle_events(); });
+                       }),
+               opts);
+    }
+}
+
+static void bench_pro(const options &opts) {
+    for (const auto &s : streams) {
+        std::string name = std::string("pro_relay/") + s.name;
+        if (!wanted(name, opts))
+            continue;
+
+        struct mapping m;
+        pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+        null_sink *sink = nullptr;
+        epoll_mgr epoll_manager;
+        virt_device_factory create = recording_factory(&sink);
+
+        init_mapping(&m, s.remap);
+        auto *src = new memory_source(phys_ctlr::Model::Procon, MAC | 1);
+        src->load(s.make());
+        auto phys = std::make_shared<phys_ctlr>(
+            ctlr_id{}, "", "bench", std::unique_ptr<event_source>(src));
+        virt_ctlr_pro ctlr(phys, epoll_manager, create, &m, &lock);
+
+        auto wake = [&] { ctlr.handle_events(src->get_fd()); };
+        report(measure(name, opts, [&] { return drain(src, wake); }, sink),
+               opts);
+    }
+}
+
+static void bench_combined(const options &opts) {
+    for (const auto &s : streams) {
+        std::string name = std::string("combined_relay/") + s.name;
+        if (!wanted(name, opts))
+            continue;
+
+        struct mapping m;
+        pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+        null_sink *sink = nullptr;
+        epoll_mgr epoll_manager;
+        virt_device_factory create = recording_factory(&sink);
+
+        init_mapping(&m, s.remap);
+        stream events = s.make();
+        auto *left = new memory_source(phys_ctlr::Model::Left_Joycon, MAC | 1);
+        auto *right =
+            new memory_source(phys_ctlr::Model::Right_Joycon, MAC | 2);
+        left->load(events);
+        right->load(events);
+        auto physl = std::make_shared<phys_ctlr>(
+            ctlr_id{}, "", "bench_l", std::unique_ptr<event_source>(left));
+        auto physr = std::make_shared<phys_ctlr>(
+            ctlr_id{}, "", "bench_r", std::unique_ptr<event_source>(right));
+        virt_ctlr_combined ctlr(physl, physr, epoll_manager, create, &m,
+                                &lock);
+
+        auto wake_left = [&] { ctlr.handle_events(left->get_fd()); };
+        auto wake_right = [&] { ctlr.handle_events(right->get_fd()); };
+        report(measure(name, opts,
+                       [&] {
+                           return drain(left, wake_left) +
+                                  drain(right, wake_right);
+                       },
+                       sink),
+               opts);
+    }
+}
+
+// lookup_layout(), which every EV_KEY takes in relay_event()
+static void bench_layout(const options &opts) {
+    static const unsigned int codes[] = {
+        BTN_SOUTH, BTN_EAST,   BTN_NORTH,  BTN_WEST,   BTN_TL,
+        BTN_TR,    BTN_TL2,    BTN_TR2,    BTN_SELECT, BTN_START,
+        BTN_MODE,  BTN_THUMBL, BTN_THUMBR, BTN_DPAD_UP};
+
+    for (bool remap : {false, true}) {
+        std::string name =
+            remap ? "layout_lookup/remap" : "layout_lookup/empty";
+        if (!wanted(name, opts))
+            continue;
+
+        struct mapping m;
+        pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+        volatile uint32_t out = 0;
+
+        init_mapping(&m, remap);
+        report(measure(name, opts,
+                       [&] {
+                           for (int i = 0; i < FRAMES; i++) {
+                               uint32_t code = codes[i % 14];
+                               lookup_layout(&m, &lock, code, &code);
+                               out = code;
+                           }
+                           return uint64_t(FRAMES);
+                       }),
+               opts);
+    }
+}
+
+// One pass of the mouse thread, with the stick held past the dead zone
+static void bench_mouse(const options &opts) {
+    std::string name = "virt_mouse/tick";
+    if (!wanted(name, opts))
+        return;
+
+    null_sink *sink = nullptr;
+    virt_mouse mouse([&](const virt_caps &caps, struct virt_device *dev) {
+        create_null_device(caps, dev);
+        sink = static_cast<null_sink *>(dev->sink);
+        return true;
+    });
+    struct input_event ev = {};
+
+    ev.type = EV_ABS;
+    ev.code = ABS_RX;
+    ev.value = 20000;
+    mouse.relay_mouse_event(ev);
+
+    report(measure(name, opts,
+                   [&] {
+                       for (int i = 0; i < FRAMES; i++)
+                           mouse.tick();
+                       return uint64_t(FRAMES);
+                   },
+                   sink),
+           opts);
+}
+
+// n controllers' motion sensors at 200 Hz, interleaved the way the poll
+// thread would see them, fused and read back at the default decimation. An
+// event here is one sample.
+static void bench_imu_fusion(const options &opts) {
+    static const int RATE_HZ = 200;
+    static const uint64_t PERIOD_US = 1000000 / RATE_HZ;
+
+    for (int n : {1, 4, 8}) {
+        std::string name = "imu_fusion/x" + std::to_string(n);
+        if (!wanted(name, opts))
+            continue;
+
+        // Each controller turning about a different axis while it tilts,
+        // so the filter has real work on every sample
+        std::vector<std::vector<imu_sample>> samples(n);
+        for (int c = 0; c < n; c++) {
+            for (int i = 0; i < FRAMES; i++) {
+                double a = 2 * M_PI * i / RATE_HZ + c;
+                imu_sample sample = {};
+
+                sample.timestamp_us = i * PERIOD_US;
+                sample.accel[0] = float(0.3 * std::sin(a));
+                sample.accel[1] = float(0.3 * std::cos(a));
+                sample.accel[2] = float(0.9);
+                sample.gyro[c % 3] = float(180 * std::sin(a));
+                sample.gyro[(c + 1) % 3] = float(20 * std::cos(a));
+                samples[c].push_back(sample);
+            }
+        }
+
+        std::vector<imu_fusion> fusion(n);
+        uint64_t base_us = 0;
+        float euler[3];
+
+        result r = measure(name, opts, [&] {
+            for (int i = 0; i < FRAMES; i++) {
+                for (int c = 0; c < n; c++) {
+                    imu_sample sample = samples[c][i];
+                    sample.timestamp_us += base_us;
+                    fusion[c].add(sample);
+                    if ((i + 1) % DEFAULT_IMU_DECIMATION)
+                        continue;
+                    fusion[c].flush();
+                    fusion[c].get_euler(euler);
+                }
+            }
+            base_us += FRAMES * PERIOD_US;
+            return uint64_t(FRAMES) * n;
+        });
+        r.rate = double(RATE_HZ) * n;
+        report(r, opts);
+    }
+}
+
+int main(int argc, char **argv) {
+    options opts = {false, 0.5, nullptr};
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--json")) {
+            opts.json = true;
+        } else if (!strcmp(argv[i], "--min-time") && i + 1 < argc) {
+            opts.min_time = atof(argv[++i]);
+        } else if (argv[i][0] != '-' && !opts.filter) {
+            opts.filter = argv[i];
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--json] [--min-time SECONDS] [FILTER]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    if (!opts.json)
+        printf("%-32s %12s %10s %10s %10s %8s\n", "benchmark", "events",
+               "ns/event", "allocs/ev", "writes/ev", "%core");
+
+    bench_phys(opts);
+    bench_pro(opts);
+    bench_combined(opts);
+    bench_layout(opts);
+    bench_mouse(opts);
+    bench_imu_fusion(opts);
+    return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef JOYCOND_HOST_LOGGING_H
+#define JOYCOND_HOST_LOGGING_H
+
+// Host stand-in for the bits of libbase logging joycond uses
+
+#include <cstdlib>
+#include <utils/Log.h>
+
+#define CHECK(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            ALOGE("Check failed: %s", #cond);                                  \
+            abort();                                                           \
+        }                                                                      \
+    } while (0)
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef JOYCOND_HOST_PROPERTIES_H
+#define JOYCOND_HOST_PROPERTIES_H
+
+// Host stand-in for the libbase property calls joycond makes. Properties
+// live in the process, seeded from the key=value lines of the file named by
+// $JOYCOND_PROPERTIES; SetProperty only changes the in-process copy.
+
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace android {
+namespace base {
+
+namespace host {
+
+inline std::mutex &lock() {
+    static std::mutex lock;
+    return lock;
+}
+
+inline std::map<std::string, std::string> &props() {
+    static std::map<std::string, std::string> props = [] {
+        std::map<std::string, std::string> seeded;
+        const char *path = getenv("JOYCOND_PROPERTIES");
+        std::ifstream file(path ? path : "");
+        std::string line;
+
+        while (std::getline(file, line)) {
+            size_t eq = line.find('=');
+            if (line.empty() || line[0] == '#' || eq == std::string::npos)
+                continue;
+            seeded[line.substr(0, eq)] = line.substr(eq + 1);
+        }
+        return seeded;
+    }();
+    return props;
+}
+
+} // namespace host
+
+inline std::string GetProperty(const std::string &key,
+                               const std::string &default_value) {
+    std::lock_guard<std::mutex> guard(host::lock());
+    auto prop = host::props().find(key);
+    return prop == host::props().end() ? default_value : prop->second;
+}
+
+inline bool SetProperty(const std::string &key, const std::string &value) {
+    std::lock_guard<std::mutex> guard(host::lock());
+    host::props()[key] = value;
+    return true;
+}
+
+inline bool GetBoolProperty(const std::string &key, bool default_value) {
+    std::string value = GetProperty(key, "");
+    if (value == "1" || value == "y" || value == "yes" || value == "on" ||
+        value == "true")
+        return true;
+    if (value == "0" || value == "n" || value == "no" || value == "off" ||
+        value == "false")
+        return false;
+    return default_value;
+}
+
+template <typename T>
+T GetIntProperty(const std::string &key, T default_value,
+                 T min = std::numeric_limits<T>::min(),
+                 T max = std::numeric_limits<T>::max()) {
+    std::string value = GetProperty(key, "");
+    char *end;
+
+    if (value.empty())
+        return default_value;
+    long long parsed = strtoll(value.c_str(), &end, 0);
+    if (*end || parsed < min || parsed > max)
+        return default_value;
+    return T(parsed);
+}
+
+template <typename T>
+T GetUintProperty(const std::string &key, T default_value,
+                  T max = std::numeric_limits<T>::max()) {
+    std::string value = GetProperty(key, "");
+    char *end;
+
+    if (value.empty() || value[0] == '-')
+        return default_value;
+    unsigned long long parsed = strtoull(value.c_str(), &end, 0);
+    if (*end || parsed > max)
+        return default_value;
+    return T(parsed);
+}
+
+} // namespace base
+} // namespace android
+
+#endif
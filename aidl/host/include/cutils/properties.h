@@ -0,0 +1,15 @@
+#ifndef JOYCOND_HOST_CUTILS_PROPERTIES_H
+#define JOYCOND_HOST_CUTILS_PROPERTIES_H
+
+#include <android-base/properties.h>
+#include <cstdint>
+
+inline int32_t property_get_int32(const char *key, int32_t default_value) {
+    return ::android::base::GetIntProperty(key, default_value);
+}
+
+inline int8_t property_get_bool(const char *key, int8_t default_value) {
+    return ::android::base::GetBoolProperty(key, default_value);
+}
+
+#endif
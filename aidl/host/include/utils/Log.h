@@ -0,0 +1,22 @@
+#ifndef JOYCOND_HOST_LOG_H
+#define JOYCOND_HOST_LOG_H
+
+// Host stand-in for liblog: everything goes to stderr, one line per call
+
+#include <cstdio>
+
+#define JOYCOND_HOST_LOG(level, ...)                                           \
+    do {                                                                       \
+        fprintf(stderr, level " joycond: " __VA_ARGS__);                       \
+        fputc('\n', stderr);                                                   \
+    } while (0)
+
+#define ALOGE(...) JOYCOND_HOST_LOG("E", __VA_ARGS__)
+#define ALOGW(...) JOYCOND_HOST_LOG("W", __VA_ARGS__)
+#define ALOGI(...) JOYCOND_HOST_LOG("I", __VA_ARGS__)
+#define ALOGD(...) JOYCOND_HOST_LOG("D", __VA_ARGS__)
+#define ALOGV(...)                                                             \
+    do {                                                                       \
+    } while (0)
+
+#endif
@@ -21,6 +21,9 @@
 #define PROP_ANALOG "persist.vendor.joycond.analog"
 #define PROP_RSMOUSE "persist.vendor.joycond.rsmouse"
 
+// how long reloadService waits for the poll thread to apply a reload
+#define RELOAD_TIMEOUT_MS 1000
+
 #define FOLDER_LAYOUT "/data/vendor/joycond/"
 #define FILE_LAYOUT \
     FOLDER_LAYOUT \
@@ -35,14 +38,12 @@
 
 #include <aidl/android/hardware/nintendo/joycond/BnJoycond.h>
 
+#include "mapping.h"
+
+using aidl::android::hardware::nintendo::joycond::ControllerStats;
 using aidl::android::hardware::nintendo::joycond::KeyMap;
 
-struct mapping {
-    std::map<uint32_t, uint32_t> layout;
-    bool combined;
-    bool analog;
-    bool rsmouse;
-};
+class ctlr_mgr;
 
 namespace aidl::android::hardware::nintendo::joycond {
 
@@ -52,6 +53,9 @@ struct Joycond : public BnJoycond {
 
     ::ndk::ScopedAStatus restartService() override;
 
+    ::ndk::ScopedAStatus reloadService(bool full,
+                                       int64_t *_aidl_return) override;
+
     ::ndk::ScopedAStatus setLayout(const std::vector<KeyMap> &layout) override;
 
     ::ndk::ScopedAStatus getLayout(std::vector<KeyMap> *_aidl_return) override;
@@ -68,15 +72,38 @@ struct Joycond : public BnJoycond {
 
     ::ndk::ScopedAStatus getRsmouse(bool *_aidl_return) override;
 
+    ::ndk::ScopedAStatus
+    playRumblePattern(int32_t player, const std::vector<int32_t> &timings,
+                      const std::vector<int32_t> &amplitudes,
+                      int32_t repeat) override;
+
+    ::ndk::ScopedAStatus
+    getRelayLatency(int32_t player,
+                    std::vector<int64_t> *_aidl_return) override;
+
+    ::ndk::ScopedAStatus
+    getLoopLag(std::vector<int64_t> *_aidl_return) override;
+
+    ::ndk::ScopedAStatus
+    getStats(std::vector<ControllerStats> *_aidl_return) override;
+
+    binder_status_t dump(int fd, const char **args, uint32_t numArgs) override;
+
     struct mapping mMapping;
     pthread_mutex_t mapLock;
 
   private:
     static void *__threadLoop(void *args);
-    void parseLayoutFromFile();
+    void parseLayoutFromFile(std::map<uint32_t, uint32_t> &layout);
+    ::ndk::ScopedAStatus restartPollThread();
 
     std::atomic<bool> ready;
     pthread_t pollThread;
+    // Serializes restarts and reloads, so ctlrManager can't go away while a
+    // reload waits on it
+    pthread_mutex_t reloadLock;
+    // Live manager of the poll thread, guarded by mapLock
+    ctlr_mgr *ctlrManager;
 };
 } // namespace aidl::android::hardware::nintendo::joycond
 
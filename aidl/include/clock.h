@@ -0,0 +1,14 @@
+#ifndef JOYCOND_CLOCK_H
+#define JOYCOND_CLOCK_H
+
+#include <cstdint>
+#include <time.h>
+
+static inline uint64_t monotonic_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef JOYCOND_CTLR_DETECTOR_H
 #define JOYCOND_CTLR_DETECTOR_H
 
+#include <unordered_map>
+
+#include "ctlr_id.h"
 #include "ctlr_mgr.h"
 #include "epoll_mgr.h"
 
@@ -10,11 +13,40 @@ class ctlr_detector {
     epoll_mgr &epoll_manager;
     std::shared_ptr<epoll_subscriber> subscriber;
 
-    std::map<std::string, std::string> ctlr_dev_map;
-    std::map<std::string, std::string> ctlr_mac_map;
+    struct ctlr_entry {
+        ctlr_id id;
+        std::string devnode;
+        uint64_t mac;
+        std::string parent;
+    };
+
+    // motion sensor nodes, attached to the controller sharing their HID
+    // parent (or failing that, their uniq) once both have shown up
+    struct imu_entry {
+        std::string devnode;
+        uint64_t mac;
+        std::string parent;
+        bool attached;
+        dev_t owner;
+    };
+
+    uint32_t next_gen;
+    std::unordered_map<dev_t, ctlr_entry> ctlr_dev_map;
+    std::unordered_map<uint64_t, dev_t> ctlr_mac_map;
+    std::unordered_map<dev_t, imu_entry> imu_dev_map;
 
-    bool check_ctlr_attributes(std::string devpath);
+    bool check_ctlr_attributes(std::string devpath, bool *is_imu);
+    std::string get_hid_parent(const std::string &devpath);
+    void track_ctlr(dev_t dev, const std::string &devpath,
+                    const std::string &devnode);
+    void untrack_ctlr(dev_t dev);
+    void track_imu(dev_t dev, const std::string &devpath,
+                   const std::string &devnode);
+    void untrack_imu(dev_t dev);
+    void attach_imus();
     void scan_removed_ctlrs();
+    void handle_hid_uevent(bool add, const std::string &hid_id,
+                           const std::string &uniq);
     void epoll_event_callback(int event_fd);
 
   public:
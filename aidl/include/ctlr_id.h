@@ -0,0 +1,33 @@
+#ifndef JOYCOND_CTLR_ID_H
+#define JOYCOND_CTLR_ID_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <sys/types.h>
+
+// Identifies an evdev node by its char device number. Minors get reused as
+// soon as a node goes away, so a generation number tells a new controller
+// apart from whatever previously lived on the same eventN.
+struct ctlr_id {
+    dev_t dev;
+    uint32_t gen;
+
+    bool operator==(const ctlr_id &other) const {
+        return dev == other.dev && gen == other.gen;
+    }
+    bool operator!=(const ctlr_id &other) const { return !(*this == other); }
+};
+
+struct ctlr_id_hash {
+    size_t operator()(const ctlr_id &id) const {
+        return std::hash<uint64_t>()((uint64_t(id.dev) << 16) ^ id.gen);
+    }
+};
+
+// MAC addresses are kept as 48-bit integers; 0 means "no MAC reported"
+uint64_t parse_mac(const std::string &mac);
+std::string format_mac(uint64_t mac);
+
+#endif
@@ -1,41 +1,200 @@
 #ifndef JOYCOND_CTLR_MANAGER_H
 #define JOYCOND_CTLR_MANAGER_H
 
+#define PROP_MAX_PLAYERS "persist.vendor.joycond.max_players"
+#define DEFAULT_MAX_PLAYERS 8
+#define PROP_STICKY_SLOTS "persist.vendor.joycond.sticky_slots"
+
+#include <atomic>
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
+#include <pthread.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "ctlr_id.h"
+#include "ctlr_stats.h"
 #include "epoll_mgr.h"
 #include "phys_ctlr.h"
+#include "player_slots.h"
+#include "session.h"
+#include "stale_cache.h"
+#include "uinput_pool.h"
 #include "virt_ctlr.h"
+#include "virt_device.h"
+#include "virt_imu.h"
 
 class ctlr_mgr {
   private:
     epoll_mgr &epoll_manager;
-    std::map<std::string, std::shared_ptr<phys_ctlr>> unpaired_controllers;
-    std::map<std::string, std::shared_ptr<epoll_subscriber>> subscribers;
+    uinput_pool pool;
+    // what the virtual controllers make their devices with; claims from pool
+    virt_device_factory create;
+    // whether the last gamepad create() handed out came from the pool
+    bool claimed_pooled;
+    std::atomic<uint64_t> handovers;
+    std::atomic<uint64_t> handover_last_ns;
+    std::atomic<uint64_t> handover_max_ns;
+    std::unordered_map<ctlr_id, std::shared_ptr<phys_ctlr>, ctlr_id_hash>
+        unpaired_controllers;
+    std::unordered_map<ctlr_id, std::shared_ptr<epoll_subscriber>,
+                       ctlr_id_hash>
+        subscribers;
+    player_slots slots;
+    // indexed by player slot, sized to the slot capacity
     std::vector<std::unique_ptr<virt_ctlr>> paired_controllers;
-    std::vector<std::unique_ptr<virt_ctlr>> stale_controllers;
+    stale_cache stale_controllers;
+    // relay latency per player slot; never resized, so readable from binder
+    // threads
+    std::vector<std::unique_ptr<latency_histogram>> relay_latency;
+    stats_registry stats;
+    std::unordered_map<ctlr_id, std::shared_ptr<ctlr_stats>, ctlr_id_hash>
+        phys_stats;
+    // last pairing state seen of each unpaired controller
+    std::unordered_map<ctlr_id, phys_ctlr::PairingState, ctlr_id_hash>
+        pairing_states;
+    // MAC -> how many times a controller with it has shown up
+    std::unordered_map<uint64_t, uint64_t> mac_seen;
+
+    // phys_ctlr -> index into paired_controllers
+    std::unordered_map<ctlr_id, size_t, ctlr_id_hash> paired_index;
+    // MAC -> index into paired_controllers; only a hint, validated with
+    // mac_belongs() since combined controllers may swap out a joy-con
+    std::unordered_map<uint64_t, size_t> mac_index;
 
     std::shared_ptr<phys_ctlr> left;
     std::shared_ptr<phys_ctlr> right;
 
-    void epoll_event_callback(int event_fd);
+    // Controllers whose HID device is there but whose input nodes aren't
+    // yet, by MAC; the pool gets their devices ready meanwhile
+    struct expected_ctlr {
+        phys_ctlr::Model model;
+        uint64_t expires_ns;
+    };
+    std::unordered_map<uint64_t, expected_ctlr> expected;
+    int expect_timer_fd;
+    std::shared_ptr<epoll_subscriber> expect_timer_subscriber;
+
+    // per player slot, when it paired and whether its device was pooled,
+    // until its first event comes in
+    struct pending_first_event {
+        uint64_t paired_ns;
+        bool pooled;
+    };
+    std::vector<pending_first_event> first_events;
+
+    // The last session's controllers, rebuilt as their devices show up
+    std::vector<session_entry> restore_entries;
+    std::vector<bool> restore_pending;
+    // MAC -> index into restore_entries, for entries still pending
+    std::unordered_map<uint64_t, size_t> restore_index;
+    // restored joy-cons whose combined partner hasn't shown up yet
+    std::unordered_map<uint64_t, std::shared_ptr<phys_ctlr>> restore_waiting;
+    uint64_t rumble_interval_ms;
+    unsigned int imu_decimation;
+    bool imu_fusion_enabled;
+    // phys_ctlr -> its motion sensor node, and the relay once it's paired
+    std::unordered_map<ctlr_id, std::string, ctlr_id_hash> imu_nodes;
+    std::unordered_map<ctlr_id, std::unique_ptr<virt_imu>, ctlr_id_hash> imus;
+    std::atomic<size_t> restored;
+    // when this started, which is what restoring is timed from
+    uint64_t created_ns;
+    std::atomic<uint64_t> restore_done_ns;
+    std::string session_contents;
+    session_writer session_file;
+
+    int reconfigure_fd;
+    std::shared_ptr<epoll_subscriber> reconfigure_subscriber;
+    pthread_mutex_t reconfigure_lock;
+    pthread_cond_t reconfigure_cond;
+    uint64_t reconfigure_requested;
+    uint64_t reconfigure_done;
+
+    // work handed over from binder threads, run on the poll thread
+    int task_fd;
+    std::shared_ptr<epoll_subscriber> task_subscriber;
+    pthread_mutex_t task_lock;
+    std::deque<std::function<void()>> tasks;
+
+    void epoll_event_callback(const ctlr_id &id, int event_fd);
+    void handle_unpaired(std::shared_ptr<phys_ctlr> ctlr);
     void add_passthrough_ctlr(std::shared_ptr<phys_ctlr> phys);
-    void add_combined_ctlr();
+    void add_combined_ctlr(std::shared_ptr<phys_ctlr> physl,
+                           std::shared_ptr<phys_ctlr> physr);
     void add_virt_procon_ctlr(std::shared_ptr<phys_ctlr> phys);
+    int acquire_slot(uint64_t mac);
+    void insert_paired(size_t slot, std::unique_ptr<virt_ctlr> virt);
+    void release_slot(size_t slot);
+    void attach_phys(size_t slot, std::shared_ptr<phys_ctlr> phys);
+    void record_handover(uint64_t latency_ns);
+    std::shared_ptr<phys_ctlr> find_phys(const ctlr_id &id) const;
+    void unsubscribe(const ctlr_id &id);
+    void record_pairing(size_t slot, uint64_t start_ns);
+    void update_pool_targets();
+    void arm_expect_timer();
+    void expect_timer_callback(int event_fd);
+    void load_session();
+    void save_session();
+    void restore_ctlr(std::shared_ptr<phys_ctlr> phys);
+    void finish_restore(size_t index);
+    void sync_imu(const ctlr_id &id);
+    void reconfigure_callback(int event_fd);
+    void task_callback(int event_fd);
+    void post(std::function<void()> task);
+    void count_reconnect(size_t slot);
 
     struct mapping *mMapping;
     pthread_mutex_t *mapLock;
 
   public:
+    // create makes the virtual devices; tools and tests pass fakes
     ctlr_mgr(epoll_mgr &epoll_manager, struct mapping *mMapping,
-             pthread_mutex_t *mapLock);
+             pthread_mutex_t *mapLock,
+             virt_device_factory create = create_virt_device);
     ~ctlr_mgr();
 
-    void add_ctlr(const std::string &devpath, const std::string &devname);
-    void remove_ctlr(const std::string &devpath);
+    void add_ctlr(const ctlr_id &id, const std::string &devpath,
+                  const std::string &devname);
+    // Same, reading from source instead of opening devname
+    void add_ctlr(const ctlr_id &id, const std::string &devpath,
+                  const std::string &devname,
+                  std::unique_ptr<event_source> source);
+    void remove_ctlr(const ctlr_id &id);
+    // parent is the controller the sensor node belongs to
+    void add_imu(const ctlr_id &parent, const std::string &devname);
+    void remove_imu(const ctlr_id &parent);
+    // A controller's HID device appeared or went away; its input nodes
+    // follow once hid-nintendo has probed it. Safe to call from any thread.
+    void expect_ctlr(uint64_t mac, phys_ctlr::Model model);
+    void forget_ctlr(uint64_t mac);
+
+    // Safe to call from any thread; the paired controllers pick up mapping
+    // changes on the poll thread. Returns a ticket for wait_reconfigured().
+    uint64_t request_reconfigure();
+    // Must not be called with mapLock held, the poll thread needs it
+    bool wait_reconfigured(uint64_t ticket, int timeout_ms);
+
+    // Safe to call from any thread; player is 1-based
+    void play_rumble_pattern(int player, std::vector<rumble_step> steps,
+                             int repeat);
+
+    // Safe to call from any thread; player is 1-based. Fills in the sample
+    // count and the p50/p99/p999 latencies in ns, false for a bad player.
+    bool get_relay_latency(int player, uint64_t *count, uint64_t *p50,
+                           uint64_t *p99, uint64_t *p999) const;
+    // Safe to call from any thread; see epoll_mgr::get_loop_lag
+    std::vector<uint64_t> get_loop_lag() const {
+        return epoll_manager.get_loop_lag();
+    }
+
+    // Safe to call from any thread
+    std::vector<ctlr_stats::snapshot> get_stats() const;
+
+    // Only touches state that is safe to read off the poll thread
+    void dump(int fd) const;
 };
 
 #endif
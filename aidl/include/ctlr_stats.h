@@ -0,0 +1,94 @@
+#ifndef JOYCOND_CTLR_STATS_H
+#define JOYCOND_CTLR_STATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+// Counters for one phys or virt controller. Every counting thread gets its
+// own cache-line-sized slot, so the relay path never bounces a line with
+// the rumble worker or a binder thread; readers sum the slots.
+class ctlr_stats {
+  public:
+    enum Counter {
+        EventsRead,
+        EventsWritten,
+        Frames,
+        SynDropped,
+        FfForwarded,
+        FfDropped,
+        LedWrites,
+        Reconnects,
+        COUNTERS
+    };
+
+    struct snapshot {
+        bool is_virtual;
+        std::string name;
+        uint64_t mac;
+        int player;
+        uint64_t counts[COUNTERS];
+        float frames_per_second;
+        uint64_t uptime_ns;
+    };
+
+  private:
+    static constexpr int SLOTS = 4;
+
+    struct alignas(64) slot {
+        std::atomic<uint64_t> counts[COUNTERS];
+    };
+
+    static std::atomic<int> next_slot;
+
+    slot slots[SLOTS];
+    const bool is_virtual;
+    const std::string name;
+    const uint64_t mac;
+    const uint64_t created_ns;
+    std::atomic<int> player;
+
+    // frame rate over the time between two reads
+    pthread_mutex_t rate_lock;
+    uint64_t rate_frames;
+    uint64_t rate_ns;
+    float frames_per_second;
+
+    static int thread_slot() {
+        static thread_local int index = next_slot.fetch_add(1) % SLOTS;
+        return index;
+    }
+
+  public:
+    ctlr_stats(bool is_virtual, const std::string &name, uint64_t mac);
+    ~ctlr_stats();
+
+    void add(Counter counter, uint64_t n = 1) {
+        slots[thread_slot()].counts[counter].fetch_add(
+            n, std::memory_order_relaxed);
+    }
+    // 1-based, 0 while the controller isn't a player
+    void set_player(int player) { this->player = player; }
+    struct snapshot read();
+};
+
+// Every live controller's stats, for readers off the poll thread
+class stats_registry {
+  private:
+    mutable pthread_mutex_t lock;
+    std::vector<std::shared_ptr<ctlr_stats>> entries;
+
+  public:
+    stats_registry();
+    ~stats_registry();
+
+    // Adding something already registered does nothing
+    void add(const std::shared_ptr<ctlr_stats> &stats);
+    void remove(const std::shared_ptr<ctlr_stats> &stats);
+    std::vector<std::shared_ptr<ctlr_stats>> list() const;
+};
+
+#endif
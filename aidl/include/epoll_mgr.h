@@ -1,15 +1,36 @@
 #ifndef JOYCOND_EPOLL_MGR_H
 #define JOYCOND_EPOLL_MGR_H
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <map>
 #include <memory>
+#include <vector>
 
 #include "epoll_subscriber.h"
+#include "latency_histogram.h"
+
+struct epoll_event;
 
 class epoll_mgr {
   private:
     int epoll_fd;
     std::map<int, std::shared_ptr<epoll_subscriber>> subscribers;
+    std::map<int, std::function<void(int)>> writers;
+
+    // epoll_pwait returning to the handler starting, i.e. time spent
+    // queued behind the other handlers of the same iteration
+    latency_histogram lag;
+    latency_histogram handler_time;
+    std::atomic<uint64_t> handler_max_ns;
+    // Start of the running handler, 0 while waiting; read by loop_watchdog
+    std::atomic<uint64_t> busy_since_ns;
+    std::atomic<int> busy_fd;
+    std::atomic<uint64_t> stalls;
+
+    bool set_events(int fd, uint32_t events);
+    void dispatch(const struct epoll_event &event);
 
   public:
     epoll_mgr();
@@ -17,7 +38,24 @@ class epoll_mgr {
 
     void add_subscriber(std::shared_ptr<epoll_subscriber> sub);
     void remove_subscriber(std::shared_ptr<epoll_subscriber> sub);
+    // Additionally calls callback whenever a subscribed fd is writable.
+    // Only watch while there is something to write, or loop() will spin.
+    // Returns false if fd can't be watched, e.g. it isn't subscribed.
+    bool watch_writable(int fd, std::function<void(int)> callback);
+    void unwatch_writable(int fd);
     void loop();
+
+    // When the current handler started and for which fd; 0 if none is
+    // running. Safe to call from any thread.
+    uint64_t get_busy_since(int *fd) const {
+        uint64_t since = busy_since_ns.load(std::memory_order_acquire);
+        *fd = busy_fd.load(std::memory_order_relaxed);
+        return since;
+    }
+    void record_stall() { stalls.fetch_add(1, std::memory_order_relaxed); }
+    // count, lag p50/p99/p999, handler p50/p99/p999 and max in ns, stalls
+    std::vector<uint64_t> get_loop_lag() const;
+    void dump(int fd) const;
 };
 
 #endif
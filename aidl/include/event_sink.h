@@ -0,0 +1,34 @@
+#ifndef JOYCOND_EVENT_SINK_H
+#define JOYCOND_EVENT_SINK_H
+
+#include <libevdev/libevdev-uinput.h>
+
+// Where a virtual device's events go: a uinput device, or an in-process fake
+// for benchmarks and tests.
+class event_sink {
+  public:
+    virtual ~event_sink() {}
+
+    virtual void write_event(unsigned int type, unsigned int code,
+                             int value) = 0;
+    // Readable when the reader sends something back (force feedback, LEDs),
+    // which is answered with the uinput ioctls
+    virtual int get_fd() = 0;
+};
+
+// Doesn't own uidev; that stays with the virt_device
+class uinput_sink : public event_sink {
+  private:
+    struct libevdev_uinput *uidev;
+
+  public:
+    uinput_sink(struct libevdev_uinput *uidev) : uidev(uidev) {}
+
+    void write_event(unsigned int type, unsigned int code,
+                     int value) override {
+        libevdev_uinput_write_event(uidev, type, code, value);
+    }
+    int get_fd() override { return libevdev_uinput_get_fd(uidev); }
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef JOYCOND_EVENT_SOURCE_H
+#define JOYCOND_EVENT_SOURCE_H
+
+#include <libevdev/libevdev.h>
+#include <string>
+
+// Where a phys_ctlr reads its input from: the controller's evdev node, or an
+// in-process fake for benchmarks and tests.
+class event_source {
+  public:
+    virtual ~event_source() {}
+
+    // Capabilities and ids of the device, and the state of every code as of
+    // the last event handed out
+    virtual struct libevdev *get_evdev() = 0;
+    // Readable while next_event() has something; what epoll waits on
+    virtual int get_fd() = 0;
+    // Same contract as libevdev_next_event()
+    virtual int next_event(unsigned int flags, struct input_event *ev) = 0;
+    virtual void grab(bool grab) = 0;
+};
+
+// An evdev node read through libevdev, stamped with CLOCK_MONOTONIC
+class evdev_source : public event_source {
+  private:
+    struct libevdev *evdev;
+
+  public:
+    evdev_source(const std::string &devname);
+    ~evdev_source();
+
+    bool is_valid() const { return evdev != nullptr; }
+    struct libevdev *get_evdev() override { return evdev; }
+    int get_fd() override { return libevdev_get_fd(evdev); }
+    int next_event(unsigned int flags, struct input_event *ev) override {
+        return libevdev_next_event(evdev, flags, ev);
+    }
+    void grab(bool grab) override {
+        libevdev_grab(evdev, grab ? LIBEVDEV_GRAB : LIBEVDEV_UNGRAB);
+    }
+};
+
+#endif
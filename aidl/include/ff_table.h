@@ -0,0 +1,90 @@
+#ifndef JOYCOND_FF_TABLE_H
+#define JOYCOND_FF_TABLE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <linux/input.h>
+#include <memory>
+
+#include "ff_worker.h"
+#include "rumble_queue.h"
+
+// Force feedback effects uploaded to a virtual controller, indexed by the
+// effect id uinput handed out. Each effect is lazily mapped onto a slot of
+// every physical controller behind it ("side"); when a device runs out of
+// slots the least recently played effect is evicted and re-uploaded the
+// next time it is played.
+class ff_table {
+  public:
+    // uinput never hands out more effect ids than this
+    static const int MAX_EFFECTS = 16;
+    static const int MAX_SIDES = 2;
+    // One more entry past the uinput ids for the daemon's own patterns
+    static const int PATTERN_ID = MAX_EFFECTS;
+    static const int TABLE_SIZE = MAX_EFFECTS + 1;
+
+  private:
+    struct entry {
+        bool used;
+        struct ff_effect effect;
+        // slot on each side's device, -1 if not uploaded there
+        int16_t phys_id[MAX_SIDES];
+        uint64_t last_play;
+    };
+
+    struct side {
+        int fd;
+        rumble_queue *queue;
+        int capacity;
+        int mapped;
+    };
+
+    entry entries[TABLE_SIZE];
+    side sides[MAX_SIDES];
+    int num_sides;
+    int count;
+    uint64_t tick;
+    // only there when there is more than one side
+    std::unique_ptr<ff_worker> worker;
+
+    // upload round trips, by the number of sides they went to; for dumpsys
+    static std::atomic<uint64_t> upload_count[MAX_SIDES];
+    static std::atomic<uint64_t> upload_total_ns[MAX_SIDES];
+    static std::atomic<uint64_t> upload_max_ns[MAX_SIDES];
+
+    int upload_to(int s, int id);
+    void unmap(int s, int id);
+    bool make_room(int s, int keep);
+    void play_id(int id, int value);
+    void send(int s, const struct input_event &ev);
+    // Runs op for every side in targets at once; returns the first error
+    int on_sides(const int *targets, int n, const std::function<int(int)> &op);
+
+  public:
+    ff_table(int num_sides);
+
+    // A (new) device now sits on side s; nothing is uploaded to it yet, so
+    // re-upload what fits. Plays go out through queue when there is one.
+    void attach(int s, int fd, rumble_queue *queue);
+    void detach(int s);
+
+    // Both return 0 or an errno suitable for uinput_ff_upload/erase.retval
+    int upload(const struct ff_effect &effect);
+    int erase(int id);
+    // Forwards an EV_FF event to every attached device
+    void play(const struct input_event &ev);
+    // Constant rumble on every side for the pattern sequencer; 0 stops it
+    void set_rumble(uint16_t magnitude);
+    // Erases every client effect, e.g. once the device they were uploaded
+    // through is gone; the pattern effect stays
+    void erase_all();
+
+    int size() const { return count; }
+
+    static void get_upload_stats(int sides, uint64_t *count,
+                                 uint64_t *avg_ns, uint64_t *max_ns);
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef JOYCOND_FF_WORKER_H
+#define JOYCOND_FF_WORKER_H
+
+#include <functional>
+#include <pthread.h>
+
+// A thread that runs one job at a time next to the poll thread, so the
+// ioctls for both joy-cons of a pair can be in flight at once.
+class ff_worker {
+  private:
+    static void *__workerLoop(void *args);
+
+    pthread_t workerThread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    std::function<void()> job;
+    bool busy;
+    bool stopping;
+    bool running;
+
+  public:
+    ff_worker();
+    ~ff_worker();
+
+    // Starts job on the worker; runs it inline if the thread is missing
+    void run(std::function<void()> job);
+    // Blocks until the job passed to run() has finished
+    void wait();
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef JOYCOND_FLIGHT_RECORDER_H
+#define JOYCOND_FLIGHT_RECORDER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Always-on ring of the most recent input, output, FF and controller
+// lifecycle events, for working out what happened after the fact. A record
+// costs one relaxed fetch_add and a 16-byte store, so it stays enabled.
+//
+// `dumpsys android.hardware.nintendo.joycond.IJoycond/default --flight`
+// writes the ring out in the binary format below; tools/flight_decode.cpp
+// turns that into text on the host.
+
+namespace flight {
+
+enum class kind : uint8_t {
+    Input,   // read from a phys_ctlr; source is the eventN number
+    Output,  // written to a virtual device; source is the player
+    Ff,      // force feedback from a game; source is the player
+    // the rest have the eventN number as source too. It's 0xff if there's
+    // none, or N is 255 or more.
+    Hotplug, // code 1 added (value is the low MAC bits), 0 removed
+    Pairing, // code is the new phys_ctlr::PairingState of an unpaired one
+    Player,  // code 1 took, 0 gave up the player slot in value
+};
+
+// stamp packs the CLOCK_MONOTONIC time in ns (upper 56 bits) with the kind
+struct record {
+    uint64_t stamp;
+    uint8_t source;
+    uint8_t type; // EV_* or TYPE_UINPUT
+    uint16_t code;
+    int32_t value;
+};
+static_assert(sizeof(record) == 16, "flight records must stay 16 bytes");
+
+// Dump layout: this header, then count records from oldest to newest
+struct header {
+    char magic[4]; // "JCFR"
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t dump_ns; // CLOCK_MONOTONIC when the dump was taken
+};
+static_assert(sizeof(header) == 24, "flight header must stay 24 bytes");
+
+static constexpr uint16_t VERSION = 1;
+// EV_UINPUT doesn't fit in record::type, so FF uploads and erases use this
+static constexpr uint8_t TYPE_UINPUT = 0xff;
+
+inline kind stamp_kind(uint64_t stamp) { return kind(stamp & 0xff); }
+inline uint64_t stamp_ns(uint64_t stamp) { return stamp >> 8; }
+
+} // namespace flight
+
+#ifndef JOYCOND_FLIGHT_DECODER
+
+#include "clock.h"
+
+class flight_recorder {
+  private:
+    // power of two, so the index wraps with a mask
+    static constexpr uint32_t CAPACITY = 8192;
+
+    // A per-slot seqlock: stamp is zero while the payload is rewritten, and
+    // readers keep a record only if the stamp didn't change around it
+    struct slot {
+        std::atomic<uint64_t> stamp;
+        // source, type, code and value packed the way record lays them out
+        std::atomic<uint64_t> payload;
+    };
+
+    static slot ring[CAPACITY];
+    static std::atomic<uint64_t> head;
+
+  public:
+    static inline void record(flight::kind kind, uint8_t source,
+                              uint16_t type, uint16_t code, int32_t value) {
+        uint64_t payload = uint64_t(source) | uint64_t(uint8_t(type)) << 8 |
+                           uint64_t(code) << 16 |
+                           uint64_t(uint32_t(value)) << 32;
+        slot &s = ring[head.fetch_add(1, std::memory_order_relaxed) &
+                       (CAPACITY - 1)];
+
+        s.stamp.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s.payload.store(payload, std::memory_order_relaxed);
+        s.stamp.store(monotonic_ns() << 8 | uint64_t(kind),
+                      std::memory_order_release);
+    }
+
+    static uint64_t recorded() { return head.load(); }
+    // Writes the header and every intact record; false on a short write
+    static bool write(int fd);
+};
+
+#endif
+
+#endif
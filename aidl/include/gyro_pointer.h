@@ -0,0 +1,50 @@
+#ifndef JOYCOND_GYRO_POINTER_H
+#define JOYCOND_GYRO_POINTER_H
+
+// pointer counts per degree turned
+#define PROP_GYRO_SENSE_X "persist.vendor.joycond.gyro_sense.x"
+#define PROP_GYRO_SENSE_Y "persist.vendor.joycond.gyro_sense.y"
+#define DEFAULT_GYRO_SENSE_X "20"
+#define DEFAULT_GYRO_SENSE_Y "20"
+
+#include "imu_sample.h"
+
+// Turns gyro samples into pointer deltas. The gyro bias is learned whenever
+// the controller holds still long enough, judged by fixed limits rather
+// than by the samples agreeing, so a slow steady turn isn't taken for bias.
+// Rates are integrated over the sensor's own timestamps, and the sub-count
+// remainder carries over to the next sample so slow turns still move the
+// pointer.
+class gyro_pointer {
+  private:
+    // a sample counts as resting while every axis reads under this rate...
+    static constexpr float REST_RATE_DPS = 3.0f;
+    // ...and the accel magnitude stays this close to 1 g
+    static constexpr float REST_ACCEL_G = 0.1f;
+    // resting samples needed before the bias is trusted (about a second)
+    static constexpr unsigned int REST_SAMPLES = 200;
+    // gaps longer than this are a stall, not motion to integrate
+    static constexpr uint64_t MAX_DT_US = 50000;
+
+    float sense_x;
+    float sense_y;
+    float bias[3];
+    float rest_sum[3];
+    unsigned int rest_count;
+    uint64_t last_us;
+    bool have_last;
+    float remainder_x;
+    float remainder_y;
+
+    void calibrate(const imu_sample &sample);
+
+  public:
+    gyro_pointer(float sense_x, float sense_y);
+
+    // Drops the integration state but keeps the learned bias
+    void reset();
+    // Feeds one sample; true with the whole counts to move if there are any
+    bool update(const imu_sample &sample, int *dx, int *dy);
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef JOYCOND_IMU_FUSION_H
+#define JOYCOND_IMU_FUSION_H
+
+// publish fused orientation next to the raw IMU axes
+#define PROP_IMU_FUSION "persist.vendor.joycond.imu_fusion"
+#define DEFAULT_IMU_FUSION true
+
+#include <atomic>
+#include <cstdint>
+
+#include "imu_sample.h"
+
+// Samples are queued into a fixed-size batch with one array per component,
+// so the unit conversion and accel normalization run as flat loops the
+// compiler can vectorize. Only the quaternion update itself is sequential.
+struct imu_batch {
+    static constexpr int SIZE = 8;
+
+    int count;
+    float ax[SIZE], ay[SIZE], az[SIZE];
+    float gx[SIZE], gy[SIZE], gz[SIZE];
+    float dt[SIZE];
+};
+
+// Madgwick's gradient descent orientation filter, gyro and accel only. Yaw
+// is relative to wherever the controller pointed when the filter started.
+class imu_fusion {
+  private:
+    // gyro error weight; higher trusts the accel more and drifts less
+    static constexpr float BETA = 0.1f;
+    static constexpr uint64_t MAX_DT_US = 50000;
+
+    static std::atomic<uint64_t> fused_samples;
+    static std::atomic<uint64_t> fused_ns;
+
+    alignas(32) imu_batch batch;
+    float q[4];
+    uint64_t last_us;
+    bool have_last;
+
+    void step(float gx, float gy, float gz, float ax, float ay, float az,
+              float dt);
+
+  public:
+    imu_fusion();
+
+    // Queues a sample, fusing the batch once it's full
+    void add(const imu_sample &sample);
+    // Fuses whatever is queued
+    void flush();
+    // Roll, pitch and yaw in degrees
+    void get_euler(float euler[3]) const;
+
+    static void get_stats(uint64_t *samples, uint64_t *avg_ns);
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef JOYCOND_IMU_SAMPLE_H
+#define JOYCOND_IMU_SAMPLE_H
+
+#include <cstdint>
+#include <functional>
+
+// One report from a controller's motion sensor, in physical units
+struct imu_sample {
+    uint64_t timestamp_us;
+    float accel[3]; // g
+    float gyro[3];  // degrees per second
+};
+
+using imu_listener = std::function<void(const imu_sample &)>;
+
+#endif
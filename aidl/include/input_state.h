@@ -0,0 +1,66 @@
+#ifndef JOYCOND_INPUT_STATE_H
+#define JOYCOND_INPUT_STATE_H
+
+#include <bitset>
+#include <cstdint>
+#include <linux/input.h>
+#include <vector>
+
+// Last key and axis values relayed from one phys_ctlr. Used to undo whatever
+// a controller left pressed when it disappears or is swapped for another
+// device, instead of leaving it stuck on the virtual device.
+struct input_state {
+    // What a held key came out as on the virtual device. The layout can be
+    // swapped while it's held, so its release has to go to the same place.
+    struct held_key {
+        uint16_t code;
+        uint16_t out_type;
+        uint16_t out_code;
+    };
+
+    std::bitset<KEY_CNT> keys;
+    std::bitset<ABS_CNT> abs_seen;
+    int32_t abs[ABS_CNT];
+    std::vector<held_key> held;
+
+    input_state() { clear(); }
+
+    void clear() {
+        keys.reset();
+        abs_seen.reset();
+        held.clear();
+    }
+
+    void hold(uint16_t code, uint16_t out_type, uint16_t out_code) {
+        for (auto &key : held) {
+            if (key.code == code) {
+                key.out_type = out_type;
+                key.out_code = out_code;
+                return;
+            }
+        }
+        held.push_back({code, out_type, out_code});
+    }
+
+    bool take_held(uint16_t code, held_key *out) {
+        for (auto it = held.begin(); it != held.end(); it++) {
+            if (it->code == code) {
+                *out = *it;
+                held.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void record(const struct input_event &ev) {
+        if (ev.type == EV_KEY && ev.code < KEY_CNT) {
+            keys.set(ev.code, ev.value != 0);
+        } else if (ev.type == EV_ABS && ev.code < ABS_CNT) {
+            abs_seen.set(ev.code);
+            abs[ev.code] = ev.value;
+        }
+    }
+};
+
+#endif
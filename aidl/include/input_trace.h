@@ -0,0 +1,116 @@
+#ifndef JOYCOND_INPUT_TRACE_H
+#define JOYCOND_INPUT_TRACE_H
+
+// directory to capture every physical controller's input into; read when a
+// controller is opened, not persistent
+#define PROP_CAPTURE_DIR "vendor.joycond.capture_dir"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+struct input_event;
+struct libevdev;
+
+// One trace file per physical controller: a fixed-size header describing the
+// device as the kernel exposed it, then fixed-size events up to the end of
+// the file, so a trace can be mmapped and indexed directly. Bitmaps and
+// absinfo are sized for the codes hid-nintendo can use rather than the
+// current KEY_CNT and friends, so the layout doesn't move with the kernel.
+namespace input_trace {
+
+static constexpr uint16_t VERSION = 1;
+
+static constexpr int PROP_BITS = 32;
+static constexpr int EV_BITS = 32;
+static constexpr int KEY_BITS = 768;
+static constexpr int ABS_BITS = 64;
+static constexpr int FF_BITS = 128;
+static constexpr int LED_BITS = 16;
+static constexpr int MSC_BITS = 8;
+
+struct absinfo {
+    int32_t value;
+    int32_t minimum;
+    int32_t maximum;
+    int32_t fuzz;
+    int32_t flat;
+    int32_t resolution;
+};
+
+struct header {
+    char magic[4]; // "JCIT"
+    uint16_t version;
+    uint16_t header_size; // offset of the first event
+    uint16_t event_size;
+    uint16_t bustype;
+    uint16_t vendor;
+    uint16_t product;
+    uint16_t id_version;
+    uint16_t reserved0;
+    uint32_t reserved1;
+    uint64_t mac;
+    uint64_t start_ns; // CLOCK_MONOTONIC when the capture started
+    char name[88];
+    uint8_t props[PROP_BITS / 8];
+    uint8_t types[EV_BITS / 8];
+    uint8_t keys[KEY_BITS / 8];
+    uint8_t axes[ABS_BITS / 8];
+    uint8_t ff[FF_BITS / 8];
+    uint8_t leds[LED_BITS / 8];
+    uint8_t msc[MSC_BITS / 8];
+    uint8_t reserved2[5];
+    absinfo abs[ABS_BITS];
+};
+static_assert(sizeof(header) == 1800, "input trace header layout changed");
+
+// time is the kernel's CLOCK_MONOTONIC stamp on the event
+struct event {
+    uint64_t time_ns;
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+};
+static_assert(sizeof(event) == 16, "input trace events must stay 16 bytes");
+
+inline bool test_bit(const uint8_t *bits, int bit) {
+    return bits[bit / 8] & (1 << (bit % 8));
+}
+inline void set_bit(uint8_t *bits, int bit) { bits[bit / 8] |= 1 << (bit % 8); }
+
+} // namespace input_trace
+
+// Tees what phys_ctlr reads into a trace file
+class input_trace_writer {
+  private:
+    FILE *file;
+
+  public:
+    input_trace_writer(const std::string &path, struct libevdev *evdev,
+                       uint64_t mac);
+    ~input_trace_writer();
+
+    bool is_valid() const { return file != nullptr; }
+    void write(const struct input_event &ev);
+};
+
+// Maps a trace file read-only and checks its header
+class input_trace_reader {
+  private:
+    void *map;
+    size_t size;
+
+  public:
+    input_trace_reader(const std::string &path);
+    ~input_trace_reader();
+
+    bool is_valid() const { return map != nullptr; }
+    const input_trace::header &get_header() const {
+        return *static_cast<const input_trace::header *>(map);
+    }
+    const input_trace::event *get_events() const;
+    size_t get_event_count() const;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef JOYCOND_LATENCY_HISTOGRAM_H
+#define JOYCOND_LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+
+// Log-linear histogram of nanosecond latencies: every power of two is split
+// into SUB linear buckets, so any value is off by at most 1/SUB. Recording
+// is a count-leading-zeros and a relaxed increment, and readers on other
+// threads only ever see whole counts.
+class latency_histogram {
+  private:
+    static constexpr int SUB_BITS = 3;
+    static constexpr int SUB = 1 << SUB_BITS;
+    static constexpr int BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+    std::atomic<uint64_t> counts[BUCKETS];
+
+    static int bucket_of(uint64_t value) {
+        if (value < SUB)
+            return int(value);
+
+        int exp = 63 - __builtin_clzll(value);
+        int sub = int(value >> (exp - SUB_BITS)) & (SUB - 1);
+        return (exp - SUB_BITS + 1) * SUB + sub;
+    }
+    static uint64_t lower_bound(int bucket);
+
+  public:
+    latency_histogram();
+
+    void record(uint64_t value_ns) {
+        counts[bucket_of(value_ns)].fetch_add(1, std::memory_order_relaxed);
+    }
+    void reset();
+    uint64_t count() const;
+    // Value at or below which the given fraction (0-1) of samples fall
+    uint64_t percentile(double fraction) const;
+};
+
+#endif
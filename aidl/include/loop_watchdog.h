@@ -0,0 +1,45 @@
+#ifndef JOYCOND_LOOP_WATCHDOG_H
+#define JOYCOND_LOOP_WATCHDOG_H
+
+// how long one poll loop handler may run before it's logged as stuck; 0
+// turns the watchdog off
+#define PROP_WATCHDOG_MS "persist.vendor.joycond.watchdog_ms"
+#define DEFAULT_WATCHDOG_MS 200
+// abort after a handler has been stuck this long, so init restarts the
+// daemon and the session is restored; 0 never aborts
+#define PROP_WATCHDOG_ABORT_MS "persist.vendor.joycond.watchdog_abort_ms"
+#define DEFAULT_WATCHDOG_ABORT_MS 0
+
+#include <cstdint>
+#include <pthread.h>
+
+#include "epoll_mgr.h"
+
+// Watches the poll loop from its own thread. Once a handler has run for
+// longer than the threshold it logs the fd it's stuck on, resolved through
+// /proc/self/fd, and counts a stall. A blocking sysfs write or a hung
+// ioctl can't be interrupted from here, so the only recovery on offer is
+// to abort and let init restart us.
+class loop_watchdog {
+  private:
+    static void *__watchLoop(void *args);
+
+    epoll_mgr &epoll_manager;
+    uint64_t stall_ns;
+    uint64_t abort_ns;
+    pthread_t watchThread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stopping;
+    bool running;
+    // busy_since of the stall already reported, so each is logged once
+    uint64_t reported;
+
+    void check();
+
+  public:
+    loop_watchdog(epoll_mgr &epoll_manager);
+    ~loop_watchdog();
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef JOYCOND_MAPPING_H
+#define JOYCOND_MAPPING_H
+
+#include <cstdint>
+#include <map>
+#include <pthread.h>
+
+// How the virtual controllers are set up, owned by the service and shared
+// with the poll thread under its mapLock
+struct mapping {
+    std::map<uint32_t, uint32_t> layout;
+    bool combined;
+    bool analog;
+    bool rsmouse;
+};
+
+// What code is remapped to in the layout; false if it isn't. Takes lock,
+// since the service can swap the layout from a binder thread.
+static inline bool lookup_layout(struct mapping *m, pthread_mutex_t *lock,
+                                 uint32_t code, uint32_t *mapped) {
+    bool found;
+
+    pthread_mutex_lock(lock);
+    auto it = m->layout.find(code);
+    found = it != m->layout.end();
+    if (found)
+        *mapped = it->second;
+    pthread_mutex_unlock(lock);
+    return found;
+}
+
+#endif
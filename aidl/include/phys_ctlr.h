@@ -3,11 +3,20 @@
 
 #include <fstream>
 #include <libevdev/libevdev.h>
+#include <memory>
 #include <optional>
 #include <string>
+#include <sys/sysmacros.h>
 
 #include "cutils/properties.h"
 
+#include "ctlr_id.h"
+#include "ctlr_stats.h"
+#include "event_source.h"
+#include "flight_recorder.h"
+#include "input_trace.h"
+#include "rumble_queue.h"
+
 class phys_ctlr {
   public:
     enum class Model {
@@ -21,8 +30,12 @@ class phys_ctlr {
     enum class PairingState { Pairing, Lone, Waiting, Horizontal, Virt_Procon };
 
   private:
+    ctlr_id id;
     std::string devpath;
     std::string devname;
+    // N of /dev/input/eventN, for the flight recorder
+    uint8_t event_number;
+    std::unique_ptr<event_source> source;
     struct libevdev *evdev;
     bool is_serial;
     std::fstream player_leds[4];
@@ -30,17 +43,29 @@ class phys_ctlr {
     std::fstream home_led;
     bool l, zl, r, zr, sl, sr, plus, minus;
     enum Model model;
-    std::string mac_addr;
+    uint64_t mac_addr;
+    std::unique_ptr<rumble_queue> rumble;
+    std::shared_ptr<ctlr_stats> stats;
+    std::unique_ptr<input_trace_writer> capture;
 
+    void start_capture();
     std::optional<std::string> get_first_glob_path(std::string const &pattern);
     std::optional<std::string> get_led_path(std::string const &name);
     void init_leds();
     void handle_event(struct input_event const &ev);
 
   public:
-    phys_ctlr(std::string const &devpath, std::string const &devname);
+    phys_ctlr(ctlr_id id, std::string const &devpath,
+              std::string const &devname);
+    // For a source that isn't a hid-nintendo node; devpath may be empty, in
+    // which case sysfs (LEDs, serial detection) is left alone
+    phys_ctlr(ctlr_id id, std::string const &devpath,
+              std::string const &devname,
+              std::unique_ptr<event_source> source);
     ~phys_ctlr();
 
+    const ctlr_id &get_id() const { return id; }
+    uint8_t get_event_number() const { return event_number; }
     std::string const &get_devpath() const { return devpath; }
     bool set_player_led(int index, bool on);
     bool set_all_player_leds(bool on);
@@ -51,12 +76,32 @@ class phys_ctlr {
     void handle_events();
     enum Model get_model() const { return model; }
     enum PairingState get_pairing_state() const;
-    void grab() { libevdev_grab(evdev, LIBEVDEV_GRAB); }
-    void ungrab() { libevdev_grab(evdev, LIBEVDEV_UNGRAB); }
+    void grab() { source->grab(true); }
+    void ungrab() { source->grab(false); }
     struct libevdev *get_evdev() { return evdev; }
+    // Same contract as libevdev_next_event(); pass what it returns on to
+    // count_event()
+    int next_event(unsigned int flags, struct input_event *ev) {
+        return source->next_event(flags, ev);
+    }
     void zero_triggers();
-    const std::string &get_mac_addr() { return mac_addr; }
+    uint64_t get_mac_addr() const { return mac_addr; }
     bool is_serial_ctlr() const { return is_serial; }
+    void set_rumble_queue(std::unique_ptr<rumble_queue> queue) {
+        rumble = std::move(queue);
+    }
+    rumble_queue *get_rumble_queue() { return rumble.get(); }
+    const std::shared_ptr<ctlr_stats> &get_stats() const { return stats; }
+    // Counts what a reader of get_evdev() pulled off the node
+    void count_event(struct input_event const &ev) {
+        flight_recorder::record(flight::kind::Input, event_number, ev.type,
+                                ev.code, ev.value);
+        if (capture)
+            capture->write(ev);
+        stats->add(ctlr_stats::EventsRead);
+        if (ev.type == EV_SYN && ev.code == SYN_REPORT)
+            stats->add(ctlr_stats::Frames);
+    }
 };
 
 #endif
@@ -0,0 +1,46 @@
+#ifndef JOYCOND_PLAYER_SLOTS_H
+#define JOYCOND_PLAYER_SLOTS_H
+
+#include <cstdint>
+#include <unordered_map>
+
+// Hands out player numbers to virtual controllers. Slots are tracked in a
+// bitmap so acquiring and releasing never scans the paired controller list.
+// With sticky reservations enabled a MAC gets its previous slot back as long
+// as nobody else took it in the meantime.
+class player_slots {
+  public:
+    // Every non-empty pattern of the four player LEDs
+    static const int MAX_SLOTS = 15;
+
+  private:
+    int capacity;
+    bool sticky;
+    uint32_t free_mask;
+    uint32_t reserved_mask;
+    uint64_t reserved_mac[MAX_SLOTS];
+    std::unordered_map<uint64_t, int> reservations;
+
+    void reserve(int slot, uint64_t mac);
+    void drop_reservation(int slot);
+
+  public:
+    player_slots(int capacity, bool sticky);
+
+    // Returns a 0-based slot, or -1 when every slot is in use
+    int acquire(uint64_t mac);
+    // Takes one particular slot if it is free, e.g. one restored from the
+    // last session
+    bool take(int slot);
+    // Keeps acquire() away from a slot that mac is expected to come back to
+    void hold(int slot, uint64_t mac);
+    void release(int slot);
+    int get_capacity() const { return capacity; }
+    int in_use() const;
+
+    // Bit n set means player LED n + 1 is lit. Players 1-8 follow the
+    // Switch's own patterns; 9-15 use the remaining combinations.
+    static uint8_t led_pattern(int player);
+};
+
+#endif
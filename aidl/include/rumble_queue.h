@@ -0,0 +1,74 @@
+#ifndef JOYCOND_RUMBLE_QUEUE_H
+#define JOYCOND_RUMBLE_QUEUE_H
+
+// minimum time between two batches of rumble writes to one controller
+#define PROP_RUMBLE_INTERVAL "persist.vendor.joycond.rumble_interval_ms"
+#define DEFAULT_RUMBLE_INTERVAL 10
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <linux/input.h>
+#include <memory>
+
+#include "ctlr_stats.h"
+#include "epoll_mgr.h"
+
+// Outbound EV_FF events for one physical controller. Only the latest value
+// per effect is kept, so a game spamming play/stop can't back the device up
+// with commands that are already stale. Writes happen when the fd polls
+// writable and at most once per interval.
+class rumble_queue {
+  public:
+    struct stats {
+        uint64_t sent;
+        uint64_t superseded;
+        uint64_t dropped;
+        uint64_t latency_avg_ns;
+        uint64_t latency_max_ns;
+    };
+
+  private:
+    epoll_mgr &epoll_manager;
+    int fd;
+    // the controller's own counters; superseded commands count as dropped
+    std::shared_ptr<ctlr_stats> counters;
+    uint64_t interval_ns;
+    int timer_fd;
+    std::shared_ptr<epoll_subscriber> timer_subscriber;
+
+    bool queued[FF_CNT];
+    int32_t values[FF_CNT];
+    uint64_t queued_ns[FF_CNT];
+    // codes in the order they were queued; cancelled ones are skipped
+    std::deque<uint16_t> order;
+    uint64_t last_write_ns;
+    bool watching;
+    bool timer_armed;
+    // fd couldn't be watched for writes, so the timer writes instead
+    bool write_on_timer;
+
+    // shared by every queue, for dumpsys
+    static std::atomic<uint64_t> sent;
+    static std::atomic<uint64_t> superseded;
+    static std::atomic<uint64_t> dropped;
+    static std::atomic<uint64_t> latency_total_ns;
+    static std::atomic<uint64_t> latency_max_ns;
+
+    void schedule();
+    void flush(int event_fd);
+    void timer_callback(int event_fd);
+
+  public:
+    rumble_queue(epoll_mgr &epoll_manager, int fd, uint64_t interval_ms,
+                 std::shared_ptr<ctlr_stats> counters);
+    ~rumble_queue();
+
+    void push(uint16_t code, int32_t value);
+    // Forget a pending command, e.g. because its effect slot was erased
+    void cancel(uint16_t code);
+
+    static struct stats get_stats();
+};
+
+#endif
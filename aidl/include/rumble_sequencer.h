@@ -0,0 +1,47 @@
+#ifndef JOYCOND_RUMBLE_SEQUENCER_H
+#define JOYCOND_RUMBLE_SEQUENCER_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "epoll_mgr.h"
+
+struct rumble_step {
+    uint32_t duration_ms;
+    uint8_t amplitude;
+};
+
+// Plays a timed amplitude pattern off a timerfd on the poll thread. Step
+// deadlines are absolute, so timer latency doesn't add up over a long
+// pattern, and output is only called when the amplitude actually changes.
+class rumble_sequencer {
+  private:
+    epoll_mgr &epoll_manager;
+    int timer_fd;
+    std::shared_ptr<epoll_subscriber> subscriber;
+    std::function<void(uint8_t)> output;
+
+    std::vector<rumble_step> steps;
+    int repeat;
+    size_t index;
+    uint64_t deadline_ns;
+    int amplitude;
+
+    void set_amplitude(uint8_t amplitude);
+    void advance();
+    void timer_callback(int event_fd);
+
+  public:
+    rumble_sequencer(epoll_mgr &epoll_manager,
+                     std::function<void(uint8_t)> output);
+    ~rumble_sequencer();
+
+    // Loops back to step repeat when it reaches the end, unless repeat is
+    // -1. An empty pattern stops whatever is playing.
+    void play(const std::vector<rumble_step> &steps, int repeat);
+    void stop();
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef JOYCOND_SESSION_H
+#define JOYCOND_SESSION_H
+
+#define FILE_SESSION "/data/vendor/joycond/session.txt"
+
+#include <cstdint>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "virt_ctlr.h"
+
+// One paired virtual controller as it should come back after a restart
+struct session_entry {
+    virt_ctlr::Kind kind;
+    int slot;
+    std::vector<uint64_t> macs;
+};
+
+// One line per entry: "<slot> <kind> <mac>[,<mac>]"
+std::string serialize_session(const std::vector<session_entry> &entries);
+std::vector<session_entry> parse_session(const std::string &contents);
+
+// Replaces path with contents so that a crash at any point leaves either
+// the old or the new file behind, never a torn one
+bool write_file_atomically(const std::string &path,
+                           const std::string &contents);
+
+// Writes a file on its own thread, so its fsyncs stay off the poll thread.
+// Only the newest contents matter: whatever was queued and not written yet
+// is replaced, and what is still queued at destruction gets written then.
+class session_writer {
+  private:
+    static void *__writerLoop(void *args);
+
+    std::string path;
+    pthread_t writerThread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    std::string pending;
+    bool dirty;
+    bool stopping;
+    bool running;
+
+  public:
+    session_writer(const std::string &path);
+    ~session_writer();
+
+    void write(const std::string &contents);
+};
+
+#endif
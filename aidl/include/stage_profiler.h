@@ -0,0 +1,90 @@
+#ifndef JOYCOND_STAGE_PROFILER_H
+#define JOYCOND_STAGE_PROFILER_H
+
+// Per-stage timing of the relay path. Only built with -DJOYCOND_PROFILE in
+// cppflags; otherwise every PROFILE_* macro expands to nothing.
+
+// with profiling built in, time one relay pass in this many
+#define PROP_PROFILE_SAMPLE "persist.vendor.joycond.profile_sample"
+#define DEFAULT_PROFILE_SAMPLE 1
+
+enum class relay_stage { Read, Mouse, Layout, Transform, Write, Ff, COUNT };
+// Passes are sampled per path, so FF traffic doesn't decide which relay
+// passes get timed
+enum class profile_path { Relay, Ff, COUNT };
+
+#ifdef JOYCOND_PROFILE
+
+#include <atomic>
+#include <cstdint>
+
+#include "clock.h"
+#include "latency_histogram.h"
+
+// Each thread keeps the tick of its last stage boundary; a mark charges the
+// time since then to the stage that just ended.
+class stage_profiler {
+  private:
+    static latency_histogram histograms[int(relay_stage::COUNT)];
+    static std::atomic<uint64_t> total_ns[int(relay_stage::COUNT)];
+    static uint32_t sample_interval;
+
+    static thread_local uint64_t last_tick;
+    static thread_local uint32_t pass[int(profile_path::COUNT)];
+    static thread_local bool sampling;
+
+    static uint64_t ticks_to_ns(uint64_t ticks);
+
+  public:
+    // The generic timer is read straight from userspace; elsewhere fall
+    // back to the (vDSO) monotonic clock
+    static inline uint64_t ticks() {
+#if defined(__aarch64__)
+        uint64_t tick;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(tick));
+        return tick;
+#else
+        return monotonic_ns();
+#endif
+    }
+
+    static void init();
+    static inline void begin(profile_path path) {
+        uint32_t &passes = pass[int(path)];
+
+        sampling = ++passes >= sample_interval;
+        if (sampling) {
+            passes = 0;
+            last_tick = ticks();
+        }
+    }
+    static inline void mark(relay_stage stage) {
+        if (!sampling)
+            return;
+
+        uint64_t now = ticks();
+        uint64_t ns = ticks_to_ns(now - last_tick);
+        histograms[int(stage)].record(ns);
+        total_ns[int(stage)].fetch_add(ns, std::memory_order_relaxed);
+        last_tick = now;
+    }
+    static void dump(int fd);
+};
+
+#define PROFILE_INIT() stage_profiler::init()
+#define PROFILE_BEGIN() stage_profiler::begin(profile_path::Relay)
+#define PROFILE_BEGIN_FF() stage_profiler::begin(profile_path::Ff)
+#define PROFILE_MARK(stage) stage_profiler::mark(relay_stage::stage)
+#define PROFILE_DUMP(fd) stage_profiler::dump(fd)
+
+#else
+
+#define PROFILE_INIT()
+#define PROFILE_BEGIN()
+#define PROFILE_BEGIN_FF()
+#define PROFILE_MARK(stage)
+#define PROFILE_DUMP(fd)
+
+#endif
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef JOYCOND_STALE_CACHE_H
+#define JOYCOND_STALE_CACHE_H
+
+#define PROP_STALE_TTL "persist.vendor.joycond.stale_ttl_ms"
+#define DEFAULT_STALE_TTL 300000
+#define PROP_STALE_CAPACITY "persist.vendor.joycond.stale_capacity"
+#define DEFAULT_STALE_CAPACITY 4
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include "epoll_mgr.h"
+#include "virt_ctlr.h"
+
+// Holds virtual controllers whose serial joy-cons were all detached so they
+// can be handed back when the joy-cons return, without keeping their uinput
+// devices and mouse threads alive forever. Entries are keyed by every MAC the
+// controller knows, expire after a TTL and are evicted oldest-first once the
+// cache is full.
+class stale_cache {
+  public:
+    struct stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t expired;
+        uint64_t evicted;
+        size_t entries;
+        size_t resident_bytes;
+    };
+
+  private:
+    struct entry {
+        std::unique_ptr<virt_ctlr> virt;
+        std::vector<uint64_t> macs;
+        uint64_t expires_ns;
+        size_t footprint;
+    };
+
+    epoll_mgr &epoll_manager;
+    std::shared_ptr<epoll_subscriber> subscriber;
+    int timer_fd;
+    size_t capacity;
+    uint64_t ttl_ns;
+
+    // Oldest first; every entry shares the TTL so this is also expiry order
+    std::list<entry> entries;
+    std::unordered_map<uint64_t, std::list<entry>::iterator> by_mac;
+
+    // Read from binder threads by dump()
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> expired;
+    std::atomic<uint64_t> evicted;
+    std::atomic<size_t> count;
+    std::atomic<size_t> resident_bytes;
+
+    void erase(std::list<entry>::iterator it);
+    void arm_timer();
+    void timer_callback(int event_fd);
+
+  public:
+    stale_cache(epoll_mgr &epoll_manager, size_t capacity, uint64_t ttl_ms);
+    ~stale_cache();
+
+    void insert(std::unique_ptr<virt_ctlr> virt);
+    // Returns nullptr (and counts a miss) if no cached controller owns mac
+    std::unique_ptr<virt_ctlr> take(uint64_t mac);
+    bool contains(uint64_t mac) const { return by_mac.count(mac); }
+    struct stats get_stats() const;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef JOYCOND_TRACE_H
+#define JOYCOND_TRACE_H
+
+// Scoped timeline markers around pairing, hotplug and relaying. They go to
+// atrace on device, so they show up in Perfetto and systrace captures with
+// the "input" category. If PROP_TRACE_FILE names a file (or
+// $JOYCOND_TRACE_FILE off Android) they are written there as Chrome JSON
+// instead, which ui.perfetto.dev and chrome://tracing both open. Building
+// with -DJOYCOND_NO_TRACE compiles them out.
+
+// read once at startup; not persistent so a reboot turns it off again
+#define PROP_TRACE_FILE "vendor.joycond.trace_file"
+
+#ifndef JOYCOND_NO_TRACE
+
+#include <cstdint>
+#include <cstdio>
+
+#include "clock.h"
+
+#ifdef __ANDROID__
+#define ATRACE_TAG ATRACE_TAG_INPUT
+#include <cutils/trace.h>
+#endif
+
+class trace {
+  private:
+    static FILE *file;
+    static int pid;
+
+    static void write_event(const char *name, uint64_t start_ns,
+                            uint64_t end_ns);
+
+  public:
+    // Call before any thread that traces is started
+    static void init();
+
+    static inline void begin(const char *name, uint64_t *start_ns) {
+        if (file) {
+            *start_ns = monotonic_ns();
+            return;
+        }
+#ifdef __ANDROID__
+        ATRACE_BEGIN(name);
+#endif
+    }
+    static inline void end(const char *name, uint64_t start_ns) {
+        if (file) {
+            write_event(name, start_ns, monotonic_ns());
+            return;
+        }
+#ifdef __ANDROID__
+        ATRACE_END();
+#endif
+    }
+};
+
+// With neither backend on, this costs a couple of loads and branches
+class trace_scope {
+  private:
+    const char *name;
+    uint64_t start_ns;
+
+  public:
+    explicit trace_scope(const char *name) : name(name), start_ns(0) {
+        trace::begin(name, &start_ns);
+    }
+    ~trace_scope() { trace::end(name, start_ns); }
+
+    trace_scope(const trace_scope &) = delete;
+    trace_scope &operator=(const trace_scope &) = delete;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_INIT() trace::init()
+#define TRACE_SCOPE(name) trace_scope TRACE_CONCAT(trace_, __LINE__)(name)
+
+#else
+
+#define TRACE_INIT()
+#define TRACE_SCOPE(name)
+
+#endif
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef JOYCOND_UINPUT_POOL_H
+#define JOYCOND_UINPUT_POOL_H
+
+// whether to build a controller's virtual devices before it can pair
+#define PROP_UINPUT_POOL "persist.vendor.joycond.uinput_pool"
+#define DEFAULT_UINPUT_POOL true
+
+#include <atomic>
+#include <cstdint>
+#include <pthread.h>
+#include <vector>
+
+#include "virt_device.h"
+
+// Creating a uinput device takes tens of milliseconds and makes the
+// InputReader rescan, and used to happen right as a controller paired.
+// hid-nintendo takes a good while to probe a controller before its input
+// nodes show up, so ctlr_mgr asks for the devices it will pair into as soon
+// as its HID device appears, and they get built here on a background
+// thread. Only controllers that are on their way in get devices; the ones
+// nobody wants anymore are destroyed on the same thread.
+class uinput_pool {
+  private:
+    static void *__refillLoop(void *args);
+
+    bool enabled;
+    virt_device_factory create;
+    pthread_t refillThread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stopping;
+    // one entry per device wanted, so capability sets can repeat
+    std::vector<virt_caps> targets;
+    std::vector<virt_device> ready;
+    // what the refill thread is building right now, if anything
+    bool building;
+    virt_caps building_caps;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    // pairing to device ready and to first relayed event, for pooled and
+    // freshly made devices
+    std::atomic<uint64_t> pairing_ns[2];
+    std::atomic<uint64_t> pairing_count[2];
+    std::atomic<uint64_t> first_event_ns[2];
+    std::atomic<uint64_t> first_event_count[2];
+
+    bool next_missing(virt_caps *caps);
+    bool next_surplus(struct virt_device *dev);
+
+  public:
+    uinput_pool(bool enabled, virt_device_factory create);
+    ~uinput_pool();
+
+    // The devices to keep ready; whatever is no longer wanted is freed
+    void set_targets(const std::vector<virt_caps> &targets);
+    // Hands out a ready device if one matches, waits for it if it is being
+    // built, and otherwise creates one
+    bool claim(const virt_caps &caps, struct virt_device *dev);
+    void record_pairing(uint64_t latency_ns, bool pooled);
+    void record_first_event(uint64_t latency_ns, bool pooled);
+    void dump(int fd) const;
+};
+
+#endif
@@ -1,29 +1,98 @@
 #ifndef JOYCOND_VIRT_CTLR_H
 #define JOYCOND_VIRT_CTLR_H
 
-#include "Joycond.h"
+#include "clock.h"
+#include "ctlr_stats.h"
+#include "flight_recorder.h"
+#include "imu_sample.h"
+#include "latency_histogram.h"
+#include "mapping.h"
 #include "phys_ctlr.h"
+#include "rumble_sequencer.h"
 
 #include <memory>
 #include <vector>
 
 class virt_ctlr {
   private:
+    latency_histogram *latency = nullptr;
+    std::shared_ptr<ctlr_stats> stats;
+    uint8_t recorder_player = 0;
+
+  protected:
+    void record(flight::kind kind, uint8_t type, uint16_t code,
+                int32_t value) {
+        flight_recorder::record(kind, recorder_player, type, code, value);
+    }
+    void count(ctlr_stats::Counter counter, uint64_t n = 1) {
+        if (stats)
+            stats->add(counter, n);
+    }
+    // Call once a relayed SYN_REPORT has been written; phys_ctlr switches
+    // its evdev to CLOCK_MONOTONIC so the source time compares directly
+    void record_relay_latency(struct input_event const &ev) {
+        if (!latency)
+            return;
+
+        uint64_t source_ns = ev.input_event_sec * 1000000000ull +
+                             ev.input_event_usec * 1000ull;
+        uint64_t now_ns = monotonic_ns();
+        if (now_ns > source_ns)
+            latency->record(now_ns - source_ns);
+    }
+
   public:
+    enum class Kind { Passthrough, Pro, Combined };
+
     virt_ctlr() {}
     virtual ~virt_ctlr() {}
 
     virtual void handle_events(int fd) = 0;
+    virtual Kind get_kind() const = 0;
     virtual bool
     contains_phys_ctlr(std::shared_ptr<phys_ctlr> const ctlr) const = 0;
-    virtual bool contains_phys_ctlr(char const *devpath) const = 0;
+    virtual bool contains_phys_ctlr(const ctlr_id &id) const = 0;
     virtual bool contains_fd(int fd) const = 0;
     virtual std::vector<std::shared_ptr<phys_ctlr>> get_phys_ctlrs() = 0;
     virtual void remove_phys_ctlr(const std::shared_ptr<phys_ctlr> phys) = 0;
     virtual void add_phys_ctlr(std::shared_ptr<phys_ctlr> phys) = 0;
+    // Swaps old for replacement (the same controller on a new transport)
+    // while keeping the virtual device; false if unsupported
+    virtual bool handover_phys_ctlr(const std::shared_ptr<phys_ctlr> old,
+                                    std::shared_ptr<phys_ctlr> replacement) {
+        return false;
+    }
+    // Rebuilds the uinput device in place if the mapping or the attached
+    // controllers now call for different capabilities
+    virtual void reconfigure() {}
+    // Plays a timed rumble pattern on every attached controller; false if
+    // this kind of controller can't rumble through the daemon
+    virtual bool play_rumble_pattern(const std::vector<rumble_step> &steps,
+                                     int repeat) {
+        return false;
+    }
+    // Motion sensor report from the IMU of the attached controller id
+    virtual void handle_motion(const ctlr_id &id, const imu_sample &sample) {}
     virtual enum phys_ctlr::Model needs_model() = 0;
     virtual bool supports_hotplug() { return false; }
-    virtual bool mac_belongs(const std::string &mac) const { return false; }
+    virtual bool mac_belongs(uint64_t mac) const { return false; }
+    virtual std::vector<uint64_t> get_macs() const { return {}; }
+
+    // Rough estimate of the memory this controller keeps alive, including
+    // the stacks of any threads it owns
+    virtual size_t mem_footprint() const { return 0; }
+
+    // Where relay latencies go while this controller holds a player slot
+    void set_latency_histogram(latency_histogram *histogram) {
+        latency = histogram;
+    }
+    // 1-based player to tag flight records with, 0 for none
+    void set_recorder_player(int player) { recorder_player = player; }
+    // Assigned by ctlr_mgr on first pairing and kept across handovers
+    void set_stats(std::shared_ptr<ctlr_stats> stats) {
+        this->stats = std::move(stats);
+    }
+    const std::shared_ptr<ctlr_stats> &get_stats() const { return stats; }
 
     // Used to determine if this virtual controller should be removed from
     // paired controllers list
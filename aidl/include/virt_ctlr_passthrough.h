@@ -19,14 +19,16 @@ class virt_ctlr_passthrough : public virt_ctlr {
     virtual ~virt_ctlr_passthrough();
 
     virtual void handle_events(int fd);
+    virtual Kind get_kind() const { return Kind::Passthrough; }
     virtual bool
     contains_phys_ctlr(std::shared_ptr<phys_ctlr> const ctlr) const;
-    virtual bool contains_phys_ctlr(char const *devpath) const;
+    virtual bool contains_phys_ctlr(const ctlr_id &id) const;
     virtual bool contains_fd(int fd) const;
     virtual std::vector<std::shared_ptr<phys_ctlr>> get_phys_ctlrs();
     virtual void remove_phys_ctlr(const std::shared_ptr<phys_ctlr> phys);
     virtual void add_phys_ctlr(std::shared_ptr<phys_ctlr> phys);
     virtual enum phys_ctlr::Model needs_model();
+    virtual std::vector<uint64_t> get_macs() const;
 };
 
 #endif
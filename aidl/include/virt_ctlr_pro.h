@@ -1,10 +1,11 @@
 #ifndef JOYCOND_VIRT_CTLR_PRO
 #define JOYCOND_VIRT_CTLR_PRO
 
-#include "Joycond.h"
 #include "epoll_mgr.h"
+#include "ff_table.h"
 #include "phys_ctlr.h"
 #include "virt_ctlr.h"
+#include "virt_device.h"
 #include "virt_mouse.h"
 
 #include "cutils/properties.h"
@@ -17,37 +18,51 @@ class virt_ctlr_pro : public virt_ctlr {
   private:
     std::shared_ptr<phys_ctlr> phys;
     epoll_mgr &epoll_manager;
+    virt_device_factory create;
     std::shared_ptr<epoll_subscriber> subscriber;
-    struct libevdev *virt_evdev;
-    struct libevdev_uinput *uidev;
-    int uifd;
-    std::map<int, struct ff_effect> rumble_effects;
-    std::string mac;
+    struct virt_device dev;
+    event_sink *sink;
+    ff_table rumble_effects;
+    rumble_sequencer sequencer;
+    uint64_t mac;
+    int player;
 
     struct mapping *mMapping;
     pthread_mutex_t *mapLock;
 
     virt_mouse *mouse;
 
+    void emit(unsigned int type, unsigned int code, int value);
+    void relay_event(struct input_event const &ev);
     void relay_events(std::shared_ptr<phys_ctlr> phys);
     void handle_uinput_event();
+    virt_caps wanted_caps() const;
+    void subscribe();
+    void replay_state();
 
   public:
     virt_ctlr_pro(std::shared_ptr<phys_ctlr> phys, epoll_mgr &epoll_manager,
-                  struct mapping *mMapping, pthread_mutex_t *mapLock);
+                  const virt_device_factory &create, struct mapping *mMapping,
+                  pthread_mutex_t *mapLock);
     virtual ~virt_ctlr_pro();
 
     virtual void handle_events(int fd);
+    virtual Kind get_kind() const { return Kind::Pro; }
     virtual bool
     contains_phys_ctlr(std::shared_ptr<phys_ctlr> const ctlr) const;
-    virtual bool contains_phys_ctlr(char const *devpath) const;
+    virtual bool contains_phys_ctlr(const ctlr_id &id) const;
     virtual bool contains_fd(int fd) const;
     virtual std::vector<std::shared_ptr<phys_ctlr>> get_phys_ctlrs();
     virtual int get_uinput_fd();
     virtual void remove_phys_ctlr(const std::shared_ptr<phys_ctlr> phys);
     virtual void add_phys_ctlr(std::shared_ptr<phys_ctlr> phys);
+    virtual void reconfigure();
+    virtual bool play_rumble_pattern(const std::vector<rumble_step> &steps,
+                                     int repeat);
+    virtual void handle_motion(const ctlr_id &id, const imu_sample &sample);
     virtual enum phys_ctlr::Model needs_model();
-    virtual bool supports_hotplug() { return true; }
+    virtual std::vector<uint64_t> get_macs() const;
+    virtual size_t mem_footprint() const;
     virtual bool set_player_led(int index, bool on);
     virtual bool set_all_player_leds(bool on);
     virtual bool set_player_leds_to_player(int player);
@@ -0,0 +1,69 @@
+#ifndef JOYCOND_VIRT_DEVICE_H
+#define JOYCOND_VIRT_DEVICE_H
+
+#include <functional>
+#include <libevdev/libevdev-uinput.h>
+#include <libevdev/libevdev.h>
+
+#include "event_sink.h"
+
+// The motion sensor axes hid-nintendo reports, which virtual IMUs copy
+#define IMU_ACCEL_RES_PER_G 4096
+#define IMU_GYRO_RES_PER_DPS 14247
+
+// Everything that decides the capabilities of a uinput device we create.
+// Two devices with equal caps are interchangeable.
+struct virt_caps {
+    enum class Kind { Pro, Combined, Mouse, Imu };
+    // the controller an Imu belongs to, which gives it its name
+    enum class Host { None, Pro, Left_Joycon, Right_Joycon };
+
+    Kind kind;
+    bool analog; // ABS_Z/ABS_RZ instead of BTN_TL2/BTN_TR2
+    bool sl_sr;  // BTN_TRIGGER_HAPPY1-4 for the SL/SR buttons
+    bool leds;   // EV_LED for the player LEDs
+    bool fused;  // orientation on ABS_TILT_X, ABS_TILT_Y and ABS_WHEEL
+    Host host;
+
+    bool operator==(const virt_caps &other) const {
+        return kind == other.kind && analog == other.analog &&
+               sl_sr == other.sl_sr && leds == other.leds &&
+               fused == other.fused && host == other.host;
+    }
+    bool operator!=(const virt_caps &other) const { return !(*this == other); }
+    bool is_gamepad() const {
+        return kind == Kind::Pro || kind == Kind::Combined;
+    }
+
+    static virt_caps pro(bool analog, bool leds) {
+        return {Kind::Pro, analog, false, leds, false, Host::None};
+    }
+    static virt_caps combined(bool analog, bool sl_sr) {
+        return {Kind::Combined, analog, sl_sr, true, false, Host::None};
+    }
+    static virt_caps mouse() {
+        return {Kind::Mouse, false, false, false, false, Host::None};
+    }
+    static virt_caps imu(Host host, bool fused) {
+        return {Kind::Imu, false, false, false, fused, host};
+    }
+};
+
+// evdev and uidev are null for devices from a fake factory; sink is what
+// the virtual controllers write to either way
+struct virt_device {
+    virt_caps caps;
+    struct libevdev *evdev;
+    struct libevdev_uinput *uidev;
+    event_sink *sink;
+    bool pooled;
+};
+
+bool create_virt_device(const virt_caps &caps, struct virt_device *dev);
+void destroy_virt_device(struct virt_device *dev);
+
+// Makes a device; create_virt_device unless a fake is wanted
+typedef std::function<bool(const virt_caps &, struct virt_device *)>
+    virt_device_factory;
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef JOYCOND_VIRT_IMU_H
+#define JOYCOND_VIRT_IMU_H
+
+// relay every Nth IMU report; 0 leaves the motion sensors alone
+#define PROP_IMU_DECIMATION "persist.vendor.joycond.imu_decimation"
+#define DEFAULT_IMU_DECIMATION 2
+
+#include <cstdint>
+#include <libevdev/libevdev.h>
+#include <memory>
+#include <string>
+
+#include "epoll_mgr.h"
+#include "imu_fusion.h"
+#include "imu_sample.h"
+#include "virt_device.h"
+
+// Grabs the motion sensor node hid-nintendo exposes next to a controller and
+// relays it through a virtual accelerometer, so it stays visible once the
+// controller itself is hidden behind a virtual gamepad. Reports are decimated
+// by whole SYN_REPORT frames; the values in a frame are the latest seen.
+// The listener sees every frame, before decimation. With caps.fused, the
+// orientation goes out as roll, pitch and yaw in centidegrees on ABS_TILT_X,
+// ABS_TILT_Y and ABS_WHEEL.
+class virt_imu {
+  private:
+    // accel on ABS_X..ABS_Z, gyro on ABS_RX..ABS_RZ
+    static constexpr int AXES = 6;
+
+    epoll_mgr &epoll_manager;
+    std::shared_ptr<epoll_subscriber> subscriber;
+    int fd;
+    struct libevdev *src;
+    struct virt_device dev;
+    unsigned int decimation;
+    unsigned int frames;
+    int values[AXES];
+    uint32_t dirty;
+    int timestamp;
+    bool timestamp_dirty;
+    bool has_timestamp;
+    // converts raw axis values to g and degrees per second
+    float scale[AXES];
+    // converts raw axis values to the virtual device's resolution, should
+    // the driver ever change its own
+    double rescale[AXES];
+    uint64_t timestamp_us;
+    imu_listener listener;
+    bool fuse;
+    imu_fusion fusion;
+
+    struct imu_sample make_sample(const struct input_event &syn);
+    void handle_event(const struct input_event &ev);
+    void handle_events();
+
+  public:
+    virt_imu(epoll_mgr &epoll_manager, const virt_device_factory &create,
+             const std::string &devnode, const virt_caps &caps,
+             unsigned int decimation);
+    ~virt_imu();
+
+    // false if the node or the virtual device couldn't be set up
+    bool is_valid() const { return dev.sink != nullptr; }
+    void set_listener(imu_listener listener) {
+        this->listener = std::move(listener);
+    }
+};
+
+#endif
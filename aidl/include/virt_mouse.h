@@ -26,8 +26,10 @@
 #include "cutils/properties.h"
 
 #include "epoll_mgr.h"
+#include "gyro_pointer.h"
 #include "phys_ctlr.h"
 #include "virt_ctlr.h"
+#include "virt_device.h"
 
 class virt_mouse {
   private:
@@ -38,17 +40,33 @@ class virt_mouse {
     std::atomic<float> sense_y;
     pthread_t mouseThread;
 
-    struct libevdev *virt_evdev;
-    struct libevdev_uinput *uidev;
+    struct virt_device dev;
+    event_sink *sink;
+    // The poll thread and the mouse thread both write frames to sink; this
+    // keeps one from landing in the middle of the other
+    pthread_mutex_t write_lock;
+
+    // gyro aiming, toggled by clicking both sticks together
+    gyro_pointer gyro;
+    bool gyro_enabled;
+    bool thumbl;
+    bool thumbr;
 
   public:
-    virt_mouse();
+    virt_mouse(const virt_device_factory &create);
     ~virt_mouse();
 
     void sync_event(struct input_event ev);
+    size_t mem_footprint() const;
 
     // Takes RS event and processes into an event for our virtual mouse
     void relay_mouse_event(struct input_event ev);
+    // Watches every button event for the gyro aiming chord
+    void relay_button_event(struct input_event const &ev);
+    // Runs on the poll thread for every IMU report, so it must stay cheap
+    void relay_motion(const imu_sample &sample);
+    // One pass of the mouse thread: moves by the latest stick deflection
+    void tick();
 };
 
 #endif
@@ -1,3 +1,6 @@
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
 #include <fcntl.h>
 #include <iostream>
 #include <sys/stat.h>
@@ -5,9 +8,12 @@
 #include <android-base/properties.h>
 #include <utils/Log.h>
 
+#include "clock.h"
 #include "ctlr_detector.h"
 #include "ctlr_mgr.h"
 #include "epoll_mgr.h"
+#include "flight_recorder.h"
+#include "loop_watchdog.h"
 
 #include "Joycond.h"
 
@@ -18,8 +24,8 @@ using ::android::base::GetProperty;
 using ::android::base::SetProperty;
 using ::ndk::ScopedAStatus;
 
-Joycond::Joycond() {
-    parseLayoutFromFile();
+Joycond::Joycond() : ctlrManager(nullptr) {
+    parseLayoutFromFile(mMapping.layout);
     mMapping.combined = GetBoolProperty(PROP_COMBINED, true);
     mMapping.analog = GetBoolProperty(PROP_ANALOG, true);
     mMapping.rsmouse = GetBoolProperty(PROP_RSMOUSE, true);
@@ -30,7 +36,8 @@ Joycond::Joycond() {
     SetProperty(PROP_RSMOUSE, mMapping.rsmouse ? "1" : "0");
 
     ready.store(true);
-    if (pthread_mutex_init(&mapLock, NULL)) {
+    if (pthread_mutex_init(&mapLock, NULL) ||
+        pthread_mutex_init(&reloadLock, NULL)) {
         ALOGE("pthread_mutex_init failed!");
         return;
     }
@@ -47,10 +54,11 @@ Joycond::Joycond() {
 Joycond::~Joycond() {
     ready.store(false);
     pthread_join(pollThread, NULL);
+    pthread_mutex_destroy(&reloadLock);
     pthread_mutex_destroy(&mapLock);
 }
 
-::ndk::ScopedAStatus Joycond::restartService() {
+::ndk::ScopedAStatus Joycond::restartPollThread() {
     int ret;
 
     ready.store(false);
@@ -68,6 +76,51 @@ Joycond::~Joycond() {
     return ScopedAStatus::ok();
 }
 
+::ndk::ScopedAStatus Joycond::restartService() {
+    pthread_mutex_lock(&reloadLock);
+    ScopedAStatus status = restartPollThread();
+    pthread_mutex_unlock(&reloadLock);
+
+    return status;
+}
+
+::ndk::ScopedAStatus Joycond::reloadService(bool full, int64_t *_aidl_return) {
+    std::map<uint32_t, uint32_t> layout;
+    ScopedAStatus status = ScopedAStatus::ok();
+    uint64_t start_ns = monotonic_ns();
+    ctlr_mgr *manager = nullptr;
+    uint64_t ticket = 0;
+
+    pthread_mutex_lock(&reloadLock);
+    parseLayoutFromFile(layout);
+
+    pthread_mutex_lock(&mapLock);
+    mMapping.layout.swap(layout);
+    mMapping.combined = GetBoolProperty(PROP_COMBINED, true);
+    mMapping.analog = GetBoolProperty(PROP_ANALOG, true);
+    mMapping.rsmouse = GetBoolProperty(PROP_RSMOUSE, true);
+    if (!full && ctlrManager) {
+        manager = ctlrManager;
+        ticket = manager->request_reconfigure();
+    }
+    pthread_mutex_unlock(&mapLock);
+
+    if (full) {
+        status = restartPollThread();
+    } else if (manager &&
+               !manager->wait_reconfigured(ticket, RELOAD_TIMEOUT_MS)) {
+        ALOGE("Timed out waiting for the poll thread to apply the reload");
+        status = ScopedAStatus::fromServiceSpecificError(ETIMEDOUT);
+    }
+    pthread_mutex_unlock(&reloadLock);
+
+    *_aidl_return = (monotonic_ns() - start_ns) / 1000;
+    ALOGI("%s reload took %" PRId64 " us", full ? "Full" : "Incremental",
+          *_aidl_return);
+
+    return status;
+}
+
 ::ndk::ScopedAStatus Joycond::setLayout(const std::vector<KeyMap> &layout) {
     std::string str = "";
 
@@ -120,6 +173,8 @@ Joycond::~Joycond() {
 ::ndk::ScopedAStatus Joycond::setAnalog(bool analog) {
     pthread_mutex_lock(&mapLock);
     mMapping.analog = analog;
+    if (ctlrManager)
+        ctlrManager->request_reconfigure();
     pthread_mutex_unlock(&mapLock);
     SetProperty(PROP_ANALOG, analog ? "1" : "0");
 
@@ -151,21 +206,136 @@ Joycond::~Joycond() {
     return ScopedAStatus::ok();
 }
 
+::ndk::ScopedAStatus
+Joycond::playRumblePattern(int32_t player, const std::vector<int32_t> &timings,
+                           const std::vector<int32_t> &amplitudes,
+                           int32_t repeat) {
+    std::vector<rumble_step> steps;
+
+    if (timings.size() != amplitudes.size() || repeat < -1 ||
+        repeat >= int32_t(timings.size()))
+        return ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+
+    for (size_t i = 0; i < timings.size(); i++) {
+        if (timings[i] < 0 || amplitudes[i] < 0 || amplitudes[i] > 255)
+            return ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+        steps.push_back({uint32_t(timings[i]), uint8_t(amplitudes[i])});
+    }
+
+    pthread_mutex_lock(&mapLock);
+    if (ctlrManager)
+        ctlrManager->play_rumble_pattern(player, steps, repeat);
+    pthread_mutex_unlock(&mapLock);
+
+    return ScopedAStatus::ok();
+}
+
+ScopedAStatus Joycond::getRelayLatency(int32_t player,
+                                       std::vector<int64_t> *_aidl_return) {
+    uint64_t count, p50, p99, p999;
+    bool found = false;
+
+    pthread_mutex_lock(&mapLock);
+    if (ctlrManager)
+        found = ctlrManager->get_relay_latency(player, &count, &p50, &p99,
+                                               &p999);
+    pthread_mutex_unlock(&mapLock);
+
+    if (!found)
+        return ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+
+    *_aidl_return = {int64_t(count), int64_t(p50), int64_t(p99),
+                     int64_t(p999)};
+    return ScopedAStatus::ok();
+}
+
+ScopedAStatus Joycond::getLoopLag(std::vector<int64_t> *_aidl_return) {
+    std::vector<uint64_t> lag;
+
+    pthread_mutex_lock(&mapLock);
+    if (ctlrManager)
+        lag = ctlrManager->get_loop_lag();
+    pthread_mutex_unlock(&mapLock);
+
+    if (lag.empty())
+        return ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
+
+    _aidl_return->assign(lag.begin(), lag.end());
+    return ScopedAStatus::ok();
+}
+
+ScopedAStatus Joycond::getStats(std::vector<ControllerStats> *_aidl_return) {
+    std::vector<ctlr_stats::snapshot> snapshots;
+
+    pthread_mutex_lock(&mapLock);
+    if (ctlrManager)
+        snapshots = ctlrManager->get_stats();
+    pthread_mutex_unlock(&mapLock);
+
+    _aidl_return->clear();
+    for (auto &s : snapshots) {
+        ControllerStats stats;
+
+        stats.isVirtual = s.is_virtual;
+        stats.name = s.name;
+        stats.mac = s.mac ? format_mac(s.mac) : "";
+        stats.player = s.player;
+        stats.eventsRead = s.counts[ctlr_stats::EventsRead];
+        stats.eventsWritten = s.counts[ctlr_stats::EventsWritten];
+        stats.framesPerSecond = s.frames_per_second;
+        stats.synDropped = s.counts[ctlr_stats::SynDropped];
+        stats.ffForwarded = s.counts[ctlr_stats::FfForwarded];
+        stats.ffDropped = s.counts[ctlr_stats::FfDropped];
+        stats.ledWrites = s.counts[ctlr_stats::LedWrites];
+        stats.reconnects = s.counts[ctlr_stats::Reconnects];
+        stats.uptimeMs = s.uptime_ns / 1000000;
+        _aidl_return->push_back(stats);
+    }
+    return ScopedAStatus::ok();
+}
+
+binder_status_t Joycond::dump(int fd, const char **args, uint32_t numArgs) {
+    // The recorder is static and lock-free, so no need for mapLock
+    if (numArgs > 0 && !strcmp(args[0], "--flight"))
+        return flight_recorder::write(fd) ? STATUS_OK
+                                          : STATUS_FAILED_TRANSACTION;
+
+    pthread_mutex_lock(&mapLock);
+    dprintf(fd, "combined: %d analog: %d rsmouse: %d\n", mMapping.combined,
+            mMapping.analog, mMapping.rsmouse);
+    if (ctlrManager)
+        ctlrManager->dump(fd);
+    else
+        dprintf(fd, "Poll thread not running\n");
+    pthread_mutex_unlock(&mapLock);
+
+    return STATUS_OK;
+}
+
 void *Joycond::__threadLoop(void *args) {
     Joycond *const self = static_cast<Joycond *>(args);
 
     epoll_mgr epoll_manager;
+    loop_watchdog watchdog(epoll_manager);
     ctlr_mgr ctlr_manager(epoll_manager, &(self->mMapping), &(self->mapLock));
     ctlr_detector ctlr_detector(ctlr_manager, epoll_manager);
 
+    pthread_mutex_lock(&self->mapLock);
+    self->ctlrManager = &ctlr_manager;
+    pthread_mutex_unlock(&self->mapLock);
+
     while (self->ready.load()) {
         epoll_manager.loop();
     }
 
+    pthread_mutex_lock(&self->mapLock);
+    self->ctlrManager = nullptr;
+    pthread_mutex_unlock(&self->mapLock);
+
     return NULL;
 }
 
-void Joycond::parseLayoutFromFile() {
+void Joycond::parseLayoutFromFile(std::map<uint32_t, uint32_t> &layout) {
     int ret;
     char *token;
     std::string buf;
@@ -203,7 +373,7 @@ void Joycond::parseLayoutFromFile() {
         if (ret != 2)
             ALOGE("Failed to parse pair from %s", ctok);
         else
-            mMapping.layout.insert(mPair);
+            layout.insert(mPair);
     }
 }
 
@@ -1,4 +1,5 @@
 #include "ctlr_detector.h"
+#include "trace.h"
 
 #include <android-base/logging.h>
 #include <dirent.h>
@@ -7,20 +8,23 @@
 #include <libevdev/libevdev.h>
 #include <linux/netlink.h>
 #include <linux/types.h>
-#include <netlink/msg.h>
 #include <sstream>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <utils/Log.h>
 
 // private
-bool ctlr_detector::check_ctlr_attributes(std::string devpath) {
+bool ctlr_detector::check_ctlr_attributes(std::string devpath, bool *is_imu) {
     struct libevdev *evdev;
 
+    *is_imu = false;
+
     // Open device to confirm the vendor and product id, not given in uevent
     int fd = open(devpath.c_str(), O_RDWR | O_NONBLOCK);
     if (fd < 0) {
@@ -60,29 +64,173 @@ bool ctlr_detector::check_ctlr_attributes(std::string devpath) {
         return false;
     }
 
-    if (is_accel)
-        return false;
-
+    *is_imu = is_accel;
     return true;
 }
 
 // private
+std::string ctlr_detector::get_hid_parent(const std::string &devpath) {
+    // The controller's and the IMU's input devices hang off the same HID
+    // device
+    char *path = realpath(("/sys/" + devpath + "/device").c_str(), NULL);
+    if (!path)
+        return "";
+
+    std::string parent(path);
+    free(path);
+    return parent;
+}
+
+// private
+void ctlr_detector::track_ctlr(dev_t dev, const std::string &devpath,
+                               const std::string &devnode) {
+    if (ctlr_dev_map.count(dev)) {
+        ALOGE("%s is already tracked", devnode.c_str());
+        return;
+    }
+
+    std::ifstream funiq("/sys/" + devpath + "/uniq");
+    std::string uniq = "";
+    std::getline(funiq, uniq);
+
+    ctlr_entry entry = {{dev, next_gen++}, devnode, parse_mac(uniq),
+                        get_hid_parent(devpath)};
+    ctlr_manager.add_ctlr(entry.id, devpath, devnode);
+    ALOGI("Add controller to map: %s", devpath.c_str());
+    if (entry.mac)
+        ctlr_mac_map[entry.mac] = dev;
+    ctlr_dev_map.emplace(dev, std::move(entry));
+    attach_imus();
+}
+
+void ctlr_detector::untrack_ctlr(dev_t dev) {
+    auto entry = ctlr_dev_map.find(dev);
+    if (entry == ctlr_dev_map.end())
+        return;
+
+    ALOGI("Remove controller from map: %s", entry->second.devnode.c_str());
+    ctlr_manager.remove_ctlr(entry->second.id);
+
+    auto mac = ctlr_mac_map.find(entry->second.mac);
+    if (mac != ctlr_mac_map.end() && mac->second == dev)
+        ctlr_mac_map.erase(mac);
+    ctlr_dev_map.erase(entry);
+
+    // ctlr_mgr drops the relay along with the controller
+    for (auto &imu : imu_dev_map) {
+        if (imu.second.attached && imu.second.owner == dev)
+            imu.second.attached = false;
+    }
+    attach_imus();
+}
+
+void ctlr_detector::track_imu(dev_t dev, const std::string &devpath,
+                              const std::string &devnode) {
+    if (imu_dev_map.count(dev)) {
+        ALOGE("%s is already tracked", devnode.c_str());
+        return;
+    }
+
+    std::ifstream funiq("/sys/" + devpath + "/uniq");
+    std::string uniq = "";
+    std::getline(funiq, uniq);
+
+    ALOGI("Add IMU to map: %s", devpath.c_str());
+    imu_dev_map[dev] = {devnode, parse_mac(uniq), get_hid_parent(devpath),
+                        false, 0};
+    attach_imus();
+}
+
+void ctlr_detector::untrack_imu(dev_t dev) {
+    auto entry = imu_dev_map.find(dev);
+    if (entry == imu_dev_map.end())
+        return;
+
+    ALOGI("Remove IMU from map: %s", entry->second.devnode.c_str());
+    auto owner = ctlr_dev_map.find(entry->second.owner);
+    if (entry->second.attached && owner != ctlr_dev_map.end())
+        ctlr_manager.remove_imu(owner->second.id);
+    imu_dev_map.erase(entry);
+}
+
+void ctlr_detector::attach_imus() {
+    for (auto &imu : imu_dev_map) {
+        if (imu.second.attached)
+            continue;
+
+        for (auto &ctlr : ctlr_dev_map) {
+            const imu_entry &i = imu.second;
+            bool match = i.parent.empty() ? i.mac && i.mac == ctlr.second.mac
+                                          : i.parent == ctlr.second.parent;
+            if (!match)
+                continue;
+
+            ctlr_manager.add_imu(ctlr.second.id, imu.second.devnode);
+            imu.second.attached = true;
+            imu.second.owner = ctlr.first;
+            break;
+        }
+    }
+}
+
 void ctlr_detector::scan_removed_ctlrs() {
     // Scan all controllers we think are connected to double check they actually
     // are, removing if needed
 
-    for (auto ctlr : ctlr_dev_map) {
-        if (access(ctlr.second.c_str(), F_OK)) {
+    for (auto &ctlr : ctlr_dev_map) {
+        if (access(ctlr.second.devnode.c_str(), F_OK)) {
             // Controller has been disconnected, it's event file is missing
-            ctlr_manager.remove_ctlr(ctlr.first);
-            ctlr_dev_map.erase(ctlr.first);
+            untrack_ctlr(ctlr.first);
+            return;
+        }
+    }
+
+    for (auto &imu : imu_dev_map) {
+        if (access(imu.second.devnode.c_str(), F_OK)) {
+            untrack_imu(imu.first);
             return;
         }
     }
 }
 
+// private
+void ctlr_detector::handle_hid_uevent(bool add, const std::string &hid_id,
+                                      const std::string &uniq) {
+    unsigned int bus, vid, pid;
+    phys_ctlr::Model model;
+
+    // HID_ID=0005:0000057E:00002009
+    if (sscanf(hid_id.c_str(), "%x:%x:%x", &bus, &vid, &pid) != 3 ||
+        vid != 0x57e)
+        return;
+
+    switch (pid) {
+    case 0x2006: // JoyCon L
+        model = phys_ctlr::Model::Left_Joycon;
+        break;
+    case 0x2007: // JoyCon R
+        model = phys_ctlr::Model::Right_Joycon;
+        break;
+    case 0x2009: // Pro Controller
+        model = phys_ctlr::Model::Procon;
+        break;
+    case 0x2017: // SNES Controller
+        model = phys_ctlr::Model::Snescon;
+        break;
+    default:
+        return;
+    }
+
+    // hid-nintendo takes a while to probe it, so get its devices going now
+    if (add)
+        ctlr_manager.expect_ctlr(parse_mac(uniq), model);
+    else
+        ctlr_manager.forget_ctlr(parse_mac(uniq));
+}
+
 // private
 void ctlr_detector::epoll_event_callback(int event_fd) {
+    TRACE_SCOPE("ctlr_detector::epoll_event_callback");
     char buf[8192];
     struct iovec event_iovec = {buf, sizeof(buf)};
     struct sockaddr_nl event_sockaddr;
@@ -94,6 +242,8 @@ void ctlr_detector::epoll_event_callback(int event_fd) {
     event_len = recvmsg(event_fd, &event_msg, 0);
 
     std::string devpath, devnode, key, val;
+    std::string subsystem, hid_id, hid_uniq;
+    unsigned int major = 0, minor = 0;
 
     bool action = false;
     bool correct = false;
@@ -113,20 +263,36 @@ void ctlr_detector::epoll_event_callback(int event_fd) {
                 }
             }
 
-            if (key == "SUBSYSTEM") {
-                correct = (val == "input") && correct;
-            }
+            if (key == "SUBSYSTEM")
+                subsystem = val;
+
+            if (key == "HID_ID")
+                hid_id = val;
+
+            if (key == "HID_UNIQ")
+                hid_uniq = val;
 
             if (key == "DEVPATH")
                 devpath = val;
 
             if (key == "DEVNAME" && val.find("/dev/") == std::string::npos)
                 devnode = "/dev/" + val;
+
+            if (key == "MAJOR")
+                major = strtoul(val.c_str(), NULL, 10);
+
+            if (key == "MINOR")
+                minor = strtoul(val.c_str(), NULL, 10);
         }
         pos += strlen(&buf[pos]) + 1;
     }
 
-    if (!correct)
+    if (correct && subsystem == "hid") {
+        handle_hid_uevent(action, hid_id, hid_uniq);
+        return;
+    }
+
+    if (!correct || subsystem != "input")
         return;
 
     // Only accept event* devices and complete requests
@@ -135,6 +301,14 @@ void ctlr_detector::epoll_event_callback(int event_fd) {
          (devnode.find("hid") == std::string::npos)))
         return;
 
+    dev_t dev = makedev(major, minor);
+
+    if (!action) {
+        untrack_ctlr(dev);
+        untrack_imu(dev);
+        return;
+    }
+
     devpath =
         "/class/input/" + std::string(basename(devnode.c_str())) + "/device";
 
@@ -144,33 +318,30 @@ void ctlr_detector::epoll_event_callback(int event_fd) {
     // Check the MAC to handle replacements - disconnects are not reported
     // instantly so otherwise we can end up desynced
     std::ifstream funiq("/sys/" + devpath + "/uniq");
-    std::string mac_addr = "";
-    std::getline(funiq, mac_addr);
-
-    if (ctlr_mac_map.count(mac_addr)) {
-        // Remove old controller
-        ctlr_manager.remove_ctlr(ctlr_dev_map[ctlr_mac_map[mac_addr]]);
-        ctlr_dev_map.erase(ctlr_mac_map[mac_addr]);
-    }
-
-    if (!action) {
-        ctlr_dev_map.erase(devnode);
-        ALOGI("Remove controller from map: %s", devpath.c_str());
-        ctlr_manager.remove_ctlr(devpath);
-        return;
+    std::string uniq = "";
+    std::getline(funiq, uniq);
+
+    auto old = ctlr_mac_map.find(parse_mac(uniq));
+    bool replace = old != ctlr_mac_map.end() && old->second != dev;
+    dev_t old_dev = replace ? old->second : 0;
+
+    // Add the new node before dropping the old one so ctlr_mgr can hand the
+    // virtual controller over instead of tearing its state down
+    bool is_imu;
+    if (check_ctlr_attributes(devnode, &is_imu)) {
+        if (is_imu)
+            track_imu(dev, devpath, devnode);
+        else
+            track_ctlr(dev, devpath, devnode);
     }
 
-    if (check_ctlr_attributes(devnode)) {
-        ctlr_manager.add_ctlr(devpath, devnode);
-        ALOGI("Add controller to map: %s", devpath.c_str());
-        ctlr_dev_map.insert({devpath, devnode});
-        ctlr_mac_map.insert({mac_addr, devpath});
-    }
+    if (replace && !is_imu)
+        untrack_ctlr(old_dev);
 }
 
 // public
 ctlr_detector::ctlr_detector(ctlr_mgr &ctlr_manager, epoll_mgr &epoll_manager)
-    : ctlr_manager(ctlr_manager), epoll_manager(epoll_manager) {
+    : ctlr_manager(ctlr_manager), epoll_manager(epoll_manager), next_gen(0) {
     struct sockaddr_nl uevent_socket;
     struct pollfd uevent_pollfd;
     struct dirent *event_dirent;
@@ -178,9 +349,10 @@ ctlr_detector::ctlr_detector(ctlr_mgr &ctlr_manager, epoll_mgr &epoll_manager)
     std::string sysfs_event_path;
     DIR *input_dir;
 
+    // A box without any input devices may not have the directory yet
     input_dir = opendir("/dev/input/");
 
-    while ((event_dirent = readdir(input_dir)) != NULL) {
+    while (input_dir && (event_dirent = readdir(input_dir)) != NULL) {
         if (event_dirent->d_type & DT_DIR)
             continue;
 
@@ -188,18 +360,20 @@ ctlr_detector::ctlr_detector(ctlr_mgr &ctlr_manager, epoll_mgr &epoll_manager)
         sysfs_event_path =
             "/class/input/" + std::string(event_dirent->d_name) + "/device";
 
-        if (check_ctlr_attributes(event_path)) {
-            ctlr_manager.add_ctlr(sysfs_event_path, event_path);
-
-            std::ifstream funiq("/sys/" + sysfs_event_path + "/uniq");
-            std::string mac_addr = "";
-            std::getline(funiq, mac_addr);
+        struct stat st;
+        if (stat(event_path.c_str(), &st) || !S_ISCHR(st.st_mode))
+            continue;
 
-            ALOGI("Add controller to map: %s", sysfs_event_path.c_str());
-            ctlr_dev_map.insert({sysfs_event_path, event_path});
-            ctlr_mac_map.insert({mac_addr, sysfs_event_path});
-        }
+        bool is_imu;
+        if (!check_ctlr_attributes(event_path, &is_imu))
+            continue;
+        if (is_imu)
+            track_imu(st.st_rdev, sysfs_event_path, event_path);
+        else
+            track_ctlr(st.st_rdev, sysfs_event_path, event_path);
     }
+    if (input_dir)
+        closedir(input_dir);
 
     // Open netlink socket
     memset(&uevent_socket, 0, sizeof(struct sockaddr_nl));
@@ -0,0 +1,26 @@
+#include "ctlr_id.h"
+
+#include <cstdio>
+
+uint64_t parse_mac(const std::string &mac) {
+    unsigned int b[6];
+
+    if (sscanf(mac.c_str(), "%2x:%2x:%2x:%2x:%2x:%2x", &b[0], &b[1], &b[2],
+               &b[3], &b[4], &b[5]) != 6)
+        return 0;
+
+    uint64_t ret = 0;
+    for (int i = 0; i < 6; i++)
+        ret = (ret << 8) | (b[i] & 0xff);
+    return ret;
+}
+
+std::string format_mac(uint64_t mac) {
+    char buf[18];
+
+    snprintf(buf, sizeof(buf), "%02x:%02x:%02x:%02x:%02x:%02x",
+             unsigned(mac >> 40) & 0xff, unsigned(mac >> 32) & 0xff,
+             unsigned(mac >> 24) & 0xff, unsigned(mac >> 16) & 0xff,
+             unsigned(mac >> 8) & 0xff, unsigned(mac) & 0xff);
+    return buf;
+}
@@ -1,237 +1,793 @@
 #include "ctlr_mgr.h"
+#include "clock.h"
+#include "ff_table.h"
+#include "stage_profiler.h"
+#include "trace.h"
 #include "virt_ctlr_combined.h"
 #include "virt_ctlr_passthrough.h"
 #include "virt_ctlr_pro.h"
 
+#include <algorithm>
+#include <android-base/properties.h>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include <utils/Log.h>
 
+using ::android::base::GetBoolProperty;
+using ::android::base::GetIntProperty;
+
+// hid-nintendo has long given up on a controller it hasn't probed by then
+static const uint64_t EXPECT_TIMEOUT_NS = 5000000000ull;
+
 // private
-void ctlr_mgr::epoll_event_callback(int event_fd) {
-    for (auto &kv : unpaired_controllers) {
-        auto ctlr = kv.second;
-        if (event_fd == ctlr->get_fd()) {
-            ctlr->handle_events();
-            switch (ctlr->get_pairing_state()) {
-            case phys_ctlr::PairingState::Lone:
-                ALOGI("Lone controller paired");
-                add_passthrough_ctlr(ctlr);
-                break;
-            case phys_ctlr::PairingState::Virt_Procon:
-                ALOGI("Virtual procon paired");
-                add_virt_procon_ctlr(ctlr);
-                break;
-            case phys_ctlr::PairingState::Waiting:
-                ALOGI("Waiting controller needs partner");
-                if (ctlr->get_model() == phys_ctlr::Model::Left_Joycon) {
-                    if (!left) {
-                        left = ctlr;
-                        ALOGI("Found left");
-                    }
-                } else {
-                    if (!right) {
-                        right = ctlr;
-                        ALOGI("Found right");
-                    }
-                }
-                if (left && right) {
-                    add_combined_ctlr();
-                    left = nullptr;
-                    right = nullptr;
-                }
-                break;
-            case phys_ctlr::PairingState::Horizontal:
-                ALOGI("Joy-Con paired in horizontal mode");
-                add_passthrough_ctlr(ctlr);
-                break;
-            default:
-                if (left == ctlr)
-                    left = nullptr;
-                if (right == ctlr)
-                    right = nullptr;
-                break;
+void ctlr_mgr::epoll_event_callback(const ctlr_id &id, int event_fd) {
+    auto unpaired = unpaired_controllers.find(id);
+    if (unpaired != unpaired_controllers.end())
+        handle_unpaired(unpaired->second);
+
+    auto paired = paired_index.find(id);
+    if (paired == paired_index.end() || !paired_controllers[paired->second])
+        return;
+
+    size_t slot = paired->second;
+    paired_controllers[slot]->handle_events(event_fd);
+    if (first_events[slot].paired_ns) {
+        pool.record_first_event(monotonic_ns() - first_events[slot].paired_ns,
+                                first_events[slot].pooled);
+        first_events[slot].paired_ns = 0;
+    }
+}
+
+void ctlr_mgr::handle_unpaired(std::shared_ptr<phys_ctlr> ctlr) {
+    TRACE_SCOPE("ctlr_mgr::handle_unpaired");
+    ctlr->handle_events();
+
+    phys_ctlr::PairingState state = ctlr->get_pairing_state();
+    auto last = pairing_states.find(ctlr->get_id());
+    bool changed = last == pairing_states.end() || last->second != state;
+    if (changed) {
+        flight_recorder::record(flight::kind::Pairing,
+                                ctlr->get_event_number(), 0, int(state), 0);
+        pairing_states[ctlr->get_id()] = state;
+    }
+
+    switch (state) {
+    case phys_ctlr::PairingState::Lone:
+        ALOGI("Lone controller paired");
+        add_passthrough_ctlr(ctlr);
+        break;
+    case phys_ctlr::PairingState::Virt_Procon:
+        ALOGI("Virtual procon paired");
+        add_virt_procon_ctlr(ctlr);
+        break;
+    case phys_ctlr::PairingState::Waiting:
+        ALOGI("Waiting controller needs partner");
+        if (ctlr->get_model() == phys_ctlr::Model::Left_Joycon) {
+            if (!left) {
+                left = ctlr;
+                ALOGI("Found left");
+            }
+        } else {
+            if (!right) {
+                right = ctlr;
+                ALOGI("Found right");
             }
-            break;
         }
+        if (left && right) {
+            add_combined_ctlr(left, right);
+            left = nullptr;
+            right = nullptr;
+        }
+        break;
+    case phys_ctlr::PairingState::Horizontal:
+        ALOGI("Joy-Con paired in horizontal mode");
+        add_passthrough_ctlr(ctlr);
+        break;
+    default:
+        if (left == ctlr)
+            left = nullptr;
+        if (right == ctlr)
+            right = nullptr;
+        break;
     }
 
-    for (auto &ctlr : paired_controllers) {
-        if (!ctlr)
-            continue;
-        if (ctlr->contains_fd(event_fd))
-            ctlr->handle_events(event_fd);
+    if (changed)
+        update_pool_targets();
+}
+
+int ctlr_mgr::acquire_slot(uint64_t mac) {
+    int slot = -1;
+
+    // Controllers from the last session go back to the player they were
+    auto pending = mac ? restore_index.find(mac) : restore_index.end();
+    if (pending != restore_index.end()) {
+        size_t index = pending->second;
+        if (slots.take(restore_entries[index].slot))
+            slot = restore_entries[index].slot;
+        finish_restore(index);
     }
+
+    if (slot < 0)
+        slot = slots.acquire(mac);
+
+    if (slot < 0)
+        ALOGE("All %d player slots are in use", slots.get_capacity());
+    else
+        ALOGI("Assigned player %d", slot + 1);
+    return slot;
 }
 
-void ctlr_mgr::add_passthrough_ctlr(std::shared_ptr<phys_ctlr> phys) {
-    std::unique_ptr<virt_ctlr_passthrough> passthrough(
-        new virt_ctlr_passthrough(phys));
+void ctlr_mgr::insert_paired(size_t slot, std::unique_ptr<virt_ctlr> virt) {
+    TRACE_SCOPE("ctlr_mgr::insert_paired");
+    if (!virt->get_stats()) {
+        std::vector<uint64_t> macs = virt->get_macs();
+        const char *name = "Passthrough";
+
+        if (virt->get_kind() == virt_ctlr::Kind::Pro)
+            name = "Virtual Pro Controller";
+        else if (virt->get_kind() == virt_ctlr::Kind::Combined)
+            name = "Combined Joy-Cons";
+        virt->set_stats(std::make_shared<ctlr_stats>(
+            true, name, macs.empty() ? 0 : macs[0]));
+    }
+    virt->get_stats()->set_player(slot + 1);
+    stats.add(virt->get_stats());
+    virt->set_recorder_player(slot + 1);
+
+    for (auto &phys : virt->get_phys_ctlrs()) {
+        flight_recorder::record(flight::kind::Player,
+                                phys->get_event_number(), 0, 1, slot + 1);
+        pairing_states.erase(phys->get_id());
+        phys->get_stats()->set_player(slot + 1);
+        paired_index[phys->get_id()] = slot;
+        if (phys->get_mac_addr())
+            mac_index[phys->get_mac_addr()] = slot;
+        unpaired_controllers.erase(phys->get_id());
+    }
+    paired_controllers[slot] = std::move(virt);
+    relay_latency[slot]->reset();
+    paired_controllers[slot]->set_latency_histogram(relay_latency[slot].get());
+    for (auto &phys : paired_controllers[slot]->get_phys_ctlrs())
+        sync_imu(phys->get_id());
+    save_session();
+}
+
+void ctlr_mgr::release_slot(size_t slot) {
+    flight_recorder::record(flight::kind::Player, 0xff, 0, 0, slot + 1);
+    if (paired_controllers[slot]) {
+        paired_controllers[slot]->set_latency_histogram(nullptr);
+        stats.remove(paired_controllers[slot]->get_stats());
+    }
+    paired_controllers[slot] = nullptr;
+    first_events[slot].paired_ns = 0;
+    slots.release(slot);
+    save_session();
+}
+
+void ctlr_mgr::attach_phys(size_t slot, std::shared_ptr<phys_ctlr> phys) {
+    phys->set_player_leds_to_player(slot + 1);
+    phys->get_stats()->set_player(slot + 1);
+    flight_recorder::record(flight::kind::Player, phys->get_event_number(), 0,
+                            1, slot + 1);
+    count_reconnect(slot);
+    paired_controllers[slot]->add_phys_ctlr(phys);
+    paired_index[phys->get_id()] = slot;
+    if (phys->get_mac_addr())
+        mac_index[phys->get_mac_addr()] = slot;
+    unpaired_controllers.erase(phys->get_id());
+    sync_imu(phys->get_id());
+    save_session();
+}
+
+void ctlr_mgr::count_reconnect(size_t slot) {
+    auto &virt = paired_controllers[slot];
+
+    if (virt && virt->get_stats())
+        virt->get_stats()->add(ctlr_stats::Reconnects);
+}
+
+void ctlr_mgr::record_handover(uint64_t latency_ns) {
+    ALOGI("Handover took %" PRIu64 " us", latency_ns / 1000);
+    handovers++;
+    handover_last_ns = latency_ns;
+    if (latency_ns > handover_max_ns)
+        handover_max_ns = latency_ns;
+}
 
+std::shared_ptr<phys_ctlr> ctlr_mgr::find_phys(const ctlr_id &id) const {
+    auto unpaired = unpaired_controllers.find(id);
+    if (unpaired != unpaired_controllers.end())
+        return unpaired->second;
+
+    auto paired = paired_index.find(id);
+    if (paired == paired_index.end() || !paired_controllers[paired->second])
+        return nullptr;
+    for (auto &phys : paired_controllers[paired->second]->get_phys_ctlrs())
+        if (phys->get_id() == id)
+            return phys;
+    return nullptr;
+}
+
+void ctlr_mgr::unsubscribe(const ctlr_id &id) {
+    auto sub = subscribers.find(id);
+    if (sub == subscribers.end())
+        return;
+
+    epoll_manager.remove_subscriber(sub->second);
+    subscribers.erase(sub);
+}
+
+void ctlr_mgr::add_passthrough_ctlr(std::shared_ptr<phys_ctlr> phys) {
     if (left == phys)
         left = nullptr;
     if (right == phys)
         right = nullptr;
 
-    bool found_slot = false;
-    for (unsigned int i = 0; i < paired_controllers.size(); i++) {
-        if (!paired_controllers[i]) {
-            found_slot = true;
-            phys->set_player_leds_to_player(i % 4 + 1);
-            paired_controllers[i] = std::move(passthrough);
-            break;
+    int slot = acquire_slot(phys->get_mac_addr());
+    if (slot < 0)
+        return;
+
+    std::unique_ptr<virt_ctlr_passthrough> passthrough(
+        new virt_ctlr_passthrough(phys));
+
+    insert_paired(slot, std::move(passthrough));
+    phys->set_player_leds_to_player(slot + 1);
+}
+
+void ctlr_mgr::add_combined_ctlr(std::shared_ptr<phys_ctlr> physl,
+                                 std::shared_ptr<phys_ctlr> physr) {
+    uint64_t start_ns = monotonic_ns();
+    int slot = acquire_slot(physl->get_mac_addr() ? physl->get_mac_addr()
+                                                  : physr->get_mac_addr());
+    if (slot < 0)
+        return;
+
+    std::unique_ptr<virt_ctlr_combined> combined(
+        new virt_ctlr_combined(physl, physr, epoll_manager, create, mMapping,
+                               mapLock));
+    virt_ctlr_combined *virt = combined.get();
+
+    ALOGI("Creating combined joy-con input");
+
+    insert_paired(slot, std::move(combined));
+    physl->set_player_leds_to_player(slot + 1);
+    physr->set_player_leds_to_player(slot + 1);
+    virt->set_player_leds_to_player(slot + 1);
+    record_pairing(slot, start_ns);
+}
+
+void ctlr_mgr::add_virt_procon_ctlr(std::shared_ptr<phys_ctlr> phys) {
+    uint64_t start_ns = monotonic_ns();
+    int slot = acquire_slot(phys->get_mac_addr());
+    if (slot < 0)
+        return;
+
+    std::unique_ptr<virt_ctlr_pro> procon(
+        new virt_ctlr_pro(phys, epoll_manager, create, mMapping, mapLock));
+    virt_ctlr_pro *virt = procon.get();
+
+    ALOGI("Creating virtual pro controller input");
+
+    insert_paired(slot, std::move(procon));
+    phys->set_player_leds_to_player(slot + 1);
+    virt->set_player_leds_to_player(slot + 1);
+    record_pairing(slot, start_ns);
+}
+
+void ctlr_mgr::record_pairing(size_t slot, uint64_t start_ns) {
+    pool.record_pairing(monotonic_ns() - start_ns, claimed_pooled);
+    first_events[slot] = {start_ns, claimed_pooled};
+}
+
+void ctlr_mgr::update_pool_targets() {
+    bool analog = mMapping->analog;
+    int pro = 0;
+    // joy-cons by side, then by whether they have SL/SR (are off the rails)
+    int joycons[2][2] = {};
+    std::vector<virt_caps> targets;
+
+    for (auto &entry : expected) {
+        if (entry.second.model == phys_ctlr::Model::Left_Joycon)
+            joycons[0][1]++;
+        else if (entry.second.model == phys_ctlr::Model::Right_Joycon)
+            joycons[1][1]++;
+        else
+            pro++;
+    }
+
+    // A joy-con waiting for its partner pairs the moment that shows up
+    for (auto &entry : pairing_states) {
+        auto unpaired = unpaired_controllers.find(entry.first);
+        if (entry.second != phys_ctlr::PairingState::Waiting ||
+            unpaired == unpaired_controllers.end())
+            continue;
+
+        auto &phys = unpaired->second;
+        if (phys->get_model() == phys_ctlr::Model::Left_Joycon)
+            joycons[0][!phys->is_serial_ctlr()]++;
+        else if (phys->get_model() == phys_ctlr::Model::Right_Joycon)
+            joycons[1][!phys->is_serial_ctlr()]++;
+    }
+
+    // Every virtual gamepad brings its own mouse along
+    for (int i = 0; i < pro; i++) {
+        targets.push_back(virt_caps::pro(analog, true));
+        targets.push_back(virt_caps::mouse());
+    }
+    for (int sl_sr = 0; sl_sr < 2 && mMapping->combined; sl_sr++) {
+        int pairs = std::max(joycons[0][sl_sr], joycons[1][sl_sr]);
+        for (int i = 0; i < pairs; i++) {
+            targets.push_back(virt_caps::combined(analog, sl_sr));
+            targets.push_back(virt_caps::mouse());
         }
     }
+    pool.set_targets(targets);
+}
+
+void ctlr_mgr::arm_expect_timer() {
+    struct itimerspec spec = {};
+    uint64_t next = 0;
 
-    if (!found_slot) {
-        phys->set_player_leds_to_player(paired_controllers.size() % 4 + 1);
-        paired_controllers.push_back(std::move(passthrough));
+    for (auto &entry : expected) {
+        if (!next || entry.second.expires_ns < next)
+            next = entry.second.expires_ns;
     }
 
-    unpaired_controllers.erase(phys->get_devpath());
+    // A zeroed it_value disarms the timer
+    spec.it_value.tv_sec = next / 1000000000ull;
+    spec.it_value.tv_nsec = next % 1000000000ull;
+    if (timerfd_settime(expect_timer_fd, TFD_TIMER_ABSTIME, &spec, NULL))
+        ALOGE("Failed to arm expected controller timer; %s", strerror(errno));
 }
 
-void ctlr_mgr::add_combined_ctlr() {
-    std::unique_ptr<virt_ctlr_combined> combined(
-        new virt_ctlr_combined(left, right, epoll_manager, mMapping, mapLock));
+void ctlr_mgr::expect_timer_callback(int event_fd) {
+    uint64_t expirations;
+    uint64_t now = monotonic_ns();
 
-    ALOGI("Creating combined joy-con input");
+    if (read(event_fd, &expirations, sizeof(expirations)) < 0 &&
+        errno != EAGAIN)
+        ALOGE("Failed to read expected controller timer; %s",
+              strerror(errno));
 
-    bool found_slot = false;
-    for (unsigned int i = 0; i < paired_controllers.size(); i++) {
-        if (!paired_controllers[i]) {
-            found_slot = true;
-            left->set_player_leds_to_player(i % 4 + 1);
-            right->set_player_leds_to_player(i % 4 + 1);
-            combined->set_player_leds_to_player(i % 4 + 1);
-            paired_controllers[i] = std::move(combined);
-            break;
+    for (auto it = expected.begin(); it != expected.end();) {
+        if (it->second.expires_ns > now) {
+            it++;
+            continue;
         }
+        ALOGI("%s never showed up; dropping its devices",
+              format_mac(it->first).c_str());
+        it = expected.erase(it);
     }
-    if (!found_slot) {
-        left->set_player_leds_to_player(paired_controllers.size() % 4 + 1);
-        right->set_player_leds_to_player(paired_controllers.size() % 4 + 1);
-        combined->set_player_leds_to_player(paired_controllers.size() % 4 + 1);
-        paired_controllers.push_back(std::move(combined));
+    arm_expect_timer();
+    update_pool_targets();
+}
+
+void ctlr_mgr::load_session() {
+    std::ifstream reader(FILE_SESSION);
+    std::stringstream contents;
+
+    if (!reader.is_open())
+        return;
+    contents << reader.rdbuf();
+    session_contents = contents.str();
+
+    for (auto &entry : parse_session(session_contents)) {
+        bool taken = false;
+
+        if (entry.slot < 0 || entry.slot >= slots.get_capacity())
+            continue;
+        for (uint64_t mac : entry.macs)
+            taken |= restore_index.count(mac) > 0;
+        if (taken)
+            continue;
+
+        for (uint64_t mac : entry.macs)
+            restore_index[mac] = restore_entries.size();
+        slots.hold(entry.slot, entry.macs[0]);
+        restore_entries.push_back(entry);
+        restore_pending.push_back(true);
     }
 
-    unpaired_controllers.erase(left->get_devpath());
-    unpaired_controllers.erase(right->get_devpath());
+    ALOGI("Restoring %zu controllers from the last session",
+          restore_entries.size());
 }
 
-void ctlr_mgr::add_virt_procon_ctlr(std::shared_ptr<phys_ctlr> phys) {
-    std::unique_ptr<virt_ctlr_pro> procon(
-        new virt_ctlr_pro(phys, epoll_manager, mMapping, mapLock));
+void ctlr_mgr::save_session() {
+    std::vector<session_entry> entries;
 
-    ALOGI("Creating virtual pro controller input");
+    for (size_t slot = 0; slot < paired_controllers.size(); slot++) {
+        auto &virt = paired_controllers[slot];
+        if (!virt || virt->get_macs().empty())
+            continue;
+
+        entries.push_back({virt->get_kind(), int(slot), virt->get_macs()});
+    }
+
+    // Don't forget whoever hasn't made it back yet
+    for (size_t i = 0; i < restore_entries.size(); i++) {
+        int slot = restore_entries[i].slot;
+        if (restore_pending[i] && !paired_controllers[slot])
+            entries.push_back(restore_entries[i]);
+    }
+
+    std::string contents = serialize_session(entries);
+    if (contents == session_contents)
+        return;
+
+    session_contents = contents;
+    session_file.write(contents);
+}
+
+void ctlr_mgr::restore_ctlr(std::shared_ptr<phys_ctlr> phys) {
+    uint64_t mac = phys->get_mac_addr();
+    auto pending = restore_index.find(mac);
+    if (pending == restore_index.end())
+        return;
+
+    const session_entry &entry = restore_entries[pending->second];
+    switch (entry.kind) {
+    case virt_ctlr::Kind::Passthrough:
+        ALOGI("Restoring lone controller");
+        add_passthrough_ctlr(phys);
+        break;
+    case virt_ctlr::Kind::Pro:
+        ALOGI("Restoring virtual procon");
+        add_virt_procon_ctlr(phys);
+        break;
+    case virt_ctlr::Kind::Combined: {
+        std::shared_ptr<phys_ctlr> partner = nullptr;
 
-    bool found_slot = false;
-    for (unsigned int i = 0; i < paired_controllers.size(); i++) {
-        if (!paired_controllers[i]) {
-            found_slot = true;
-            phys->set_player_leds_to_player(i % 4 + 1);
-            procon->set_player_leds_to_player(i % 4 + 1);
-            paired_controllers[i] = std::move(procon);
+        for (uint64_t other : entry.macs) {
+            auto waiting = restore_waiting.find(other);
+            if (other != mac && waiting != restore_waiting.end())
+                partner = waiting->second;
+        }
+
+        if (!partner) {
+            ALOGI("Restored joy-con waiting for its partner");
+            restore_waiting[mac] = phys;
             break;
         }
+
+        restore_waiting.erase(partner->get_mac_addr());
+        if (phys->get_model() == phys_ctlr::Model::Left_Joycon &&
+            partner->get_model() == phys_ctlr::Model::Right_Joycon) {
+            ALOGI("Restoring combined joy-cons");
+            add_combined_ctlr(phys, partner);
+        } else if (phys->get_model() == phys_ctlr::Model::Right_Joycon &&
+                   partner->get_model() == phys_ctlr::Model::Left_Joycon) {
+            ALOGI("Restoring combined joy-cons");
+            add_combined_ctlr(partner, phys);
+        }
+        break;
+    }
+    }
+}
+
+void ctlr_mgr::finish_restore(size_t index) {
+    if (!restore_pending[index])
+        return;
+
+    restore_pending[index] = false;
+    for (uint64_t mac : restore_entries[index].macs) {
+        restore_index.erase(mac);
+        restore_waiting.erase(mac);
+    }
+
+    restored++;
+    if (restored == restore_entries.size()) {
+        restore_done_ns = monotonic_ns() - created_ns;
+        ALOGI("Last session restored %" PRIu64 " ms after start",
+              restore_done_ns / 1000000);
+    }
+}
+
+void ctlr_mgr::sync_imu(const ctlr_id &id) {
+    auto node = imu_nodes.find(id);
+    auto paired = paired_index.find(id);
+    std::shared_ptr<phys_ctlr> phys = nullptr;
+    virt_ctlr *virt = nullptr;
+
+    if (node != imu_nodes.end() && paired != paired_index.end())
+        virt = paired_controllers[paired->second].get();
+    if (virt) {
+        for (auto &candidate : virt->get_phys_ctlrs()) {
+            if (candidate->get_id() == id)
+                phys = candidate;
+        }
     }
-    if (!found_slot) {
-        phys->set_player_leds_to_player(paired_controllers.size() % 4 + 1);
-        procon->set_player_leds_to_player(paired_controllers.size() % 4 + 1);
-        paired_controllers.push_back(std::move(procon));
+
+    // Passthrough controllers are still visible, and so is their IMU
+    if (!phys || virt->get_kind() == virt_ctlr::Kind::Passthrough) {
+        imus.erase(id);
+        return;
     }
+    if (imus.count(id))
+        return;
+
+    virt_caps::Host host = virt_caps::Host::Right_Joycon;
+    if (virt->get_kind() == virt_ctlr::Kind::Pro)
+        host = virt_caps::Host::Pro;
+    else if (phys->get_model() == phys_ctlr::Model::Left_Joycon)
+        host = virt_caps::Host::Left_Joycon;
+
+    std::unique_ptr<virt_imu> imu(new virt_imu(
+        epoll_manager, create, node->second,
+        virt_caps::imu(host, imu_fusion_enabled), imu_decimation));
+    if (!imu->is_valid())
+        return;
+
+    imu->set_listener([this, id](const imu_sample &sample) {
+        auto owner = paired_index.find(id);
+        if (owner != paired_index.end() && paired_controllers[owner->second])
+            paired_controllers[owner->second]->handle_motion(id, sample);
+    });
+    imus[id] = std::move(imu);
+}
+
+void ctlr_mgr::reconfigure_callback(int event_fd) {
+    uint64_t requests;
+    uint64_t ticket;
+    uint64_t start_ns = monotonic_ns();
+
+    if (read(event_fd, &requests, sizeof(requests)) < 0 && errno != EAGAIN)
+        ALOGE("Failed to read reconfigure eventfd; %s", strerror(errno));
+
+    // Everything requested up to here sees the mapping as it is now
+    pthread_mutex_lock(&reconfigure_lock);
+    ticket = reconfigure_requested;
+    pthread_mutex_unlock(&reconfigure_lock);
+
+    update_pool_targets();
+    for (auto &virt : paired_controllers) {
+        if (virt)
+            virt->reconfigure();
+    }
+
+    pthread_mutex_lock(&reconfigure_lock);
+    reconfigure_done = ticket;
+    pthread_cond_broadcast(&reconfigure_cond);
+    pthread_mutex_unlock(&reconfigure_lock);
+
+    ALOGI("Reconfigured controllers in %" PRIu64 " us",
+          (monotonic_ns() - start_ns) / 1000);
+}
+
+void ctlr_mgr::task_callback(int event_fd) {
+    std::deque<std::function<void()>> pending;
+    uint64_t count;
+
+    if (read(event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        ALOGE("Failed to read task eventfd; %s", strerror(errno));
+
+    pthread_mutex_lock(&task_lock);
+    pending.swap(tasks);
+    pthread_mutex_unlock(&task_lock);
+
+    for (auto &task : pending)
+        task();
+}
+
+void ctlr_mgr::post(std::function<void()> task) {
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&task_lock);
+    tasks.push_back(std::move(task));
+    pthread_mutex_unlock(&task_lock);
 
-    unpaired_controllers.erase(phys->get_devpath());
+    if (write(task_fd, &one, sizeof(one)) != sizeof(one))
+        ALOGE("Failed to signal task eventfd; %s", strerror(errno));
 }
 
 // public
 ctlr_mgr::ctlr_mgr(epoll_mgr &epoll_manager, struct mapping *mMapping,
-                   pthread_mutex_t *mapLock)
-    : epoll_manager(epoll_manager), unpaired_controllers(), subscribers(),
-      paired_controllers() {
+                   pthread_mutex_t *mapLock, virt_device_factory create)
+    : epoll_manager(epoll_manager),
+      pool(GetBoolProperty(PROP_UINPUT_POOL, DEFAULT_UINPUT_POOL), create),
+      create([this](const virt_caps &caps, struct virt_device *dev) {
+          if (!pool.claim(caps, dev))
+              return false;
+          if (caps.is_gamepad())
+              claimed_pooled = dev->pooled;
+          return true;
+      }),
+      claimed_pooled(false), handovers(0), handover_last_ns(0),
+      handover_max_ns(0), unpaired_controllers(), subscribers(),
+      slots(GetIntProperty(PROP_MAX_PLAYERS, DEFAULT_MAX_PLAYERS),
+            GetBoolProperty(PROP_STICKY_SLOTS, false)),
+      paired_controllers(),
+      stale_controllers(
+          epoll_manager,
+          GetIntProperty(PROP_STALE_CAPACITY, DEFAULT_STALE_CAPACITY, 0),
+          GetIntProperty(PROP_STALE_TTL, DEFAULT_STALE_TTL, 0)),
+      restored(0), created_ns(monotonic_ns()), restore_done_ns(0),
+      session_file(FILE_SESSION), reconfigure_requested(0),
+      reconfigure_done(0) {
     this->mMapping = mMapping;
     this->mapLock = mapLock;
+
+    PROFILE_INIT();
+    paired_controllers.resize(slots.get_capacity());
+    first_events.resize(slots.get_capacity());
+    for (int i = 0; i < slots.get_capacity(); i++)
+        relay_latency.emplace_back(new latency_histogram());
+    load_session();
+    rumble_interval_ms =
+        GetIntProperty(PROP_RUMBLE_INTERVAL, DEFAULT_RUMBLE_INTERVAL);
+    imu_decimation =
+        GetIntProperty(PROP_IMU_DECIMATION, DEFAULT_IMU_DECIMATION, 0);
+    imu_fusion_enabled = GetBoolProperty(PROP_IMU_FUSION, DEFAULT_IMU_FUSION);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&reconfigure_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&reconfigure_lock, NULL);
+
+    reconfigure_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reconfigure_fd < 0) {
+        ALOGE("Failed to create reconfigure eventfd; %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    reconfigure_subscriber = std::make_shared<epoll_subscriber>(
+        std::vector({reconfigure_fd}),
+        [=](int event_fd) { reconfigure_callback(event_fd); });
+    epoll_manager.add_subscriber(reconfigure_subscriber);
+
+    pthread_mutex_init(&task_lock, NULL);
+    task_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (task_fd < 0) {
+        ALOGE("Failed to create task eventfd; %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    task_subscriber = std::make_shared<epoll_subscriber>(
+        std::vector({task_fd}),
+        [=](int event_fd) { task_callback(event_fd); });
+    epoll_manager.add_subscriber(task_subscriber);
+
+    expect_timer_fd =
+        timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (expect_timer_fd < 0) {
+        ALOGE("Failed to create expected controller timer; %s",
+              strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    expect_timer_subscriber = std::make_shared<epoll_subscriber>(
+        std::vector({expect_timer_fd}),
+        [=](int event_fd) { expect_timer_callback(event_fd); });
+    epoll_manager.add_subscriber(expect_timer_subscriber);
 }
 
-ctlr_mgr::~ctlr_mgr() {}
+ctlr_mgr::~ctlr_mgr() {
+    // the controllers' fds close with them, after this
+    for (auto &sub : subscribers)
+        epoll_manager.remove_subscriber(sub.second);
+
+    epoll_manager.remove_subscriber(expect_timer_subscriber);
+    close(expect_timer_fd);
+
+    epoll_manager.remove_subscriber(task_subscriber);
+    close(task_fd);
+    pthread_mutex_destroy(&task_lock);
 
-void ctlr_mgr::add_ctlr(const std::string &devpath,
+    epoll_manager.remove_subscriber(reconfigure_subscriber);
+    close(reconfigure_fd);
+    pthread_cond_destroy(&reconfigure_cond);
+    pthread_mutex_destroy(&reconfigure_lock);
+}
+
+void ctlr_mgr::add_ctlr(const ctlr_id &id, const std::string &devpath,
                         const std::string &devname) {
+    add_ctlr(id, devpath, devname, std::make_unique<evdev_source>(devname));
+}
+
+void ctlr_mgr::add_ctlr(const ctlr_id &id, const std::string &devpath,
+                        const std::string &devname,
+                        std::unique_ptr<event_source> source) {
+    TRACE_SCOPE("ctlr_mgr::add_ctlr");
     std::shared_ptr<phys_ctlr> phys = nullptr;
+    uint64_t start_ns = monotonic_ns();
 
-    if (!unpaired_controllers.count(devpath)) {
+    if (!unpaired_controllers.count(id)) {
         ALOGI("Creating new phys_ctlr for %s", devname.c_str());
-        phys.reset(new phys_ctlr(devpath, devname));
-        unpaired_controllers[devpath] = phys;
-        phys->blink_player_leds();
-        subscribers[devpath] = std::make_shared<epoll_subscriber>(
+        phys.reset(new phys_ctlr(id, devpath, devname, std::move(source)));
+        unpaired_controllers[id] = phys;
+        subscribers[id] = std::make_shared<epoll_subscriber>(
             std::vector({phys->get_fd()}),
-            [=](int event_fd) { epoll_event_callback(event_fd); });
-        epoll_manager.add_subscriber(subscribers[devpath]);
+            [=](int event_fd) { epoll_event_callback(id, event_fd); });
+        epoll_manager.add_subscriber(subscribers[id]);
+        phys->set_rumble_queue(std::make_unique<rumble_queue>(
+            epoll_manager, phys->get_fd(), rumble_interval_ms,
+            phys->get_stats()));
+        phys_stats[id] = phys->get_stats();
+        stats.add(phys->get_stats());
     } else {
         ALOGE("Attempting to add existing phys_ctlr to controller manager");
         return;
     }
 
-    // See if this controller belongs to a "stale" controller
-    for (unsigned int i = 0; i < stale_controllers.size(); i++) {
-        auto &virt = stale_controllers[i];
-
-        if (!virt)
-            continue;
+    uint64_t mac = phys->get_mac_addr();
+    // Made it; whatever the pool got ready for it is claimed below
+    if (mac && expected.erase(mac))
+        arm_expect_timer();
+    flight_recorder::record(flight::kind::Hotplug, phys->get_event_number(),
+                            0, 1, int32_t(mac));
+    if (mac && mac_seen[mac]++)
+        phys->get_stats()->add(ctlr_stats::Reconnects, mac_seen[mac] - 1);
 
-        if (virt->mac_belongs(phys->get_mac_addr())) {
-            bool found_slot = false;
+    // See if this controller belongs to a "stale" controller
+    std::unique_ptr<virt_ctlr> stale =
+        mac ? stale_controllers.take(mac) : nullptr;
+    if (stale) {
+        int slot = acquire_slot(mac);
+        if (slot >= 0) {
             ALOGI("Re-pairing stale controller");
-            for (unsigned int i = 0; i < paired_controllers.size(); i++) {
-                if (!paired_controllers[i]) {
-                    found_slot = true;
-                    paired_controllers[i] = std::move(virt);
-                    break;
-                }
-            }
-            if (!found_slot)
-                paired_controllers.push_back(std::move(virt));
-            stale_controllers.erase(stale_controllers.begin() + i);
-            break;
+            insert_paired(slot, std::move(stale));
+            count_reconnect(slot);
+            mac_index[mac] = slot;
+            // the mapping may have changed while it sat in the cache
+            paired_controllers[slot]->reconfigure();
+        } else {
+            // Keep it for its next return rather than dropping its state
+            ALOGI("No free player slot; keeping stale controller cached");
+            stale_controllers.insert(std::move(stale));
         }
     }
 
     // Check if a controller with this MAC already exists in a combined
-    // controller
-    for (unsigned int i = 0; i < paired_controllers.size(); i++) {
-        auto &virt = paired_controllers[i];
-
-        if (!virt)
-            continue;
+    // controller, or was part of one before it disconnected
+    auto owner = mac ? mac_index.find(mac) : mac_index.end();
+    if (owner != mac_index.end()) {
+        size_t slot = owner->second;
+        auto &virt = paired_controllers[slot];
 
-        if (virt->supports_hotplug()) {
-            bool found;
+        if (!virt || !virt->mac_belongs(mac)) {
+            mac_index.erase(owner);
+        } else if (virt->supports_hotplug()) {
             for (auto phys2 : virt->get_phys_ctlrs()) {
-                if (phys->get_mac_addr() == phys2->get_mac_addr() &&
-                    phys->get_mac_addr() != "") {
-                    ALOGI(
-                        "Replacing controller (likely a BT to serial switch)");
-                    if (subscribers.count(phys2->get_devpath())) {
-                        epoll_manager.remove_subscriber(
-                            subscribers[phys2->get_devpath()]);
-                        subscribers.erase(phys2->get_devpath());
-                    }
+                if (phys2->get_mac_addr() != mac)
+                    continue;
+
+                ALOGI("Replacing controller (likely a BT to serial switch)");
+                unsubscribe(phys2->get_id());
+                paired_index.erase(phys2->get_id());
+                if (virt->handover_phys_ctlr(phys2, phys)) {
+                    paired_index[id] = slot;
+                    unpaired_controllers.erase(id);
+                    phys->get_stats()->set_player(slot + 1);
+                    count_reconnect(slot);
+                    sync_imu(id);
+                    record_handover(monotonic_ns() - start_ns);
+                } else {
                     virt->remove_phys_ctlr(phys2);
-                    phys->set_player_leds_to_player(i % 4 + 1);
-                    virt->add_phys_ctlr(phys);
-                    unpaired_controllers.erase(phys->get_devpath());
-                    found = true;
-                    break;
                 }
-            }
-            if (found)
                 break;
+            }
+
+            if (unpaired_controllers.count(id) &&
+                (virt->needs_model() == phys->get_model() ||
+                 virt->no_ctlrs_left())) {
+                ALOGI("Detected reconnected joy-con");
+                attach_phys(slot, phys);
+            }
         }
     }
 
-    // Now check if this is a reconnecting joy-con
-    for (unsigned int i = 0; i < paired_controllers.size(); i++) {
+    // Now check if this is a different joy-con filling a hole
+    for (size_t i = 0;
+         unpaired_controllers.count(id) && i < paired_controllers.size();
+         i++) {
         auto &virt = paired_controllers[i];
 
         if (!virt)
@@ -242,57 +798,276 @@ void ctlr_mgr::add_ctlr(const std::string &devpath,
              virt->no_ctlrs_left()) &&
             virt->supports_hotplug()) {
             ALOGI("Detected reconnected joy-con");
-            phys->set_player_leds_to_player(i % 4 + 1);
-            virt->add_phys_ctlr(phys);
-            unpaired_controllers.erase(phys->get_devpath());
+            attach_phys(i, phys);
         }
     }
+
+    // Rebuild what the last session had before asking anyone to pair again
+    if (unpaired_controllers.count(id) && restore_index.count(mac))
+        restore_ctlr(phys);
+
     // check if we're already ready to pair this contoller
-    if (unpaired_controllers.count(devpath))
-        epoll_event_callback(unpaired_controllers[devpath]->get_fd());
+    if (unpaired_controllers.count(id)) {
+        phys->blink_player_leds();
+        epoll_event_callback(id, phys->get_fd());
+    }
+    update_pool_targets();
 }
 
-void ctlr_mgr::remove_ctlr(const std::string &devpath) {
-    if (subscribers.count(devpath)) {
-        epoll_manager.remove_subscriber(subscribers[devpath]);
-        subscribers.erase(devpath);
+void ctlr_mgr::remove_ctlr(const ctlr_id &id) {
+    TRACE_SCOPE("ctlr_mgr::remove_ctlr");
+    unsubscribe(id);
+    imus.erase(id);
+    imu_nodes.erase(id);
+    pairing_states.erase(id);
+
+    auto phys_counters = phys_stats.find(id);
+    if (phys_counters != phys_stats.end()) {
+        std::shared_ptr<phys_ctlr> phys = find_phys(id);
+        flight_recorder::record(flight::kind::Hotplug,
+                                phys ? phys->get_event_number() : 0xff, 0, 0,
+                                0);
+        stats.remove(phys_counters->second);
+        phys_stats.erase(phys_counters);
     }
-    if (unpaired_controllers.count(devpath)) {
-        ALOGI("Removing %s from unpaired list", devpath.c_str());
-        auto phys = unpaired_controllers[devpath];
-        if (phys == left)
+
+    auto unpaired = unpaired_controllers.find(id);
+    if (unpaired != unpaired_controllers.end()) {
+        ALOGI("Removing %s from unpaired list",
+              unpaired->second->get_devpath().c_str());
+        if (unpaired->second == left)
             left = nullptr;
-        if (phys == right)
+        if (unpaired->second == right)
             right = nullptr;
-        unpaired_controllers.erase(devpath);
+        auto waiting = restore_waiting.find(unpaired->second->get_mac_addr());
+        if (waiting != restore_waiting.end() &&
+            waiting->second == unpaired->second)
+            restore_waiting.erase(waiting);
+        unpaired_controllers.erase(unpaired);
+        update_pool_targets();
     }
-    for (auto &ctlr : paired_controllers) {
-        if (!ctlr)
+
+    auto paired = paired_index.find(id);
+    if (paired == paired_index.end())
+        return;
+
+    size_t slot = paired->second;
+    auto &ctlr = paired_controllers[slot];
+    paired_index.erase(paired);
+    if (!ctlr)
+        return;
+
+    for (auto phys : ctlr->get_phys_ctlrs()) {
+        if (phys->get_id() != id)
             continue;
-        bool found = false;
-        for (auto phys : ctlr->get_phys_ctlrs()) {
-            if (phys->get_devpath() == devpath) {
-                bool serial = phys->is_serial_ctlr();
-
-                if (ctlr->supports_hotplug())
-                    ctlr->remove_phys_ctlr(phys);
-
-                if (ctlr->no_ctlrs_left()) {
-                    if (serial) {
-                        ALOGI("Both serial joy-cons disconnected; keep ctlr "
-                              "alive");
-                        stale_controllers.push_back(std::move(ctlr));
-                    } else {
-                        ALOGI("unpairing controller");
-                    }
-                    ctlr = nullptr;
-                }
 
-                found = true;
-                break;
+        bool serial = phys->is_serial_ctlr();
+
+        if (ctlr->supports_hotplug())
+            ctlr->remove_phys_ctlr(phys);
+
+        if (ctlr->no_ctlrs_left()) {
+            if (serial) {
+                ALOGI("Both serial joy-cons disconnected; keep ctlr alive");
+                ctlr->set_latency_histogram(nullptr);
+                stats.remove(ctlr->get_stats());
+                ctlr->get_stats()->set_player(0);
+                stale_controllers.insert(std::move(ctlr));
+            } else {
+                ALOGI("unpairing controller");
             }
+            release_slot(slot);
+
+            auto hint = mac_index.find(phys->get_mac_addr());
+            if (hint != mac_index.end() && hint->second == slot)
+                mac_index.erase(hint);
         }
-        if (found)
-            break;
+        break;
     }
 }
+
+void ctlr_mgr::add_imu(const ctlr_id &parent, const std::string &devname) {
+    if (!imu_decimation)
+        return;
+
+    ALOGI("Found IMU %s", devname.c_str());
+    imu_nodes[parent] = devname;
+    sync_imu(parent);
+}
+
+void ctlr_mgr::remove_imu(const ctlr_id &parent) {
+    imus.erase(parent);
+    imu_nodes.erase(parent);
+}
+
+void ctlr_mgr::expect_ctlr(uint64_t mac, phys_ctlr::Model model) {
+    post([=]() {
+        auto owner = mac_index.find(mac);
+
+        // Already here, or coming back to a controller that kept its device
+        if (!mac || stale_controllers.contains(mac) ||
+            (owner != mac_index.end() && paired_controllers[owner->second] &&
+             paired_controllers[owner->second]->mac_belongs(mac)))
+            return;
+        for (auto &unpaired : unpaired_controllers) {
+            if (unpaired.second->get_mac_addr() == mac)
+                return;
+        }
+
+        expected[mac] = {model, monotonic_ns() + EXPECT_TIMEOUT_NS};
+        arm_expect_timer();
+        update_pool_targets();
+    });
+}
+
+void ctlr_mgr::forget_ctlr(uint64_t mac) {
+    post([=]() {
+        if (!expected.erase(mac))
+            return;
+        arm_expect_timer();
+        update_pool_targets();
+    });
+}
+
+uint64_t ctlr_mgr::request_reconfigure() {
+    uint64_t one = 1;
+    uint64_t ticket;
+
+    pthread_mutex_lock(&reconfigure_lock);
+    ticket = ++reconfigure_requested;
+    pthread_mutex_unlock(&reconfigure_lock);
+
+    if (write(reconfigure_fd, &one, sizeof(one)) != sizeof(one))
+        ALOGE("Failed to signal reconfigure eventfd; %s", strerror(errno));
+    return ticket;
+}
+
+bool ctlr_mgr::wait_reconfigured(uint64_t ticket, int timeout_ms) {
+    struct timespec deadline;
+    uint64_t deadline_ns = monotonic_ns() + timeout_ms * 1000000ull;
+    int ret = 0;
+
+    deadline.tv_sec = deadline_ns / 1000000000ull;
+    deadline.tv_nsec = deadline_ns % 1000000000ull;
+
+    pthread_mutex_lock(&reconfigure_lock);
+    while (reconfigure_done < ticket && ret != ETIMEDOUT)
+        ret = pthread_cond_timedwait(&reconfigure_cond, &reconfigure_lock,
+                                     &deadline);
+    bool done = reconfigure_done >= ticket;
+    pthread_mutex_unlock(&reconfigure_lock);
+
+    return done;
+}
+
+void ctlr_mgr::play_rumble_pattern(int player, std::vector<rumble_step> steps,
+                                   int repeat) {
+    post([=]() {
+        int slot = player - 1;
+
+        if (slot < 0 || slot >= int(paired_controllers.size()) ||
+            !paired_controllers[slot]) {
+            ALOGE("No controller for player %d to play a pattern on", player);
+            return;
+        }
+        if (!paired_controllers[slot]->play_rumble_pattern(steps, repeat))
+            ALOGE("Player %d can't play rumble patterns", player);
+    });
+}
+
+bool ctlr_mgr::get_relay_latency(int player, uint64_t *count, uint64_t *p50,
+                                 uint64_t *p99, uint64_t *p999) const {
+    if (player < 1 || player > int(relay_latency.size()))
+        return false;
+
+    const latency_histogram &latency = *relay_latency[player - 1];
+    *count = latency.count();
+    *p50 = latency.percentile(0.5);
+    *p99 = latency.percentile(0.99);
+    *p999 = latency.percentile(0.999);
+    return true;
+}
+
+std::vector<ctlr_stats::snapshot> ctlr_mgr::get_stats() const {
+    std::vector<ctlr_stats::snapshot> snapshots;
+
+    for (auto &entry : stats.list())
+        snapshots.push_back(entry->read());
+    return snapshots;
+}
+
+void ctlr_mgr::dump(int fd) const {
+    struct stale_cache::stats stale = stale_controllers.get_stats();
+
+    dprintf(fd, "Stale controllers: %zu (%zu bytes resident)\n", stale.entries,
+            stale.resident_bytes);
+    dprintf(fd, "  reclaim hits: %" PRIu64 " misses: %" PRIu64 "\n",
+            stale.hits, stale.misses);
+    dprintf(fd, "  expired: %" PRIu64 " evicted: %" PRIu64 "\n", stale.expired,
+            stale.evicted);
+    dprintf(fd, "Handovers: %" PRIu64 " last: %" PRIu64 " us max: %" PRIu64
+            " us\n",
+            handovers.load(), handover_last_ns.load() / 1000,
+            handover_max_ns.load() / 1000);
+    pool.dump(fd);
+    epoll_manager.dump(fd);
+
+    for (auto &s : get_stats()) {
+        dprintf(fd, "%s %s (%s) player %d up %" PRIu64 " s\n",
+                s.is_virtual ? "virt" : "phys", s.name.c_str(),
+                format_mac(s.mac).c_str(), s.player, s.uptime_ns / 1000000000);
+        dprintf(fd, "  events read: %" PRIu64 " written: %" PRIu64
+                " fps: %.1f syn dropped: %" PRIu64 "\n",
+                s.counts[ctlr_stats::EventsRead],
+                s.counts[ctlr_stats::EventsWritten], s.frames_per_second,
+                s.counts[ctlr_stats::SynDropped]);
+        dprintf(fd, "  ff forwarded: %" PRIu64 " dropped: %" PRIu64
+                " led writes: %" PRIu64 " reconnects: %" PRIu64 "\n",
+                s.counts[ctlr_stats::FfForwarded],
+                s.counts[ctlr_stats::FfDropped],
+                s.counts[ctlr_stats::LedWrites],
+                s.counts[ctlr_stats::Reconnects]);
+    }
+
+    for (size_t slot = 0; slot < relay_latency.size(); slot++) {
+        uint64_t count, p50, p99, p999;
+
+        get_relay_latency(slot + 1, &count, &p50, &p99, &p999);
+        if (!count)
+            continue;
+        dprintf(fd, "Player %zu relay latency: p50 %" PRIu64 " us p99 %" PRIu64
+                " us p999 %" PRIu64 " us (%" PRIu64 " reports)\n",
+                slot + 1, p50 / 1000, p99 / 1000, p999 / 1000, count);
+    }
+
+    struct rumble_queue::stats rumble = rumble_queue::get_stats();
+    dprintf(fd, "Rumble commands sent: %" PRIu64 " superseded: %" PRIu64
+            " dropped: %" PRIu64 "\n",
+            rumble.sent, rumble.superseded, rumble.dropped);
+    dprintf(fd, "  latency avg: %" PRIu64 " us max: %" PRIu64 " us\n",
+            rumble.latency_avg_ns / 1000, rumble.latency_max_ns / 1000);
+    for (int sides = 1; sides <= ff_table::MAX_SIDES; sides++) {
+        uint64_t count, avg_ns, max_ns;
+
+        ff_table::get_upload_stats(sides, &count, &avg_ns, &max_ns);
+        dprintf(fd, "  ff uploads to %d side(s): %" PRIu64 " avg: %" PRIu64
+                " us max: %" PRIu64 " us\n",
+                sides, count, avg_ns / 1000, max_ns / 1000);
+    }
+    PROFILE_DUMP(fd);
+    dprintf(fd, "Flight recorder: %" PRIu64 " events (dump with --flight)\n",
+            flight_recorder::recorded());
+
+    uint64_t fused, fused_avg_ns;
+    imu_fusion::get_stats(&fused, &fused_avg_ns);
+    // a 200 Hz stream costs avg_ns * 200 per second of a core
+    dprintf(fd, "IMU samples fused: %" PRIu64 " avg: %" PRIu64
+            " ns (%.4f%% of a core per 200 Hz controller)\n",
+            fused, fused_avg_ns, fused_avg_ns * 200 / 1e7);
+    if (restore_done_ns)
+        dprintf(fd, "Last session restored %" PRIu64 " ms after start\n",
+                restore_done_ns.load() / 1000000);
+    else if (!restore_entries.empty())
+        dprintf(fd, "Last session: %zu of %zu controllers restored\n",
+                restored.load(), restore_entries.size());
+}
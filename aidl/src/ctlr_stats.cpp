@@ -0,0 +1,75 @@
+#include "ctlr_stats.h"
+#include "clock.h"
+
+#include <algorithm>
+
+std::atomic<int> ctlr_stats::next_slot(0);
+
+// public
+ctlr_stats::ctlr_stats(bool is_virtual, const std::string &name,
+                       uint64_t mac)
+    : is_virtual(is_virtual), name(name), mac(mac),
+      created_ns(monotonic_ns()), player(0), rate_frames(0),
+      rate_ns(created_ns), frames_per_second(0) {
+    for (auto &s : slots) {
+        for (auto &count : s.counts)
+            count.store(0, std::memory_order_relaxed);
+    }
+    pthread_mutex_init(&rate_lock, NULL);
+}
+
+ctlr_stats::~ctlr_stats() { pthread_mutex_destroy(&rate_lock); }
+
+struct ctlr_stats::snapshot ctlr_stats::read() {
+    struct snapshot snap = {};
+    uint64_t now_ns = monotonic_ns();
+
+    snap.is_virtual = is_virtual;
+    snap.name = name;
+    snap.mac = mac;
+    snap.player = player.load();
+    snap.uptime_ns = now_ns - created_ns;
+    for (auto &s : slots) {
+        for (int i = 0; i < COUNTERS; i++)
+            snap.counts[i] += s.counts[i].load(std::memory_order_relaxed);
+    }
+
+    // Reads closer together than this keep the last rate rather than
+    // measure a handful of frames
+    pthread_mutex_lock(&rate_lock);
+    if (now_ns - rate_ns >= 1000000000ull) {
+        frames_per_second = (snap.counts[Frames] - rate_frames) * 1e9f /
+                            (now_ns - rate_ns);
+        rate_frames = snap.counts[Frames];
+        rate_ns = now_ns;
+    }
+    snap.frames_per_second = frames_per_second;
+    pthread_mutex_unlock(&rate_lock);
+
+    return snap;
+}
+
+stats_registry::stats_registry() { pthread_mutex_init(&lock, NULL); }
+
+stats_registry::~stats_registry() { pthread_mutex_destroy(&lock); }
+
+void stats_registry::add(const std::shared_ptr<ctlr_stats> &stats) {
+    pthread_mutex_lock(&lock);
+    if (std::find(entries.begin(), entries.end(), stats) == entries.end())
+        entries.push_back(stats);
+    pthread_mutex_unlock(&lock);
+}
+
+void stats_registry::remove(const std::shared_ptr<ctlr_stats> &stats) {
+    pthread_mutex_lock(&lock);
+    entries.erase(std::remove(entries.begin(), entries.end(), stats),
+                  entries.end());
+    pthread_mutex_unlock(&lock);
+}
+
+std::vector<std::shared_ptr<ctlr_stats>> stats_registry::list() const {
+    pthread_mutex_lock(&lock);
+    std::vector<std::shared_ptr<ctlr_stats>> copy = entries;
+    pthread_mutex_unlock(&lock);
+    return copy;
+}
@@ -1,16 +1,51 @@
 #include "epoll_mgr.h"
 
 #include <android-base/logging.h>
+#include <cinttypes>
+#include <cstdio>
 #include <iostream>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <unistd.h>
 #include <utils/Log.h>
 
+#include "clock.h"
+
 //private
+bool epoll_mgr::set_events(int fd, uint32_t events)
+{
+    struct epoll_event event = {0};
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event)) {
+        ALOGE("Failed to modify epoll events; errno=%d", errno);
+        return false;
+    }
+    return true;
+}
+
+void epoll_mgr::dispatch(const struct epoll_event &event)
+{
+    int e_fd = event.data.fd;
+
+    if ((event.events & EPOLLOUT) && writers.count(e_fd)) {
+        // the writer may unwatch itself
+        std::function<void(int)> writer = writers[e_fd];
+        writer(e_fd);
+    }
+    if (!(event.events & ~EPOLLOUT))
+        return;
+
+    if (subscribers.count(e_fd))
+        (*subscribers[e_fd])(e_fd);
+    else
+        ALOGE("fd not found in subscribers map");
+}
 
 //public
 epoll_mgr::epoll_mgr()
+    : handler_max_ns(0), busy_since_ns(0), busy_fd(-1), stalls(0)
 {
     epoll_fd = epoll_create1(0);
     if (epoll_fd < 0) {
@@ -68,7 +103,30 @@ void epoll_mgr::remove_subscriber(std::shared_ptr<epoll_subscriber> sub)
             exit(EXIT_FAILURE);
         }
         subscribers.erase(fd);
+        writers.erase(fd);
+    }
+}
+
+bool epoll_mgr::watch_writable(int fd, std::function<void(int)> callback)
+{
+    if (!subscribers.count(fd)) {
+        ALOGE("Can't watch unsubscribed fd %d for writes", fd);
+        return false;
     }
+
+    if (!writers.count(fd) && !set_events(fd, EPOLLIN | EPOLLOUT))
+        return false;
+    writers[fd] = callback;
+    return true;
+}
+
+void epoll_mgr::unwatch_writable(int fd)
+{
+    if (!writers.count(fd))
+        return;
+
+    set_events(fd, EPOLLIN);
+    writers.erase(fd);
 }
 
 static const int MAX_EVENTS = 10;
@@ -84,12 +142,47 @@ void epoll_mgr::loop()
         return;
     }
 
+    uint64_t woke_ns = monotonic_ns();
     for (int i = 0; i < nfds; i++) {
-        int e_fd = events[i].data.fd;
-        if (subscribers.count(e_fd))
-            (*subscribers[e_fd])(e_fd);
-        else
-            ALOGE("fd not found in subscribers map");
+        uint64_t start_ns = monotonic_ns();
+
+        lag.record(start_ns - woke_ns);
+        busy_fd.store(events[i].data.fd, std::memory_order_relaxed);
+        busy_since_ns.store(start_ns, std::memory_order_release);
+
+        dispatch(events[i]);
+
+        uint64_t took_ns = monotonic_ns() - start_ns;
+        handler_time.record(took_ns);
+        if (took_ns > handler_max_ns.load(std::memory_order_relaxed))
+            handler_max_ns.store(took_ns, std::memory_order_relaxed);
     }
+    busy_since_ns.store(0, std::memory_order_release);
+}
+
+std::vector<uint64_t> epoll_mgr::get_loop_lag() const
+{
+    return {handler_time.count(),
+            lag.percentile(0.5),
+            lag.percentile(0.99),
+            lag.percentile(0.999),
+            handler_time.percentile(0.5),
+            handler_time.percentile(0.99),
+            handler_time.percentile(0.999),
+            handler_max_ns.load(),
+            stalls.load()};
+}
+
+void epoll_mgr::dump(int fd) const
+{
+    std::vector<uint64_t> l = get_loop_lag();
+
+    dprintf(fd, "Poll loop: %" PRIu64 " handlers stalls: %" PRIu64 "\n", l[0],
+            l[8]);
+    dprintf(fd, "  lag p50: %" PRIu64 " p99: %" PRIu64 " p999: %" PRIu64
+            " us\n", l[1] / 1000, l[2] / 1000, l[3] / 1000);
+    dprintf(fd, "  handler p50: %" PRIu64 " p99: %" PRIu64 " p999: %" PRIu64
+            " max: %" PRIu64 " us\n", l[4] / 1000, l[5] / 1000, l[6] / 1000,
+            l[7] / 1000);
 }
 
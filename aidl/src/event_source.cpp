@@ -0,0 +1,32 @@
+#include "event_source.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+// public
+evdev_source::evdev_source(const std::string &devname) : evdev(nullptr) {
+    int fd = open(devname.c_str(), O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        ALOGE("Failed to open %s; errno=%d", devname.c_str(), errno);
+        return;
+    }
+    if (libevdev_new_from_fd(fd, &evdev)) {
+        ALOGE("Failed to create evdev from fd");
+        evdev = nullptr;
+        close(fd);
+        return;
+    }
+    // Event times are compared against monotonic_ns() to measure latency
+    if (libevdev_set_clock_id(evdev, CLOCK_MONOTONIC))
+        ALOGE("Failed to switch evdev to CLOCK_MONOTONIC");
+}
+
+evdev_source::~evdev_source() {
+    if (evdev) {
+        int fd = libevdev_get_fd(evdev);
+        libevdev_free(evdev);
+        close(fd);
+    }
+}
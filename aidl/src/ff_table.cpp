@@ -0,0 +1,319 @@
+#include "ff_table.h"
+#include "clock.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+std::atomic<uint64_t> ff_table::upload_count[MAX_SIDES];
+std::atomic<uint64_t> ff_table::upload_total_ns[MAX_SIDES];
+std::atomic<uint64_t> ff_table::upload_max_ns[MAX_SIDES];
+
+// private
+int ff_table::upload_to(int s, int id) {
+    struct ff_effect effect = entries[id].effect;
+
+    effect.id = entries[id].phys_id[s];
+    if (effect.id < 0 && !make_room(s, id))
+        return ENOSPC;
+
+    if (ioctl(sides[s].fd, EVIOCSFF, &effect) == -1)
+        return errno;
+
+    if (entries[id].phys_id[s] < 0)
+        sides[s].mapped++;
+    entries[id].phys_id[s] = effect.id;
+    return 0;
+}
+
+void ff_table::unmap(int s, int id) {
+    int16_t phys_id = entries[id].phys_id[s];
+
+    if (phys_id < 0)
+        return;
+
+    if (sides[s].queue)
+        sides[s].queue->cancel(phys_id);
+    if (sides[s].fd >= 0 && ioctl(sides[s].fd, EVIOCRMFF, phys_id) == -1)
+        ALOGE("Failed to erase ff_effect %d: %s", phys_id, strerror(errno));
+    entries[id].phys_id[s] = -1;
+    sides[s].mapped--;
+}
+
+int ff_table::on_sides(const int *targets, int n,
+                       const std::function<int(int)> &op) {
+    int errs[MAX_SIDES] = {};
+    bool split = n > 1 && worker;
+
+    // Each side only touches its own slots and device, so the other side
+    // can go to the worker while this thread does the first
+    if (split)
+        worker->run([&]() {
+            for (int i = 1; i < n; i++)
+                errs[i] = op(targets[i]);
+        });
+    for (int i = 0; i < (split ? 1 : n); i++)
+        errs[i] = op(targets[i]);
+    if (split)
+        worker->wait();
+
+    for (int i = 0; i < n; i++) {
+        if (errs[i])
+            return errs[i];
+    }
+    return 0;
+}
+
+void ff_table::play_id(int id, int value) {
+    struct input_event ev = {};
+
+    ev.type = EV_FF;
+    ev.value = value;
+    entries[id].last_play = ++tick;
+
+    for (int s = 0; s < num_sides; s++) {
+        if (sides[s].fd < 0)
+            continue;
+
+        if (entries[id].phys_id[s] < 0) {
+            // Stopping an effect that isn't on the device is a no-op
+            if (!value)
+                continue;
+
+            int err = upload_to(s, id);
+            if (err) {
+                ALOGE("Failed to reupload ff_effect: %s", strerror(err));
+                continue;
+            }
+        }
+        ev.code = entries[id].phys_id[s];
+        send(s, ev);
+    }
+}
+
+void ff_table::send(int s, const struct input_event &ev) {
+    if (sides[s].queue) {
+        sides[s].queue->push(ev.code, ev.value);
+        return;
+    }
+
+    if (write(sides[s].fd, &ev, sizeof(ev)) != sizeof(ev))
+        ALOGE("Failed to forward EV_FF to phys");
+}
+
+bool ff_table::make_room(int s, int keep) {
+    int victim = -1;
+
+    if (sides[s].mapped < sides[s].capacity)
+        return true;
+
+    for (int id = 0; id < TABLE_SIZE; id++) {
+        if (id == keep || entries[id].phys_id[s] < 0)
+            continue;
+        if (victim < 0 || entries[id].last_play < entries[victim].last_play)
+            victim = id;
+    }
+    if (victim < 0)
+        return false;
+
+    unmap(s, victim);
+    return true;
+}
+
+// public
+ff_table::ff_table(int num_sides)
+    : entries(), sides(), num_sides(num_sides), count(0), tick(0),
+      worker(num_sides > 1 ? new ff_worker() : nullptr) {
+    for (int id = 0; id < TABLE_SIZE; id++) {
+        for (int s = 0; s < MAX_SIDES; s++)
+            entries[id].phys_id[s] = -1;
+    }
+    for (int s = 0; s < MAX_SIDES; s++) {
+        sides[s].fd = -1;
+        sides[s].queue = nullptr;
+    }
+}
+
+void ff_table::attach(int s, int fd, rumble_queue *queue) {
+    int capacity = 0;
+
+    detach(s);
+    if (ioctl(fd, EVIOCGEFFECTS, &capacity) == -1 || capacity <= 0)
+        capacity = MAX_EFFECTS;
+
+    sides[s].fd = fd;
+    sides[s].queue = queue;
+    sides[s].capacity = capacity;
+
+    // Most recently played first, so those are the ones that fit
+    for (int uploaded = 0; uploaded < capacity; uploaded++) {
+        int next = -1;
+
+        for (int id = 0; id < TABLE_SIZE; id++) {
+            if (!entries[id].used || entries[id].phys_id[s] >= 0)
+                continue;
+            if (next < 0 || entries[id].last_play > entries[next].last_play)
+                next = id;
+        }
+        if (next < 0)
+            break;
+
+        int ret = upload_to(s, next);
+        if (ret) {
+            ALOGE("Failed to reupload ff_effect: %s", strerror(ret));
+            break;
+        }
+    }
+}
+
+void ff_table::detach(int s) {
+    // The slots went away with the device; nothing to erase
+    sides[s].fd = -1;
+    sides[s].queue = nullptr;
+    for (int id = 0; id < TABLE_SIZE; id++)
+        entries[id].phys_id[s] = -1;
+    sides[s].mapped = 0;
+}
+
+int ff_table::upload(const struct ff_effect &effect) {
+    int ret = 0;
+
+    if (effect.id < 0 || effect.id >= MAX_EFFECTS) {
+        ALOGE("ff_effect id=%d out of range", effect.id);
+        return EINVAL;
+    }
+
+    entry &e = entries[effect.id];
+    entry old = e;
+    if (!e.used)
+        count++;
+    e.used = true;
+    e.effect = effect;
+    e.last_play = tick;
+
+    int targets[MAX_SIDES];
+    int n = 0;
+    for (int s = 0; s < num_sides; s++) {
+        if (sides[s].fd < 0)
+            continue;
+        // Don't evict anything for an effect that might never be played
+        if (e.phys_id[s] < 0 && sides[s].mapped >= sides[s].capacity)
+            continue;
+        targets[n++] = s;
+    }
+    if (!n)
+        return 0;
+
+    std::atomic<int> failed(0);
+    uint64_t start_ns = monotonic_ns();
+    ret = on_sides(targets, n, [&](int s) {
+        int err = upload_to(s, effect.id);
+        if (err)
+            failed++;
+        return err;
+    });
+    uint64_t rtt = monotonic_ns() - start_ns;
+
+    // Nothing took it, so the devices still have whatever was there before
+    if (failed == n) {
+        if (!old.used)
+            count--;
+        e = old;
+    }
+
+    upload_count[n - 1]++;
+    upload_total_ns[n - 1] += rtt;
+    if (rtt > upload_max_ns[n - 1])
+        upload_max_ns[n - 1] = rtt;
+    return ret;
+}
+
+int ff_table::erase(int id) {
+    if (id < 0 || id >= MAX_EFFECTS || !entries[id].used) {
+        ALOGE("WARNING: effect_id %d not in effect table", id);
+        return 0;
+    }
+
+    int targets[MAX_SIDES];
+    int n = 0;
+    for (int s = 0; s < num_sides; s++) {
+        if (entries[id].phys_id[s] >= 0)
+            targets[n++] = s;
+    }
+
+    on_sides(targets, n, [&](int s) {
+        unmap(s, id);
+        return 0;
+    });
+    entries[id].used = false;
+    count--;
+    return 0;
+}
+
+void ff_table::play(const struct input_event &ev) {
+    if (ev.code < MAX_EFFECTS) {
+        if (!entries[ev.code].used) {
+            ALOGE("ff_effect with id=%hu is not in table", ev.code);
+            return;
+        }
+        play_id(ev.code, ev.value);
+        return;
+    } else if (ev.code < FF_GAIN) {
+        ALOGE("ff_effect with id=%hu is out of range", ev.code);
+        return;
+    }
+
+    for (int s = 0; s < num_sides; s++) {
+        if (sides[s].fd >= 0)
+            send(s, ev);
+    }
+}
+
+void ff_table::set_rumble(uint16_t magnitude) {
+    entry &e = entries[PATTERN_ID];
+    int targets[MAX_SIDES];
+    int n = 0;
+
+    if (!magnitude) {
+        if (e.used)
+            play_id(PATTERN_ID, 0);
+        return;
+    }
+
+    e.used = true;
+    e.effect = {};
+    e.effect.type = FF_RUMBLE;
+    e.effect.id = PATTERN_ID;
+    e.effect.u.rumble.strong_magnitude = magnitude;
+    e.effect.u.rumble.weak_magnitude = magnitude;
+    // a zero length plays until stopped
+
+    // Sides that already have it get the new magnitude in place; the rest
+    // get it uploaded by play_id()
+    for (int s = 0; s < num_sides; s++) {
+        if (sides[s].fd >= 0 && e.phys_id[s] >= 0)
+            targets[n++] = s;
+    }
+    int err =
+        on_sides(targets, n, [&](int s) { return upload_to(s, PATTERN_ID); });
+    if (err)
+        ALOGE("Failed to update rumble pattern effect: %s", strerror(err));
+
+    play_id(PATTERN_ID, 1);
+}
+
+void ff_table::erase_all() {
+    for (int id = 0; id < MAX_EFFECTS; id++) {
+        if (entries[id].used)
+            erase(id);
+    }
+}
+
+void ff_table::get_upload_stats(int sides, uint64_t *count, uint64_t *avg_ns,
+                                uint64_t *max_ns) {
+    *count = upload_count[sides - 1].load();
+    *avg_ns = *count ? upload_total_ns[sides - 1].load() / *count : 0;
+    *max_ns = upload_max_ns[sides - 1].load();
+}
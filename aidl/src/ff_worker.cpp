@@ -0,0 +1,76 @@
+#include "ff_worker.h"
+
+#include <utils/Log.h>
+
+// private
+void *ff_worker::__workerLoop(void *args) {
+    ff_worker *const self = static_cast<ff_worker *>(args);
+
+    pthread_mutex_lock(&self->lock);
+    while (!self->stopping) {
+        if (!self->busy) {
+            pthread_cond_wait(&self->cond, &self->lock);
+            continue;
+        }
+
+        std::function<void()> job = std::move(self->job);
+        pthread_mutex_unlock(&self->lock);
+        job();
+        pthread_mutex_lock(&self->lock);
+
+        self->busy = false;
+        pthread_cond_broadcast(&self->cond);
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    return NULL;
+}
+
+// public
+ff_worker::ff_worker() : busy(false), stopping(false), running(false) {
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&cond, NULL);
+
+    if (pthread_create(&workerThread, NULL, __workerLoop, this)) {
+        ALOGE("pthread_create failed!");
+        return;
+    }
+    running = true;
+
+    pthread_setname_np(workerThread, "joycond_ff_worker");
+}
+
+ff_worker::~ff_worker() {
+    if (running) {
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&lock);
+        pthread_join(workerThread, NULL);
+    }
+
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&lock);
+}
+
+void ff_worker::run(std::function<void()> job) {
+    if (!running) {
+        job();
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    while (busy)
+        pthread_cond_wait(&cond, &lock);
+    this->job = std::move(job);
+    busy = true;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+void ff_worker::wait() {
+    pthread_mutex_lock(&lock);
+    while (busy)
+        pthread_cond_wait(&cond, &lock);
+    pthread_mutex_unlock(&lock);
+}
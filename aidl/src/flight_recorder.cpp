@@ -0,0 +1,62 @@
+#include "flight_recorder.h"
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+
+flight_recorder::slot flight_recorder::ring[CAPACITY];
+std::atomic<uint64_t> flight_recorder::head(0);
+
+static bool write_all(int fd, const void *buf, size_t len) {
+    const char *p = static_cast<const char *>(buf);
+
+    while (len) {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// public
+bool flight_recorder::write(int fd) {
+    std::vector<flight::record> records;
+    struct flight::header hdr = {};
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t start = end > CAPACITY ? end - CAPACITY : 0;
+
+    records.reserve(end - start);
+    for (uint64_t i = start; i < end; i++) {
+        slot &s = ring[i & (CAPACITY - 1)];
+        uint64_t stamp = s.stamp.load(std::memory_order_acquire);
+        uint64_t payload = s.payload.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        // Skip records that are mid-write or were overwritten while read
+        if (!stamp || stamp != s.stamp.load(std::memory_order_relaxed))
+            continue;
+
+        flight::record r;
+        r.stamp = stamp;
+        r.source = payload & 0xff;
+        r.type = (payload >> 8) & 0xff;
+        r.code = (payload >> 16) & 0xffff;
+        r.value = int32_t(payload >> 32);
+        records.push_back(r);
+    }
+
+    memcpy(hdr.magic, "JCFR", sizeof(hdr.magic));
+    hdr.version = flight::VERSION;
+    hdr.record_size = sizeof(flight::record);
+    hdr.count = records.size();
+    hdr.dump_ns = monotonic_ns();
+
+    return write_all(fd, &hdr, sizeof(hdr)) &&
+           write_all(fd, records.data(),
+                     records.size() * sizeof(flight::record));
+}
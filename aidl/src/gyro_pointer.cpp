@@ -0,0 +1,69 @@
+#include "gyro_pointer.h"
+
+#include <cmath>
+
+// private
+void gyro_pointer::calibrate(const imu_sample &sample) {
+    const float *gyro = sample.gyro;
+    const float *accel = sample.accel;
+    float g = std::sqrt(accel[0] * accel[0] + accel[1] * accel[1] +
+                        accel[2] * accel[2]);
+    bool resting = std::fabs(g - 1.0f) < REST_ACCEL_G;
+
+    for (int i = 0; i < 3; i++) {
+        if (std::fabs(gyro[i]) > REST_RATE_DPS)
+            resting = false;
+    }
+    if (!resting) {
+        rest_count = 0;
+        rest_sum[0] = rest_sum[1] = rest_sum[2] = 0;
+        return;
+    }
+
+    for (int i = 0; i < 3; i++)
+        rest_sum[i] += gyro[i];
+    rest_count++;
+
+    if (rest_count < REST_SAMPLES)
+        return;
+
+    // Slide the window by keeping half of it, so slow drift is followed
+    for (int i = 0; i < 3; i++) {
+        bias[i] = rest_sum[i] / rest_count;
+        rest_sum[i] = bias[i] * (REST_SAMPLES / 2);
+    }
+    rest_count = REST_SAMPLES / 2;
+}
+
+// public
+gyro_pointer::gyro_pointer(float sense_x, float sense_y)
+    : sense_x(sense_x), sense_y(sense_y), bias(), rest_sum(), rest_count(0),
+      last_us(0), have_last(false), remainder_x(0), remainder_y(0) {}
+
+void gyro_pointer::reset() {
+    have_last = false;
+    remainder_x = 0;
+    remainder_y = 0;
+}
+
+bool gyro_pointer::update(const imu_sample &sample, int *dx, int *dy) {
+    calibrate(sample);
+
+    uint64_t dt_us = have_last ? sample.timestamp_us - last_us : 0;
+    last_us = sample.timestamp_us;
+    have_last = true;
+    if (dt_us > MAX_DT_US)
+        return false;
+
+    // Yaw (around the vertical axis) moves the pointer sideways, pitch moves
+    // it up and down; both turn the opposite way to the pointer axes
+    float dt = dt_us / 1000000.0f;
+    remainder_x -= (sample.gyro[2] - bias[2]) * dt * sense_x;
+    remainder_y -= (sample.gyro[1] - bias[1]) * dt * sense_y;
+
+    *dx = int(remainder_x);
+    *dy = int(remainder_y);
+    remainder_x -= *dx;
+    remainder_y -= *dy;
+    return *dx || *dy;
+}
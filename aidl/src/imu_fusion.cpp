@@ -0,0 +1,140 @@
+#include "imu_fusion.h"
+#include "clock.h"
+
+#include <cmath>
+
+std::atomic<uint64_t> imu_fusion::fused_samples(0);
+std::atomic<uint64_t> imu_fusion::fused_ns(0);
+
+static inline float inv_sqrt(float x) { return 1.0f / std::sqrt(x); }
+
+// private
+void imu_fusion::step(float gx, float gy, float gz, float ax, float ay,
+                      float az, float dt) {
+    float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+
+    // Rate of change of the quaternion from the gyro
+    float dq0 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+    float dq1 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+    float dq2 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+    float dq3 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+    // Accel was normalized in the batch pass; zero means free fall or no
+    // data, so there's no gravity to correct against
+    if (ax != 0.0f || ay != 0.0f || az != 0.0f) {
+        float _2q0 = 2.0f * q0, _2q1 = 2.0f * q1;
+        float _2q2 = 2.0f * q2, _2q3 = 2.0f * q3;
+        float _4q0 = 4.0f * q0, _4q1 = 4.0f * q1, _4q2 = 4.0f * q2;
+        float _8q1 = 8.0f * q1, _8q2 = 8.0f * q2;
+        float q0q0 = q0 * q0, q1q1 = q1 * q1;
+        float q2q2 = q2 * q2, q3q3 = q3 * q3;
+
+        // Gradient of the error between measured and estimated gravity
+        float s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+        float s1 = _4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * q1 - _2q0 * ay -
+                   _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+        float s2 = 4.0f * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay -
+                   _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+        float s3 = 4.0f * q1q1 * q3 - _2q1 * ax + 4.0f * q2q2 * q3 - _2q2 * ay;
+        float norm = s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3;
+
+        if (norm > 0.0f) {
+            float scale = BETA * inv_sqrt(norm);
+            dq0 -= scale * s0;
+            dq1 -= scale * s1;
+            dq2 -= scale * s2;
+            dq3 -= scale * s3;
+        }
+    }
+
+    q0 += dq0 * dt;
+    q1 += dq1 * dt;
+    q2 += dq2 * dt;
+    q3 += dq3 * dt;
+
+    float scale = inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+    q[0] = q0 * scale;
+    q[1] = q1 * scale;
+    q[2] = q2 * scale;
+    q[3] = q3 * scale;
+}
+
+// public
+imu_fusion::imu_fusion()
+    : batch(), q{1, 0, 0, 0}, last_us(0), have_last(false) {}
+
+void imu_fusion::add(const imu_sample &sample) {
+    uint64_t dt_us = have_last ? sample.timestamp_us - last_us : 0;
+    int i = batch.count;
+
+    last_us = sample.timestamp_us;
+    have_last = true;
+
+    batch.ax[i] = sample.accel[0];
+    batch.ay[i] = sample.accel[1];
+    batch.az[i] = sample.accel[2];
+    batch.gx[i] = sample.gyro[0];
+    batch.gy[i] = sample.gyro[1];
+    batch.gz[i] = sample.gyro[2];
+    // a stalled stream shouldn't integrate the gap
+    batch.dt[i] = dt_us > MAX_DT_US ? 0.0f : dt_us / 1000000.0f;
+
+    if (++batch.count == imu_batch::SIZE)
+        flush();
+}
+
+void imu_fusion::flush() {
+    const float rad = float(M_PI) / 180.0f;
+    int count = batch.count;
+
+    if (!count)
+        return;
+
+    uint64_t start_ns = monotonic_ns();
+
+    // Run the batch through the whole-array passes at full SIZE; the lanes
+    // past count are ignored
+    for (int i = 0; i < imu_batch::SIZE; i++) {
+        batch.gx[i] *= rad;
+        batch.gy[i] *= rad;
+        batch.gz[i] *= rad;
+    }
+    for (int i = 0; i < imu_batch::SIZE; i++) {
+        float norm = batch.ax[i] * batch.ax[i] + batch.ay[i] * batch.ay[i] +
+                     batch.az[i] * batch.az[i];
+        float scale = norm > 0.0f ? inv_sqrt(norm) : 0.0f;
+        batch.ax[i] *= scale;
+        batch.ay[i] *= scale;
+        batch.az[i] *= scale;
+    }
+
+    for (int i = 0; i < count; i++)
+        step(batch.gx[i], batch.gy[i], batch.gz[i], batch.ax[i], batch.ay[i],
+             batch.az[i], batch.dt[i]);
+    batch.count = 0;
+
+    fused_ns += monotonic_ns() - start_ns;
+    fused_samples += count;
+}
+
+void imu_fusion::get_euler(float euler[3]) const {
+    const float deg = 180.0f / float(M_PI);
+    float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    float sin_pitch = 2.0f * (q0 * q2 - q3 * q1);
+
+    if (sin_pitch > 1.0f)
+        sin_pitch = 1.0f;
+    else if (sin_pitch < -1.0f)
+        sin_pitch = -1.0f;
+
+    euler[0] = deg * std::atan2(2.0f * (q0 * q1 + q2 * q3),
+                                1.0f - 2.0f * (q1 * q1 + q2 * q2));
+    euler[1] = deg * std::asin(sin_pitch);
+    euler[2] = deg * std::atan2(2.0f * (q0 * q3 + q1 * q2),
+                                1.0f - 2.0f * (q2 * q2 + q3 * q3));
+}
+
+void imu_fusion::get_stats(uint64_t *samples, uint64_t *avg_ns) {
+    *samples = fused_samples.load();
+    *avg_ns = *samples ? fused_ns.load() / *samples : 0;
+}
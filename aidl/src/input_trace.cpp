@@ -0,0 +1,146 @@
+#include "input_trace.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <libevdev/libevdev.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+#include "clock.h"
+
+using namespace input_trace;
+
+static void fill_bits(struct libevdev *evdev, unsigned int type, uint8_t *bits,
+                      int count) {
+    for (int code = 0; code < count; code++)
+        if (libevdev_has_event_code(evdev, type, code))
+            set_bit(bits, code);
+}
+
+static void fill_header(struct header *hdr, struct libevdev *evdev,
+                        uint64_t mac) {
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, "JCIT", sizeof(hdr->magic));
+    hdr->version = VERSION;
+    hdr->header_size = sizeof(struct header);
+    hdr->event_size = sizeof(struct event);
+    hdr->bustype = libevdev_get_id_bustype(evdev);
+    hdr->vendor = libevdev_get_id_vendor(evdev);
+    hdr->product = libevdev_get_id_product(evdev);
+    hdr->id_version = libevdev_get_id_version(evdev);
+    hdr->mac = mac;
+    hdr->start_ns = monotonic_ns();
+    strncpy(hdr->name, libevdev_get_name(evdev), sizeof(hdr->name) - 1);
+
+    for (int prop = 0; prop < PROP_BITS; prop++)
+        if (libevdev_has_property(evdev, prop))
+            set_bit(hdr->props, prop);
+    for (int type = 0; type < EV_BITS; type++)
+        if (libevdev_has_event_type(evdev, type))
+            set_bit(hdr->types, type);
+    fill_bits(evdev, EV_KEY, hdr->keys, KEY_BITS);
+    fill_bits(evdev, EV_ABS, hdr->axes, ABS_BITS);
+    fill_bits(evdev, EV_FF, hdr->ff, FF_BITS);
+    fill_bits(evdev, EV_LED, hdr->leds, LED_BITS);
+    fill_bits(evdev, EV_MSC, hdr->msc, MSC_BITS);
+
+    for (int code = 0; code < ABS_BITS; code++) {
+        const struct input_absinfo *abs = libevdev_get_abs_info(evdev, code);
+        if (!abs)
+            continue;
+        hdr->abs[code] = {abs->value, abs->minimum, abs->maximum,
+                          abs->fuzz,  abs->flat,    abs->resolution};
+    }
+}
+
+// public
+input_trace_writer::input_trace_writer(const std::string &path,
+                                       struct libevdev *evdev, uint64_t mac)
+    : file(nullptr) {
+    struct header hdr;
+
+    file = fopen(path.c_str(), "we");
+    if (!file) {
+        ALOGE("Failed to open capture %s; errno=%d", path.c_str(), errno);
+        return;
+    }
+
+    fill_header(&hdr, evdev, mac);
+    if (fwrite(&hdr, sizeof(hdr), 1, file) != 1) {
+        ALOGE("Failed to write capture header to %s", path.c_str());
+        fclose(file);
+        file = nullptr;
+        return;
+    }
+    ALOGI("Capturing input of %s to %s", hdr.name, path.c_str());
+}
+
+input_trace_writer::~input_trace_writer() {
+    if (file)
+        fclose(file);
+}
+
+void input_trace_writer::write(const struct input_event &ev) {
+    struct event rec = {
+        uint64_t(ev.input_event_sec) * 1000000000ull +
+            uint64_t(ev.input_event_usec) * 1000,
+        ev.type, ev.code, ev.value};
+
+    // Buffered by stdio; the tail is flushed when the controller goes away
+    fwrite(&rec, sizeof(rec), 1, file);
+}
+
+input_trace_reader::input_trace_reader(const std::string &path)
+    : map(nullptr), size(0) {
+    struct stat st;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGE("Failed to open trace %s; errno=%d", path.c_str(), errno);
+        return;
+    }
+    if (fstat(fd, &st) || size_t(st.st_size) < sizeof(struct header)) {
+        ALOGE("Trace %s is too short", path.c_str());
+        close(fd);
+        return;
+    }
+
+    void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        ALOGE("Failed to map trace %s; errno=%d", path.c_str(), errno);
+        return;
+    }
+
+    const struct header *hdr = static_cast<const struct header *>(mapped);
+    if (memcmp(hdr->magic, "JCIT", sizeof(hdr->magic)) ||
+        hdr->version != VERSION || hdr->event_size != sizeof(struct event) ||
+        hdr->header_size < sizeof(struct header) ||
+        hdr->header_size > size_t(st.st_size)) {
+        ALOGE("%s is not a version %u joycond input trace", path.c_str(),
+              VERSION);
+        munmap(mapped, st.st_size);
+        return;
+    }
+
+    map = mapped;
+    size = st.st_size;
+}
+
+input_trace_reader::~input_trace_reader() {
+    if (map)
+        munmap(map, size);
+}
+
+const struct event *input_trace_reader::get_events() const {
+    return reinterpret_cast<const struct event *>(
+        static_cast<const char *>(map) + get_header().header_size);
+}
+
+size_t input_trace_reader::get_event_count() const {
+    // A capture cut short may end in a partial event; ignore it
+    return (size - get_header().header_size) / sizeof(struct event);
+}
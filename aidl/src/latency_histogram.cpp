@@ -0,0 +1,54 @@
+#include "latency_histogram.h"
+
+// private
+uint64_t latency_histogram::lower_bound(int bucket) {
+    if (bucket < SUB)
+        return bucket;
+
+    int exp = bucket / SUB + SUB_BITS - 1;
+    uint64_t sub = bucket % SUB;
+    return (uint64_t(SUB) | sub) << (exp - SUB_BITS);
+}
+
+// public
+latency_histogram::latency_histogram() { reset(); }
+
+void latency_histogram::reset() {
+    for (auto &count : counts)
+        count.store(0, std::memory_order_relaxed);
+}
+
+uint64_t latency_histogram::count() const {
+    uint64_t total = 0;
+
+    for (auto &count : counts)
+        total += count.load(std::memory_order_relaxed);
+    return total;
+}
+
+uint64_t latency_histogram::percentile(double fraction) const {
+    uint64_t snapshot[BUCKETS];
+    uint64_t total = 0;
+
+    // Counts keep moving while we read; work off one consistent copy
+    for (int i = 0; i < BUCKETS; i++) {
+        snapshot[i] = counts[i].load(std::memory_order_relaxed);
+        total += snapshot[i];
+    }
+    if (!total)
+        return 0;
+
+    uint64_t rank = uint64_t(fraction * total);
+    if (rank >= total)
+        rank = total - 1;
+
+    for (int i = 0; i < BUCKETS; i++) {
+        if (rank < snapshot[i] && i + 1 < BUCKETS)
+            // report the middle of the bucket
+            return (lower_bound(i) + lower_bound(i + 1)) / 2;
+        if (rank < snapshot[i])
+            return lower_bound(i);
+        rank -= snapshot[i];
+    }
+    return lower_bound(BUCKETS - 1);
+}
@@ -0,0 +1,113 @@
+#include "loop_watchdog.h"
+
+#include <android-base/properties.h>
+#include <cinttypes>
+#include <climits>
+#include <cstdlib>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+#include "clock.h"
+
+using ::android::base::GetIntProperty;
+
+static std::string describe_fd(int fd) {
+    char path[PATH_MAX];
+    std::string link = "/proc/self/fd/" + std::to_string(fd);
+
+    ssize_t len = readlink(link.c_str(), path, sizeof(path) - 1);
+    if (len < 0)
+        return "closed";
+    path[len] = '\0';
+    return path;
+}
+
+// private
+void loop_watchdog::check() {
+    int fd;
+    uint64_t since = epoll_manager.get_busy_since(&fd);
+    if (!since)
+        return;
+
+    uint64_t stuck_ns = monotonic_ns() - since;
+    if (stuck_ns < stall_ns)
+        return;
+
+    if (since != reported) {
+        reported = since;
+        epoll_manager.record_stall();
+        ALOGE("Poll loop stuck for %" PRIu64 " ms in handler for fd %d (%s)",
+              stuck_ns / 1000000, fd, describe_fd(fd).c_str());
+    }
+
+    if (abort_ns && stuck_ns >= abort_ns) {
+        ALOGE("Poll loop stuck for %" PRIu64 " ms; aborting to recover",
+              stuck_ns / 1000000);
+        abort();
+    }
+}
+
+void *loop_watchdog::__watchLoop(void *args) {
+    loop_watchdog *const self = static_cast<loop_watchdog *>(args);
+    // Check a few times per threshold so a stall is caught close to it
+    uint64_t period_ns = self->stall_ns / 4;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&self->lock);
+    while (!self->stopping) {
+        uint64_t next = monotonic_ns() + period_ns;
+        deadline.tv_sec = next / 1000000000;
+        deadline.tv_nsec = next % 1000000000;
+        pthread_cond_timedwait(&self->cond, &self->lock, &deadline);
+        if (!self->stopping)
+            self->check();
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    return NULL;
+}
+
+// public
+loop_watchdog::loop_watchdog(epoll_mgr &epoll_manager)
+    : epoll_manager(epoll_manager), stopping(false), running(false),
+      reported(0) {
+    int stall_ms = GetIntProperty(PROP_WATCHDOG_MS, DEFAULT_WATCHDOG_MS, 0);
+    int abort_ms = GetIntProperty(PROP_WATCHDOG_ABORT_MS,
+                                  DEFAULT_WATCHDOG_ABORT_MS, 0);
+    pthread_condattr_t attr;
+
+    stall_ns = uint64_t(stall_ms) * 1000000;
+    abort_ns = uint64_t(abort_ms) * 1000000;
+
+    pthread_mutex_init(&lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (!stall_ms)
+        return;
+
+    if (pthread_create(&watchThread, NULL, __watchLoop, this)) {
+        ALOGE("pthread_create failed!");
+        return;
+    }
+    running = true;
+
+    pthread_setname_np(watchThread, "joycond_watchdog");
+}
+
+loop_watchdog::~loop_watchdog() {
+    if (running) {
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&lock);
+        pthread_join(watchThread, NULL);
+    }
+
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&lock);
+}
@@ -1,9 +1,14 @@
 #include "phys_ctlr.h"
+#include "clock.h"
+#include "player_slots.h"
+#include "trace.h"
 
 #include <android-base/logging.h>
+#include <android-base/properties.h>
 #include <fcntl.h>
 #include <glob.h>
 #include <iostream>
+#include <stdlib.h>
 #include <string.h>
 #include <string>
 #include <sys/stat.h>
@@ -11,6 +16,8 @@
 #include <unistd.h>
 #include <utils/Log.h>
 
+using ::android::base::GetProperty;
+
 // private
 std::optional<std::string>
 phys_ctlr::get_first_glob_path(std::string const &pattern) {
@@ -33,7 +40,23 @@ std::optional<std::string> phys_ctlr::get_led_path(std::string const &name) {
                                "/device/leds/*" + name);
 }
 
+void phys_ctlr::start_capture() {
+    std::string dir = GetProperty(PROP_CAPTURE_DIR, "");
+    if (dir.empty())
+        return;
+
+    // eventN-<ms since boot>.jct, so a reconnect doesn't overwrite the last
+    std::string node = devname.substr(devname.find_last_of('/') + 1);
+    std::string path = dir + "/" + node + "-" +
+                       std::to_string(monotonic_ns() / 1000000) + ".jct";
+
+    capture = std::make_unique<input_trace_writer>(path, evdev, mac_addr);
+    if (!capture->is_valid())
+        capture.reset();
+}
+
 void phys_ctlr::init_leds() {
+    TRACE_SCOPE("phys_ctlr::init_leds");
     std::optional<std::string> tmp;
     for (unsigned int i = 0; i < 100; i++) {
         tmp = get_led_path("player1");
@@ -226,20 +249,36 @@ void phys_ctlr::handle_event(struct input_event const &ev) {
 }
 
 // public
-phys_ctlr::phys_ctlr(std::string const &devpath, std::string const &devname)
-    : devpath(devpath), devname(devname), evdev(nullptr), is_serial(false) {
+// 0xff when devname isn't an eventN node or N doesn't fit
+static uint8_t parse_event_number(std::string const &devname) {
+    size_t pos = devname.rfind("/event");
+    if (pos == std::string::npos)
+        return 0xff;
+
+    const char *digits = devname.c_str() + pos + strlen("/event");
+    char *end;
+    unsigned long n = strtoul(digits, &end, 10);
+    if (end == digits || *end || n >= 0xff)
+        return 0xff;
+    return n;
+}
+
+phys_ctlr::phys_ctlr(ctlr_id id, std::string const &devpath,
+                     std::string const &devname)
+    : phys_ctlr(id, devpath, devname,
+                std::make_unique<evdev_source>(devname)) {}
+
+phys_ctlr::phys_ctlr(ctlr_id id, std::string const &devpath,
+                     std::string const &devname,
+                     std::unique_ptr<event_source> source)
+    : id(id), devpath(devpath), devname(devname),
+      event_number(parse_event_number(devname)), source(std::move(source)),
+      evdev(this->source->get_evdev()), is_serial(false), mac_addr(0) {
 
     zero_triggers();
 
-    int fd = open(devname.c_str(), O_RDWR | O_NONBLOCK);
-    if (fd < 0) {
-        ALOGE("Failed to open %s; errno=%d", devname.c_str(), errno);
-        exit(1);
-    }
-    if (libevdev_new_from_fd(fd, &evdev)) {
-        ALOGE("Failed to create evdev from fd");
+    if (!evdev)
         exit(1);
-    }
 
     int product_id = libevdev_get_id_product(evdev);
     // Extra checks are required for charging grip
@@ -278,11 +317,24 @@ phys_ctlr::phys_ctlr(std::string const &devpath, std::string const &devname)
         break;
     }
 
+    // Prevent other users from having access to the evdev until it's paired
+    grab();
+
+    // Without a sysfs node there are no LEDs, and the MAC and the name
+    // come from the evdev itself
+    if (devpath.empty()) {
+        const char *uniq = libevdev_get_uniq(evdev);
+        mac_addr = parse_mac(uniq ? uniq : "");
+        is_serial = model == Model::Sio ||
+                    strstr(libevdev_get_name(evdev), "Serial") != nullptr;
+        stats = std::make_shared<ctlr_stats>(false, libevdev_get_name(evdev),
+                                             mac_addr);
+        return;
+    }
+
     if (model != Model::Sio)
         init_leds();
 
-    // Prevent other users from having access to the evdev until it's paired
-    grab();
     if (fchmod(get_fd(), S_IRUSR | S_IWUSR))
         ALOGE("Failed to change evdev permissions; %s", strerror(errno));
 
@@ -302,26 +354,28 @@ phys_ctlr::phys_ctlr(std::string const &devpath, std::string const &devname)
     }
 
     // Attempt to read MAC address from uniq attribute
-    mac_addr = "";
+    std::string uniq;
     std::ifstream funiq("/sys/" + devpath + "/uniq");
-    std::getline(funiq, mac_addr);
-    ALOGI("MAC: %s", mac_addr.c_str());
-}
+    std::getline(funiq, uniq);
+    mac_addr = parse_mac(uniq);
+    ALOGI("MAC: %s", uniq.c_str());
 
-phys_ctlr::~phys_ctlr() {
-    if (evdev) {
-        int fd = libevdev_get_fd(evdev);
-        libevdev_free(evdev);
-        close(fd);
-    }
+    stats = std::make_shared<ctlr_stats>(false, libevdev_get_name(evdev),
+                                         mac_addr);
+    start_capture();
 }
 
+phys_ctlr::~phys_ctlr() {}
+
 bool phys_ctlr::set_player_led(int index, bool on) {
     if (index > 3 || !player_leds[index].is_open() || is_serial)
         return false;
 
     player_leds[index] << (on ? '1' : '0');
     player_leds[index].flush();
+    // the constructor may set LEDs before stats exist
+    if (stats)
+        stats->add(ctlr_stats::LedWrites);
     return true;
 }
 
@@ -335,14 +389,16 @@ bool phys_ctlr::set_all_player_leds(bool on) {
 }
 
 bool phys_ctlr::set_player_leds_to_player(int player) {
-    if (player < 1 || player > 4) {
+    uint8_t pattern = player_slots::led_pattern(player);
+
+    if (!pattern) {
         ALOGE("%d is not a valid player led value", player);
         return false;
     }
 
-    set_all_player_leds(false);
-    for (int i = 0; i < player; i++) {
-        set_player_led(i, true);
+    for (int i = 0; i < 4; i++) {
+        if (!set_player_led(i, pattern & (1 << i)))
+            return false;
         usleep(5000);
     }
     return true;
@@ -354,6 +410,7 @@ bool phys_ctlr::set_home_led(unsigned short brightness) {
 
     home_led << brightness;
     home_led.flush();
+    stats->add(ctlr_stats::LedWrites);
     return true;
 }
 
@@ -374,24 +431,27 @@ bool phys_ctlr::blink_player_leds() {
     return true;
 }
 
-int phys_ctlr::get_fd() { return libevdev_get_fd(evdev); }
+int phys_ctlr::get_fd() { return source->get_fd(); }
 
 void phys_ctlr::handle_events() {
     struct input_event ev;
 
-    int ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+    int ret = next_event(LIBEVDEV_READ_FLAG_NORMAL, &ev);
     while (ret == LIBEVDEV_READ_STATUS_SYNC ||
            ret == LIBEVDEV_READ_STATUS_SUCCESS) {
         if (ret == LIBEVDEV_READ_STATUS_SYNC) {
             ALOGI("handle sync");
+            stats->add(ctlr_stats::SynDropped);
             while (ret == LIBEVDEV_READ_STATUS_SYNC) {
+                count_event(ev);
                 handle_event(ev);
-                ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_SYNC, &ev);
+                ret = next_event(LIBEVDEV_READ_FLAG_SYNC, &ev);
             }
         } else if (ret == LIBEVDEV_READ_STATUS_SUCCESS) {
+            count_event(ev);
             handle_event(ev);
         }
-        ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+        ret = next_event(LIBEVDEV_READ_FLAG_NORMAL, &ev);
     }
 }
 
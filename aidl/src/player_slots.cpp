@@ -0,0 +1,106 @@
+#include "player_slots.h"
+
+#include <utils/Log.h>
+
+static const uint8_t led_patterns[player_slots::MAX_SLOTS] = {
+    0b0001, 0b0011, 0b0111, 0b1111, 0b1001, 0b0101, 0b1101, 0b0110,
+    0b0010, 0b0100, 0b1000, 0b1010, 0b1100, 0b1110, 0b1011,
+};
+
+// private
+void player_slots::reserve(int slot, uint64_t mac) {
+    auto prev = reservations.find(mac);
+    if (prev != reservations.end()) {
+        if (prev->second == slot)
+            return;
+        drop_reservation(prev->second);
+    }
+    if (reserved_mask & (1u << slot))
+        drop_reservation(slot);
+
+    reserved_mask |= 1u << slot;
+    reserved_mac[slot] = mac;
+    reservations[mac] = slot;
+}
+
+void player_slots::drop_reservation(int slot) {
+    if (!(reserved_mask & (1u << slot)))
+        return;
+
+    reservations.erase(reserved_mac[slot]);
+    reserved_mask &= ~(1u << slot);
+    reserved_mac[slot] = 0;
+}
+
+// public
+player_slots::player_slots(int capacity, bool sticky)
+    : capacity(capacity), sticky(sticky), reserved_mask(0), reserved_mac() {
+    if (this->capacity < 1 || this->capacity > MAX_SLOTS) {
+        ALOGE("Invalid player slot count %d; using %d", capacity, MAX_SLOTS);
+        this->capacity = MAX_SLOTS;
+    }
+    free_mask = (1u << this->capacity) - 1;
+}
+
+int player_slots::acquire(uint64_t mac) {
+    int slot;
+
+    if (sticky && mac) {
+        auto held = reservations.find(mac);
+        if (held != reservations.end() &&
+            (free_mask & (1u << held->second))) {
+            free_mask &= ~(1u << held->second);
+            return held->second;
+        }
+    }
+
+    // Prefer slots nobody has a claim on before evicting a reservation
+    uint32_t candidates = free_mask & ~reserved_mask;
+    if (!candidates)
+        candidates = free_mask;
+    if (!candidates)
+        return -1;
+
+    slot = __builtin_ctz(candidates);
+    free_mask &= ~(1u << slot);
+    drop_reservation(slot);
+    if (sticky && mac)
+        reserve(slot, mac);
+
+    return slot;
+}
+
+bool player_slots::take(int slot) {
+    if (slot < 0 || slot >= capacity || !(free_mask & (1u << slot)))
+        return false;
+
+    free_mask &= ~(1u << slot);
+    if (!sticky)
+        drop_reservation(slot);
+    return true;
+}
+
+void player_slots::hold(int slot, uint64_t mac) {
+    if (slot < 0 || slot >= capacity || !mac)
+        return;
+
+    reserve(slot, mac);
+}
+
+void player_slots::release(int slot) {
+    if (slot < 0 || slot >= capacity)
+        return;
+
+    free_mask |= 1u << slot;
+}
+
+int player_slots::in_use() const {
+    return capacity - __builtin_popcount(free_mask);
+}
+
+uint8_t player_slots::led_pattern(int player) {
+    if (player < 1 || player > MAX_SLOTS)
+        return 0;
+
+    return led_patterns[player - 1];
+}
@@ -0,0 +1,170 @@
+#include "rumble_queue.h"
+#include "clock.h"
+
+#include <cstring>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+std::atomic<uint64_t> rumble_queue::sent(0);
+std::atomic<uint64_t> rumble_queue::superseded(0);
+std::atomic<uint64_t> rumble_queue::dropped(0);
+std::atomic<uint64_t> rumble_queue::latency_total_ns(0);
+std::atomic<uint64_t> rumble_queue::latency_max_ns(0);
+
+// private
+void rumble_queue::schedule() {
+    uint64_t now = monotonic_ns();
+    uint64_t next = last_write_ns + interval_ns;
+
+    if (order.empty() || timer_armed || watching)
+        return;
+
+    if (now >= next) {
+        if (epoll_manager.watch_writable(
+                fd, [=](int event_fd) { flush(event_fd); })) {
+            watching = true;
+            return;
+        }
+        // Still paced, so a device that keeps saying EAGAIN can't spin us
+        write_on_timer = true;
+        next = now + interval_ns;
+    }
+
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = next / 1000000000ull;
+    spec.it_value.tv_nsec = next % 1000000000ull;
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL))
+        ALOGE("Failed to arm rumble timer; %s", strerror(errno));
+    else
+        timer_armed = true;
+}
+
+void rumble_queue::flush(int event_fd) {
+    uint64_t now = monotonic_ns();
+    struct input_event ev = {};
+
+    ev.type = EV_FF;
+    while (!order.empty()) {
+        uint16_t code = order.front();
+
+        if (!queued[code]) {
+            order.pop_front();
+            continue;
+        }
+
+        ev.code = code;
+        ev.value = values[code];
+        if (write(fd, &ev, sizeof(ev)) != sizeof(ev)) {
+            if (errno == EAGAIN)
+                return;
+            ALOGE("Failed to forward EV_FF to phys; %s", strerror(errno));
+            dropped++;
+            counters->add(ctlr_stats::FfDropped);
+        } else {
+            uint64_t latency = now - queued_ns[code];
+
+            sent++;
+            counters->add(ctlr_stats::FfForwarded);
+            latency_total_ns += latency;
+            if (latency > latency_max_ns)
+                latency_max_ns = latency;
+        }
+
+        queued[code] = false;
+        order.pop_front();
+    }
+
+    last_write_ns = now;
+    epoll_manager.unwatch_writable(fd);
+    watching = false;
+}
+
+void rumble_queue::timer_callback(int event_fd) {
+    uint64_t expirations;
+
+    if (read(event_fd, &expirations, sizeof(expirations)) < 0 &&
+        errno != EAGAIN)
+        ALOGE("Failed to read rumble timer; %s", strerror(errno));
+
+    timer_armed = false;
+    if (write_on_timer) {
+        write_on_timer = false;
+        flush(fd);
+    }
+    schedule();
+}
+
+// public
+rumble_queue::rumble_queue(epoll_mgr &epoll_manager, int fd,
+                           uint64_t interval_ms,
+                           std::shared_ptr<ctlr_stats> counters)
+    : epoll_manager(epoll_manager), fd(fd), counters(counters),
+      interval_ns(interval_ms * 1000000ull), timer_fd(-1),
+      timer_subscriber(nullptr), queued(), values(), queued_ns(),
+      last_write_ns(0), watching(false), timer_armed(false),
+      write_on_timer(false) {
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        ALOGE("Failed to create rumble timer; %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    timer_subscriber = std::make_shared<epoll_subscriber>(
+        std::vector({timer_fd}),
+        [=](int event_fd) { timer_callback(event_fd); });
+    epoll_manager.add_subscriber(timer_subscriber);
+}
+
+rumble_queue::~rumble_queue() {
+    // Whatever is still queued has nowhere to go anymore
+    for (uint16_t code : order) {
+        if (queued[code]) {
+            queued[code] = false;
+            dropped++;
+            counters->add(ctlr_stats::FfDropped);
+        }
+    }
+
+    if (watching)
+        epoll_manager.unwatch_writable(fd);
+    epoll_manager.remove_subscriber(timer_subscriber);
+    close(timer_fd);
+}
+
+void rumble_queue::push(uint16_t code, int32_t value) {
+    if (code >= FF_CNT)
+        return;
+
+    if (queued[code]) {
+        superseded++;
+        counters->add(ctlr_stats::FfDropped);
+    } else {
+        queued[code] = true;
+        order.push_back(code);
+    }
+    values[code] = value;
+    queued_ns[code] = monotonic_ns();
+
+    schedule();
+}
+
+void rumble_queue::cancel(uint16_t code) {
+    if (code < FF_CNT && queued[code]) {
+        queued[code] = false;
+        dropped++;
+        counters->add(ctlr_stats::FfDropped);
+    }
+}
+
+struct rumble_queue::stats rumble_queue::get_stats() {
+    struct stats s;
+    uint64_t count = sent.load();
+
+    s.sent = count;
+    s.superseded = superseded.load();
+    s.dropped = dropped.load();
+    s.latency_avg_ns = count ? latency_total_ns.load() / count : 0;
+    s.latency_max_ns = latency_max_ns.load();
+    return s;
+}
@@ -0,0 +1,101 @@
+#include "rumble_sequencer.h"
+#include "clock.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+// private
+void rumble_sequencer::set_amplitude(uint8_t amplitude) {
+    if (this->amplitude == amplitude)
+        return;
+
+    this->amplitude = amplitude;
+    output(amplitude);
+}
+
+void rumble_sequencer::advance() {
+    while (index < steps.size()) {
+        const rumble_step &step = steps[index++];
+
+        set_amplitude(step.amplitude);
+        if (index == steps.size() && repeat >= 0)
+            index = repeat;
+
+        // zero length steps only set the amplitude
+        if (!step.duration_ms)
+            continue;
+
+        struct itimerspec spec = {};
+        deadline_ns += step.duration_ms * 1000000ull;
+        spec.it_value.tv_sec = deadline_ns / 1000000000ull;
+        spec.it_value.tv_nsec = deadline_ns % 1000000000ull;
+        if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL))
+            ALOGE("Failed to arm rumble pattern timer; %s", strerror(errno));
+        return;
+    }
+
+    stop();
+}
+
+void rumble_sequencer::timer_callback(int event_fd) {
+    uint64_t expirations;
+
+    if (read(event_fd, &expirations, sizeof(expirations)) < 0 &&
+        errno != EAGAIN)
+        ALOGE("Failed to read rumble pattern timer; %s", strerror(errno));
+
+    advance();
+}
+
+// public
+rumble_sequencer::rumble_sequencer(epoll_mgr &epoll_manager,
+                                   std::function<void(uint8_t)> output)
+    : epoll_manager(epoll_manager), timer_fd(-1), subscriber(nullptr),
+      output(output), repeat(-1), index(0), deadline_ns(0), amplitude(0) {
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        ALOGE("Failed to create rumble pattern timer; %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    subscriber = std::make_shared<epoll_subscriber>(
+        std::vector({timer_fd}),
+        [=](int event_fd) { timer_callback(event_fd); });
+    epoll_manager.add_subscriber(subscriber);
+}
+
+rumble_sequencer::~rumble_sequencer() {
+    epoll_manager.remove_subscriber(subscriber);
+    close(timer_fd);
+}
+
+void rumble_sequencer::play(const std::vector<rumble_step> &steps,
+                            int repeat) {
+    uint64_t loop_ms = 0;
+
+    // A loop with no duration would never give the poll thread back
+    for (size_t i = repeat >= 0 ? repeat : steps.size(); i < steps.size(); i++)
+        loop_ms += steps[i].duration_ms;
+    if (repeat >= int(steps.size()) || (repeat >= 0 && !loop_ms)) {
+        ALOGE("Invalid rumble pattern repeat index %d", repeat);
+        repeat = -1;
+    }
+
+    this->steps = steps;
+    this->repeat = repeat;
+    index = 0;
+    deadline_ns = monotonic_ns();
+    advance();
+}
+
+void rumble_sequencer::stop() {
+    struct itimerspec spec = {};
+
+    timerfd_settime(timer_fd, 0, &spec, NULL);
+    steps.clear();
+    index = 0;
+    set_amplitude(0);
+}
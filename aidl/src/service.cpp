@@ -20,10 +20,12 @@
 #include <android/binder_process.h>
 
 #include "Joycond.h"
+#include "trace.h"
 
 using aidl::android::hardware::nintendo::joycond::Joycond;
 
 int main() {
+    TRACE_INIT();
     ABinderProcess_setThreadPoolMaxThreadCount(0);
     std::shared_ptr<Joycond> joycond = ndk::SharedRefBase::make<Joycond>();
 
@@ -0,0 +1,200 @@
+#include "session.h"
+#include "ctlr_id.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <utils/Log.h>
+
+static const char *SESSION_HEADER = "joycond-session 1";
+
+static const char *kind_name(virt_ctlr::Kind kind) {
+    switch (kind) {
+    case virt_ctlr::Kind::Passthrough:
+        return "passthrough";
+    case virt_ctlr::Kind::Pro:
+        return "pro";
+    case virt_ctlr::Kind::Combined:
+        return "combined";
+    }
+    return "unknown";
+}
+
+static bool parse_kind(const std::string &name, virt_ctlr::Kind *kind) {
+    if (name == "passthrough")
+        *kind = virt_ctlr::Kind::Passthrough;
+    else if (name == "pro")
+        *kind = virt_ctlr::Kind::Pro;
+    else if (name == "combined")
+        *kind = virt_ctlr::Kind::Combined;
+    else
+        return false;
+    return true;
+}
+
+std::string serialize_session(const std::vector<session_entry> &entries) {
+    std::string out = SESSION_HEADER;
+
+    out += "\n";
+    for (auto &entry : entries) {
+        out += std::to_string(entry.slot) + " " + kind_name(entry.kind) + " ";
+        for (size_t i = 0; i < entry.macs.size(); i++) {
+            if (i)
+                out += ",";
+            out += format_mac(entry.macs[i]);
+        }
+        out += "\n";
+    }
+    return out;
+}
+
+std::vector<session_entry> parse_session(const std::string &contents) {
+    std::vector<session_entry> entries;
+    std::istringstream stream(contents);
+    std::string line;
+
+    if (!std::getline(stream, line) || line != SESSION_HEADER) {
+        ALOGE("Ignoring session snapshot with unknown format");
+        return entries;
+    }
+
+    while (std::getline(stream, line)) {
+        std::istringstream fields(line);
+        std::string kind;
+        std::string macs;
+        std::string mac;
+        session_entry entry;
+
+        if (!(fields >> entry.slot >> kind >> macs) ||
+            !parse_kind(kind, &entry.kind)) {
+            ALOGE("Skipping bad session line \"%s\"", line.c_str());
+            continue;
+        }
+
+        std::istringstream mac_list(macs);
+        while (std::getline(mac_list, mac, ',')) {
+            uint64_t parsed = parse_mac(mac);
+            if (parsed)
+                entry.macs.push_back(parsed);
+        }
+        if (!entry.macs.empty())
+            entries.push_back(entry);
+    }
+    return entries;
+}
+
+bool write_file_atomically(const std::string &path,
+                           const std::string &contents) {
+    std::string tmp = path + ".tmp";
+    std::string dir = path.substr(0, path.find_last_of('/') + 1);
+    size_t written = 0;
+    int fd;
+
+    fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ALOGE("Failed to open %s; %s", tmp.c_str(), strerror(errno));
+        return false;
+    }
+
+    while (written < contents.size()) {
+        ssize_t ret = write(fd, contents.data() + written,
+                            contents.size() - written);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0) {
+            ALOGE("Failed to write %s; %s", tmp.c_str(), strerror(errno));
+            close(fd);
+            unlink(tmp.c_str());
+            return false;
+        }
+        written += ret;
+    }
+
+    // The data has to be on disk before the rename can make it visible
+    if (fsync(fd)) {
+        ALOGE("Failed to sync %s; %s", tmp.c_str(), strerror(errno));
+        close(fd);
+        unlink(tmp.c_str());
+        return false;
+    }
+    close(fd);
+
+    if (rename(tmp.c_str(), path.c_str())) {
+        ALOGE("Failed to replace %s; %s", path.c_str(), strerror(errno));
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    // ...and the rename itself only survives a crash once the directory is
+    fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    return true;
+}
+
+// private
+void *session_writer::__writerLoop(void *args) {
+    session_writer *const self = static_cast<session_writer *>(args);
+
+    pthread_mutex_lock(&self->lock);
+    while (self->dirty || !self->stopping) {
+        if (!self->dirty) {
+            pthread_cond_wait(&self->cond, &self->lock);
+            continue;
+        }
+
+        std::string contents = std::move(self->pending);
+        self->dirty = false;
+        pthread_mutex_unlock(&self->lock);
+        write_file_atomically(self->path, contents);
+        pthread_mutex_lock(&self->lock);
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    return NULL;
+}
+
+// public
+session_writer::session_writer(const std::string &path)
+    : path(path), dirty(false), stopping(false), running(false) {
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&cond, NULL);
+
+    if (pthread_create(&writerThread, NULL, __writerLoop, this)) {
+        ALOGE("pthread_create failed!");
+        return;
+    }
+    running = true;
+
+    pthread_setname_np(writerThread, "joycond_session");
+}
+
+session_writer::~session_writer() {
+    if (running) {
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&lock);
+        pthread_join(writerThread, NULL);
+    }
+
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&lock);
+}
+
+void session_writer::write(const std::string &contents) {
+    if (!running) {
+        write_file_atomically(path, contents);
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    pending = contents;
+    dirty = true;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,58 @@
+#include "stage_profiler.h"
+
+#ifdef JOYCOND_PROFILE
+
+#include <android-base/properties.h>
+#include <cinttypes>
+#include <cstdio>
+
+using ::android::base::GetIntProperty;
+
+static const char *const stage_names[] = {"read",      "mouse", "layout",
+                                          "transform", "write", "ff"};
+
+latency_histogram stage_profiler::histograms[int(relay_stage::COUNT)];
+std::atomic<uint64_t> stage_profiler::total_ns[int(relay_stage::COUNT)];
+uint32_t stage_profiler::sample_interval = DEFAULT_PROFILE_SAMPLE;
+
+thread_local uint64_t stage_profiler::last_tick = 0;
+thread_local uint32_t stage_profiler::pass[int(profile_path::COUNT)];
+thread_local bool stage_profiler::sampling = false;
+
+// private
+uint64_t stage_profiler::ticks_to_ns(uint64_t ticks) {
+#if defined(__aarch64__)
+    static const uint64_t freq = [] {
+        uint64_t f;
+        asm volatile("mrs %0, cntfrq_el0" : "=r"(f));
+        return f;
+    }();
+    return ticks * 1000000000ull / freq;
+#else
+    return ticks;
+#endif
+}
+
+// public
+void stage_profiler::init() {
+    sample_interval = GetIntProperty(PROP_PROFILE_SAMPLE,
+                                     DEFAULT_PROFILE_SAMPLE, 1);
+}
+
+void stage_profiler::dump(int fd) {
+    dprintf(fd, "Relay stage profile (1 in %u relay and FF passes):\n",
+            sample_interval);
+    for (int i = 0; i < int(relay_stage::COUNT); i++) {
+        uint64_t count = histograms[i].count();
+        if (!count)
+            continue;
+
+        dprintf(fd, "  %-9s n: %" PRIu64 " total: %" PRIu64 " us avg: %" PRIu64
+                " ns p50: %" PRIu64 " ns p99: %" PRIu64 " ns\n",
+                stage_names[i], count, total_ns[i].load() / 1000,
+                total_ns[i].load() / count, histograms[i].percentile(0.5),
+                histograms[i].percentile(0.99));
+    }
+}
+
+#endif
@@ -0,0 +1,130 @@
+#include "stale_cache.h"
+#include "clock.h"
+
+#include <cstring>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+// private
+void stale_cache::erase(std::list<entry>::iterator it) {
+    for (uint64_t mac : it->macs) {
+        auto owner = by_mac.find(mac);
+        if (owner != by_mac.end() && owner->second == it)
+            by_mac.erase(owner);
+    }
+
+    resident_bytes -= it->footprint;
+    count--;
+    entries.erase(it);
+}
+
+void stale_cache::arm_timer() {
+    struct itimerspec spec = {};
+
+    // A zeroed it_value disarms the timer
+    if (!entries.empty()) {
+        uint64_t expires = entries.front().expires_ns;
+        spec.it_value.tv_sec = expires / 1000000000ull;
+        spec.it_value.tv_nsec = expires % 1000000000ull;
+    }
+
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL))
+        ALOGE("Failed to arm stale controller timer; %s", strerror(errno));
+}
+
+void stale_cache::timer_callback(int event_fd) {
+    uint64_t expirations;
+
+    if (read(event_fd, &expirations, sizeof(expirations)) < 0 &&
+        errno != EAGAIN)
+        ALOGE("Failed to read stale controller timer; %s", strerror(errno));
+
+    uint64_t now = monotonic_ns();
+    while (!entries.empty() && entries.front().expires_ns <= now) {
+        ALOGI("Stale controller expired; tearing it down");
+        erase(entries.begin());
+        expired++;
+    }
+    arm_timer();
+}
+
+// public
+stale_cache::stale_cache(epoll_mgr &epoll_manager, size_t capacity,
+                         uint64_t ttl_ms)
+    : epoll_manager(epoll_manager), subscriber(nullptr), timer_fd(-1),
+      capacity(capacity), ttl_ns(ttl_ms * 1000000ull), hits(0), misses(0),
+      expired(0), evicted(0), count(0), resident_bytes(0) {
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        ALOGE("Failed to create stale controller timer; %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    subscriber = std::make_shared<epoll_subscriber>(
+        std::vector({timer_fd}),
+        [=](int event_fd) { timer_callback(event_fd); });
+    epoll_manager.add_subscriber(subscriber);
+}
+
+stale_cache::~stale_cache() {
+    epoll_manager.remove_subscriber(subscriber);
+    close(timer_fd);
+}
+
+void stale_cache::insert(std::unique_ptr<virt_ctlr> virt) {
+    if (!capacity)
+        return;
+
+    while (entries.size() >= capacity) {
+        ALOGI("Stale controller cache full; evicting oldest");
+        erase(entries.begin());
+        evicted++;
+    }
+
+    entry e;
+    e.macs = virt->get_macs();
+    e.footprint = virt->mem_footprint();
+    e.expires_ns = monotonic_ns() + ttl_ns;
+    e.virt = std::move(virt);
+
+    entries.push_back(std::move(e));
+    auto it = std::prev(entries.end());
+    for (uint64_t mac : it->macs)
+        by_mac[mac] = it;
+
+    resident_bytes += it->footprint;
+    count++;
+    arm_timer();
+}
+
+std::unique_ptr<virt_ctlr> stale_cache::take(uint64_t mac) {
+    auto owner = by_mac.find(mac);
+    if (owner == by_mac.end()) {
+        misses++;
+        return nullptr;
+    }
+
+    auto it = owner->second;
+    bool was_front = it == entries.begin();
+    std::unique_ptr<virt_ctlr> virt = std::move(it->virt);
+
+    erase(it);
+    hits++;
+    if (was_front)
+        arm_timer();
+    return virt;
+}
+
+struct stale_cache::stats stale_cache::get_stats() const {
+    struct stats s;
+
+    s.hits = hits.load();
+    s.misses = misses.load();
+    s.expired = expired.load();
+    s.evicted = evicted.load();
+    s.entries = count.load();
+    s.resident_bytes = resident_bytes.load();
+    return s;
+}
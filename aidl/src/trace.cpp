@@ -0,0 +1,74 @@
+#include "trace.h"
+
+#ifndef JOYCOND_NO_TRACE
+
+#include <cinttypes>
+#include <cstdlib>
+#include <pthread.h>
+#include <string>
+#include <unistd.h>
+#include <utils/Log.h>
+
+#ifdef __ANDROID__
+#include <android-base/properties.h>
+
+using ::android::base::GetProperty;
+#endif
+
+FILE *trace::file = nullptr;
+int trace::pid = 0;
+
+// private
+void trace::write_event(const char *name, uint64_t start_ns, uint64_t end_ns) {
+    static thread_local bool named = false;
+    int tid = gettid();
+
+    // Name each thread the first time it shows up so the timeline rows read
+    // joycond_poll and friends rather than bare tids
+    if (!named) {
+        char thread_name[16] = "";
+
+        pthread_getname_np(pthread_self(), thread_name, sizeof(thread_name));
+        fprintf(file,
+                "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+                pid, tid, thread_name);
+        named = true;
+    }
+
+    // One fprintf per event; stdio locks the stream, so lines don't interleave
+    fprintf(file,
+            "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+            "\"ts\":%" PRIu64 ".%03" PRIu64 ",\"dur\":%" PRIu64
+            ".%03" PRIu64 "},\n",
+            name, pid, tid, start_ns / 1000, start_ns % 1000,
+            (end_ns - start_ns) / 1000, (end_ns - start_ns) % 1000);
+}
+
+// public
+void trace::init() {
+#ifdef __ANDROID__
+    std::string path = GetProperty(PROP_TRACE_FILE, "");
+#else
+    const char *env = getenv("JOYCOND_TRACE_FILE");
+    std::string path = env ? env : "";
+#endif
+
+    if (path.empty())
+        return;
+
+    file = fopen(path.c_str(), "we");
+    if (!file) {
+        ALOGE("Failed to open trace file %s; errno=%d", path.c_str(), errno);
+        return;
+    }
+    // Line buffered, so a crash or kill still leaves a usable trace; the
+    // JSON array format doesn't need its closing bracket
+    setvbuf(file, nullptr, _IOLBF, 0);
+    fputs("[\n", file);
+    pid = getpid();
+
+    ALOGI("Writing trace events to %s", path.c_str());
+}
+
+#endif
@@ -0,0 +1,185 @@
+#include "uinput_pool.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <utils/Log.h>
+
+// private
+bool uinput_pool::next_missing(virt_caps *caps) {
+    for (const virt_caps &target : targets) {
+        int wanted = std::count(targets.begin(), targets.end(), target);
+        int have = std::count_if(
+            ready.begin(), ready.end(),
+            [&](const virt_device &dev) { return dev.caps == target; });
+        if (have < wanted) {
+            *caps = target;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool uinput_pool::next_surplus(struct virt_device *dev) {
+    for (auto it = ready.begin(); it != ready.end(); it++) {
+        int wanted = std::count(targets.begin(), targets.end(), it->caps);
+        int have = std::count_if(
+            ready.begin(), ready.end(),
+            [&](const virt_device &other) { return other.caps == it->caps; });
+        if (have > wanted) {
+            *dev = *it;
+            ready.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+void *uinput_pool::__refillLoop(void *args) {
+    uinput_pool *const self = static_cast<uinput_pool *>(args);
+    struct virt_device dev;
+    virt_caps caps;
+
+    pthread_mutex_lock(&self->lock);
+    while (!self->stopping) {
+        if (self->next_surplus(&dev)) {
+            pthread_mutex_unlock(&self->lock);
+            destroy_virt_device(&dev);
+            pthread_mutex_lock(&self->lock);
+            continue;
+        }
+
+        if (!self->next_missing(&caps)) {
+            pthread_cond_wait(&self->cond, &self->lock);
+            continue;
+        }
+
+        self->building = true;
+        self->building_caps = caps;
+        pthread_mutex_unlock(&self->lock);
+        bool created = self->create(caps, &dev);
+        pthread_mutex_lock(&self->lock);
+        self->building = false;
+
+        if (created) {
+            dev.pooled = true;
+            self->ready.push_back(dev);
+        }
+        pthread_cond_broadcast(&self->cond);
+        // Don't spin on a broken uinput; wait for the targets to change
+        if (!created)
+            pthread_cond_wait(&self->cond, &self->lock);
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    return NULL;
+}
+
+// public
+uinput_pool::uinput_pool(bool enabled, virt_device_factory create)
+    : enabled(enabled), create(std::move(create)), stopping(false),
+      building(false), hits(0), misses(0), pairing_ns(), pairing_count(),
+      first_event_ns(), first_event_count() {
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&cond, NULL);
+
+    if (!enabled)
+        return;
+
+    if (pthread_create(&refillThread, NULL, __refillLoop, this)) {
+        ALOGE("pthread_create failed!");
+        this->enabled = false;
+        return;
+    }
+
+    pthread_setname_np(refillThread, "joycond_uinput_pool");
+}
+
+uinput_pool::~uinput_pool() {
+    if (enabled) {
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&lock);
+        pthread_join(refillThread, NULL);
+    }
+
+    for (auto &dev : ready)
+        destroy_virt_device(&dev);
+
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&lock);
+}
+
+void uinput_pool::set_targets(const std::vector<virt_caps> &targets) {
+    if (!enabled)
+        return;
+
+    pthread_mutex_lock(&lock);
+    this->targets = targets;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+bool uinput_pool::claim(const virt_caps &caps, struct virt_device *dev) {
+    if (enabled) {
+        auto matches = [&](const virt_device &pooled) {
+            return pooled.caps == caps;
+        };
+
+        pthread_mutex_lock(&lock);
+        auto match = std::find_if(ready.begin(), ready.end(), matches);
+        // Half built is still quicker than starting over
+        while (match == ready.end() && building && building_caps == caps) {
+            pthread_cond_wait(&cond, &lock);
+            match = std::find_if(ready.begin(), ready.end(), matches);
+        }
+        // Served either way, so don't build it again
+        auto target = std::find(targets.begin(), targets.end(), caps);
+        if (target != targets.end())
+            targets.erase(target);
+        if (match != ready.end()) {
+            *dev = *match;
+            ready.erase(match);
+            pthread_mutex_unlock(&lock);
+            hits++;
+            return true;
+        }
+        pthread_mutex_unlock(&lock);
+    }
+
+    misses++;
+    return create(caps, dev);
+}
+
+void uinput_pool::record_pairing(uint64_t latency_ns, bool pooled) {
+    ALOGI("Paired in %" PRIu64 " us (%s device)", latency_ns / 1000,
+          pooled ? "pooled" : "new");
+    pairing_ns[pooled] += latency_ns;
+    pairing_count[pooled]++;
+}
+
+void uinput_pool::record_first_event(uint64_t latency_ns, bool pooled) {
+    ALOGI("First event %" PRIu64 " us after pairing (%s device)",
+          latency_ns / 1000, pooled ? "pooled" : "new");
+    first_event_ns[pooled] += latency_ns;
+    first_event_count[pooled]++;
+}
+
+void uinput_pool::dump(int fd) const {
+    dprintf(fd, "uinput pool: %s hits: %" PRIu64 " misses: %" PRIu64 "\n",
+            enabled ? "on" : "off", hits.load(), misses.load());
+    for (int pooled = 0; pooled < 2; pooled++) {
+        uint64_t pairs = pairing_count[pooled].load();
+        uint64_t firsts = first_event_count[pooled].load();
+        if (!pairs)
+            continue;
+        dprintf(fd, "  %s devices: pairing avg %" PRIu64 " us",
+                pooled ? "pooled" : "new",
+                pairing_ns[pooled].load() / pairs / 1000);
+        if (firsts)
+            dprintf(fd, ", to first event avg %" PRIu64 " us",
+                    first_event_ns[pooled].load() / firsts / 1000);
+        dprintf(fd, "\n");
+    }
+}
@@ -1,6 +1,11 @@
 #include "virt_ctlr_combined.h"
+#include "clock.h"
+#include "player_slots.h"
+#include "stage_profiler.h"
+#include "trace.h"
 
 #include <android-base/logging.h>
+#include <cinttypes>
 #include <cstring>
 #include <fcntl.h>
 #include <iostream>
@@ -14,125 +19,183 @@
 #include <vector>
 
 // private
+void virt_ctlr_combined::emit(unsigned int type, unsigned int code,
+                              int value) {
+    PROFILE_MARK(Transform);
+    sink->write_event(type, code, value);
+    PROFILE_MARK(Write);
+    record(flight::kind::Output, type, code, value);
+    count(ctlr_stats::EventsWritten);
+    if (type == EV_SYN && code == SYN_REPORT)
+        count(ctlr_stats::Frames);
+}
+
+// Emits what ev came out as, remembering it if ev pressed a key
+void virt_ctlr_combined::emit_key(input_state &state,
+                                  struct input_event const &ev,
+                                  unsigned int type, unsigned int code,
+                                  int value) {
+    if (ev.type == EV_KEY && ev.value)
+        state.hold(ev.code, type, code);
+    emit(type, code, value);
+}
+
+void virt_ctlr_combined::relay_event(std::shared_ptr<phys_ctlr> const &phys,
+                                     struct input_event const &ev) {
+    bool is_serial = phys->is_serial_ctlr();
+    input_state &state = phys == physl ? left_state : right_state;
+    input_state::held_key held;
+
+    if (mMapping->rsmouse)
+        this->mouse->relay_mouse_event(ev);
+    this->mouse->relay_button_event(ev);
+    PROFILE_MARK(Mouse);
+
+    // toggle rsmouse with screenshot button
+    if (ev.code == 309 && ev.value)
+        mMapping->rsmouse = !mMapping->rsmouse;
+
+    // Let go of whatever the press came out as, whatever maps it now
+    if (ev.type == EV_KEY && !ev.value && state.take_held(ev.code, &held)) {
+        emit(held.out_type, held.out_code, 0);
+        return;
+    }
+
+    // EV_KEY mapping
+    uint32_t code;
+    bool remapped = lookup_layout(mMapping, mapLock, ev.code, &code);
+    PROFILE_MARK(Layout);
+    if (remapped) {
+        emit_key(state, ev, EV_KEY, code, ev.value);
+        return;
+    }
+
+    /* First remap the SL and SR buttons on each physical controller */
+    if (phys == physl && ev.type == EV_KEY &&
+        (ev.code == BTN_TR || ev.code == BTN_TR2)) {
+        if (!is_serial)
+            emit_key(state, ev, ev.type,
+                     ev.code == BTN_TR ? BTN_TRIGGER_HAPPY1
+                                       : BTN_TRIGGER_HAPPY2,
+                     ev.value);
+        return;
+    } else if (phys == physr && ev.type == EV_KEY &&
+               (ev.code == BTN_TL || ev.code == BTN_TL2)) {
+        if (!is_serial)
+            emit_key(state, ev, ev.type,
+                     ev.code == BTN_TL ? BTN_TRIGGER_HAPPY3
+                                       : BTN_TRIGGER_HAPPY4,
+                     ev.value);
+        return;
+    }
+
+    if (mMapping->analog) {
+        /* Second remap the ZL and ZR buttons to analog trigger and map
+         * the DPAD to a HAT on android */
+        if (phys == physl && ev.type == EV_KEY && ev.code == BTN_TL2) {
+            emit_key(state, ev, EV_ABS, ABS_Z, ev.value);
+            return;
+        } else if (phys == physr && ev.type == EV_KEY && ev.code == BTN_TR2) {
+            emit_key(state, ev, EV_ABS, ABS_RZ, ev.value);
+            return;
+        }
+    }
+
+    if (ev.type == EV_KEY) {
+        switch (ev.code) {
+        case BTN_DPAD_UP:
+            emit_key(state, ev, EV_ABS, ABS_HAT0Y, -ev.value);
+            return;
+        case BTN_DPAD_DOWN:
+            emit_key(state, ev, EV_ABS, ABS_HAT0Y, ev.value);
+            return;
+        case BTN_DPAD_LEFT:
+            emit_key(state, ev, EV_ABS, ABS_HAT0X, -ev.value);
+            return;
+        case BTN_DPAD_RIGHT:
+            emit_key(state, ev, EV_ABS, ABS_HAT0X, ev.value);
+            return;
+        default:
+            break;
+        }
+    }
+    emit_key(state, ev, ev.type, ev.code, ev.value);
+}
+
 void virt_ctlr_combined::relay_events(std::shared_ptr<phys_ctlr> phys) {
+    TRACE_SCOPE("virt_ctlr_combined::relay_events");
     struct input_event ev;
-    struct libevdev *evdev = phys->get_evdev();
-    bool is_serial;
+    input_state &state = phys == physl ? left_state : right_state;
 
-    int ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+    PROFILE_BEGIN();
+    int ret = phys->next_event(LIBEVDEV_READ_FLAG_NORMAL, &ev);
+    PROFILE_MARK(Read);
     while (ret == LIBEVDEV_READ_STATUS_SYNC ||
            ret == LIBEVDEV_READ_STATUS_SUCCESS) {
         if (ret == LIBEVDEV_READ_STATUS_SYNC) {
             ALOGI("handle sync");
+            phys->get_stats()->add(ctlr_stats::SynDropped);
             while (ret == LIBEVDEV_READ_STATUS_SYNC) {
                 if (mMapping->rsmouse)
                     this->mouse->sync_event(ev);
 
-                libevdev_uinput_write_event(uidev, ev.type, ev.code, ev.value);
-                ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_SYNC, &ev);
+                state.record(ev);
+                phys->count_event(ev);
+                emit(ev.type, ev.code, ev.value);
+                ret = phys->next_event(LIBEVDEV_READ_FLAG_SYNC, &ev);
             }
         } else if (ret == LIBEVDEV_READ_STATUS_SUCCESS) {
-            is_serial = phys->is_serial_ctlr();
-
-            if (mMapping->rsmouse)
-                this->mouse->relay_mouse_event(ev);
-
-            // toggle rsmouse with screenshot button
-            if (ev.code == 309 && ev.value)
-                mMapping->rsmouse = !mMapping->rsmouse;
-
-            // EV_KEY mapping
-            pthread_mutex_lock(mapLock);
-            std::map<uint32_t, uint32_t>::iterator event =
-                mMapping->layout.find(ev.code);
-            if (event != mMapping->layout.end()) {
-                libevdev_uinput_write_event(uidev, EV_KEY, event->second,
-                                            ev.value);
-
-                pthread_mutex_unlock(mapLock);
-                ret =
-                    libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-                continue;
-            }
-            pthread_mutex_unlock(mapLock);
-
-            /* First remap the SL and SR buttons on each physical controller */
-            if (phys == physl && ev.type == EV_KEY &&
-                (ev.code == BTN_TR || ev.code == BTN_TR2)) {
-                if (!is_serial)
-                    libevdev_uinput_write_event(uidev, ev.type,
-                                                ev.code == BTN_TR
-                                                    ? BTN_TRIGGER_HAPPY1
-                                                    : BTN_TRIGGER_HAPPY2,
-                                                ev.value);
-                ret =
-                    libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-                continue;
-            } else if (phys == physr && ev.type == EV_KEY &&
-                       (ev.code == BTN_TL || ev.code == BTN_TL2)) {
-                if (!is_serial)
-                    libevdev_uinput_write_event(uidev, ev.type,
-                                                ev.code == BTN_TL
-                                                    ? BTN_TRIGGER_HAPPY3
-                                                    : BTN_TRIGGER_HAPPY4,
-                                                ev.value);
-                ret =
-                    libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-                continue;
-            }
+            state.record(ev);
+            phys->count_event(ev);
+            relay_event(phys, ev);
+            if (ev.type == EV_SYN && ev.code == SYN_REPORT)
+                record_relay_latency(ev);
+        }
+        ret = phys->next_event(LIBEVDEV_READ_FLAG_NORMAL, &ev);
+        PROFILE_MARK(Read);
+    }
+}
 
-            if (mMapping->analog) {
-                /* Second remap the ZL and ZR buttons to analog trigger and map
-                 * the DPAD to a HAT on android */
-                if (phys == physl && ev.type == EV_KEY && ev.code == BTN_TL2) {
-                    libevdev_uinput_write_event(uidev, EV_ABS, ABS_Z, ev.value);
-                    ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL,
-                                              &ev);
-                    continue;
-                } else if (phys == physr && ev.type == EV_KEY &&
-                           ev.code == BTN_TR2) {
-                    libevdev_uinput_write_event(uidev, EV_ABS, ABS_RZ,
-                                                ev.value);
-                    ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL,
-                                              &ev);
-                    continue;
-                }
-            }
+void virt_ctlr_combined::reconcile(std::shared_ptr<phys_ctlr> const &phys,
+                                   input_state &state,
+                                   struct libevdev *target) {
+    struct input_event ev = {};
+    bool changed = false;
+
+    // Release whatever the old source held that the new one doesn't
+    ev.type = EV_KEY;
+    ev.value = 0;
+    for (unsigned int code = 0; code < KEY_CNT; code++) {
+        if (!state.keys.test(code))
+            continue;
+        if (target && libevdev_get_event_value(target, EV_KEY, code))
+            continue;
+
+        state.keys.reset(code);
+        ev.code = code;
+        relay_event(phys, ev);
+        changed = true;
+    }
 
-            if (ev.type == EV_KEY) {
-                switch (ev.code) {
-                case BTN_DPAD_UP:
-                    libevdev_uinput_write_event(uidev, EV_ABS, ABS_HAT0Y,
-                                                -ev.value);
-                    ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL,
-                                              &ev);
-                    continue;
-                case BTN_DPAD_DOWN:
-                    libevdev_uinput_write_event(uidev, EV_ABS, ABS_HAT0Y,
-                                                ev.value);
-                    ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL,
-                                              &ev);
-                    continue;
-                case BTN_DPAD_LEFT:
-                    libevdev_uinput_write_event(uidev, EV_ABS, ABS_HAT0X,
-                                                -ev.value);
-                    ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL,
-                                              &ev);
-                    continue;
-                case BTN_DPAD_RIGHT:
-                    libevdev_uinput_write_event(uidev, EV_ABS, ABS_HAT0X,
-                                                ev.value);
-                    ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL,
-                                              &ev);
-                    continue;
-                default:
-                    break;
-                }
-            }
-            libevdev_uinput_write_event(uidev, ev.type, ev.code, ev.value);
-        }
-        ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+    // Move axes to where the new source sits, or centre them
+    ev.type = EV_ABS;
+    for (unsigned int code = 0; code < ABS_CNT; code++) {
+        if (!state.abs_seen.test(code))
+            continue;
+
+        int value = target ? libevdev_get_event_value(target, EV_ABS, code) : 0;
+        if (state.abs[code] == value)
+            continue;
+
+        state.abs[code] = value;
+        ev.code = code;
+        ev.value = value;
+        relay_event(phys, ev);
+        changed = true;
     }
+
+    if (changed)
+        emit(EV_SYN, SYN_REPORT, 0);
 }
 
 void virt_ctlr_combined::handle_uinput_event() {
@@ -140,81 +203,33 @@ void virt_ctlr_combined::handle_uinput_event() {
     int ret;
 
     while ((ret = read(get_uinput_fd(), &ev, sizeof(ev))) == sizeof(ev)) {
+        PROFILE_BEGIN_FF();
         switch (ev.type) {
-        case EV_FF: {
-            struct input_event redirectedl = ev;
-            struct input_event redirectedr = ev;
-
-            if (!rumble_effects.count(ev.code)) {
-                if (ev.code < FF_GAIN)
-                    ALOGE("ff_effect with id=%hu is not in map", ev.code);
-            } else {
-                redirectedl.code = rumble_effects[ev.code].first.id;
-                redirectedr.code = rumble_effects[ev.code].second.id;
-            }
-
+        case EV_FF:
             /* Just forward this FF event on to the actual devices */
-            if (physl) {
-                if (write(physl->get_fd(), &redirectedl, sizeof(redirectedl)) !=
-                    sizeof(redirectedl))
-                    ALOGE("Failed to forward EV_FF to physl");
-            }
-            if (physr) {
-                if (write(physr->get_fd(), &redirectedr, sizeof(redirectedr)) !=
-                    sizeof(redirectedr))
-                    ALOGE("Failed to forward EV_FF to physr");
-            }
+            rumble_effects.play(ev);
+            count(ctlr_stats::FfForwarded);
+            record(flight::kind::Ff, ev.type, ev.code, ev.value);
             break;
-        }
 
         case EV_UINPUT:
             switch (ev.code) {
             case UI_FF_UPLOAD: {
                 struct uinput_ff_upload upload = {0};
-                struct ff_effect effect = {0};
-                struct ff_effect effect_l = {0};
-                struct ff_effect effect_r = {0};
-                bool allocate_new_effect;
 
                 upload.request_id = ev.value;
                 if (ioctl(get_uinput_fd(), UI_BEGIN_FF_UPLOAD, &upload))
                     ALOGE("Failed to get uinput_ff_upload: %s",
                           strerror(errno));
 
-                effect = upload.effect;
-                /* Check if already allocated or it needs an update */
-                allocate_new_effect = !rumble_effects.count(effect.id);
-                if (allocate_new_effect)
-                    effect.id = -1;
-
                 /* upload the effect to both devices */
-                upload.retval = 0;
-                if (physl) {
-                    if (ioctl(physl->get_fd(), EVIOCSFF, &effect) == -1)
-                        upload.retval = errno;
-                    effect_l = effect;
-                }
-
-                if (physr) {
-                    /* reset effect */
-                    effect = upload.effect;
-                    /* Check if already allocated or it needs an update */
-                    if (allocate_new_effect)
-                        effect.id = -1;
-                    if (ioctl(physr->get_fd(), EVIOCSFF, &effect) == -1)
-                        upload.retval = errno;
-                    effect_r = effect;
-                }
-
-                upload.effect = effect;
+                upload.retval = rumble_effects.upload(upload.effect);
+                record(flight::kind::Ff, flight::TYPE_UINPUT,
+                       UI_FF_UPLOAD, upload.effect.id);
 
                 if (upload.retval)
                     ALOGE("UI_FF_UPLOAD failed: %s", strerror(upload.retval));
 
-                if (allocate_new_effect)
-                    rumble_effects[effect.id] =
-                        std::make_pair(effect_l, effect_r);
-
                 if (ioctl(get_uinput_fd(), UI_END_FF_UPLOAD, &upload))
                     ALOGE("Failed to end uinput_ff_upload: %s",
                           strerror(errno));
@@ -228,24 +243,9 @@ void virt_ctlr_combined::handle_uinput_event() {
                 if (ioctl(get_uinput_fd(), UI_BEGIN_FF_ERASE, &erase))
                     ALOGE("Failed to get uinput_ff_erase: %s", strerror(errno));
 
-                erase.retval = 0;
-                if (physl) {
-                    if (ioctl(physl->get_fd(), EVIOCRMFF, erase.effect_id) ==
-                        -1)
-                        erase.retval = errno;
-                }
-                if (physr) {
-                    if (ioctl(physr->get_fd(), EVIOCRMFF, erase.effect_id) ==
-                        -1)
-                        erase.retval = errno;
-                }
-
-                if (erase.retval)
-                    ALOGE("UI_FF_ERASE failed: %s", strerror(erase.retval));
-                else if (!rumble_effects.count(erase.effect_id))
-                    ALOGE("WARNING: effect_id not in rumble_effects map");
-                else
-                    rumble_effects.erase(erase.effect_id);
+                erase.retval = rumble_effects.erase(erase.effect_id);
+                record(flight::kind::Ff, flight::TYPE_UINPUT,
+                       UI_FF_ERASE, erase.effect_id);
 
                 if (ioctl(get_uinput_fd(), UI_END_FF_ERASE, &erase))
                     ALOGE("Failed to end uinput_ff_erase: %s", strerror(errno));
@@ -260,7 +260,7 @@ void virt_ctlr_combined::handle_uinput_event() {
 
         case EV_LED:
             if (ev.value == 0) {
-                libevdev_uinput_write_event(uidev, EV_LED, ev.code, !ev.value);
+                sink->write_event(EV_LED, ev.code, !ev.value);
             }
             break;
 
@@ -268,6 +268,7 @@ void virt_ctlr_combined::handle_uinput_event() {
             ALOGE("Unhandled uinput type=%hu", ev.type);
             break;
         }
+        PROFILE_MARK(Ff);
     }
     if (ret < 0 && errno != EAGAIN) {
         ALOGE("Failed reading uinput fd; ret=%s", strerror(errno));
@@ -276,136 +277,78 @@ void virt_ctlr_combined::handle_uinput_event() {
     }
 }
 
+// A pair that started off the rails keeps SL/SR even while a joy-con sits
+// on them and can't press them (relay_event drops them then), so moving
+// between BT and the rails never has to rebuild it; only the analog trigger
+// setting does
+virt_caps virt_ctlr_combined::wanted_caps() const {
+    return virt_caps::combined(mMapping->analog, sl_sr);
+}
+
+void virt_ctlr_combined::subscribe() {
+    subscriber = std::make_shared<epoll_subscriber>(
+        std::vector({get_uinput_fd()}),
+        [=](int event_fd) { handle_events(event_fd); });
+    epoll_manager.add_subscriber(subscriber);
+}
+
+void virt_ctlr_combined::replay_state(std::shared_ptr<phys_ctlr> const &phys) {
+    input_state &state = phys == physl ? left_state : right_state;
+    struct input_event ev = {};
+
+    // Bring a freshly made device up to what is currently held
+    ev.type = EV_KEY;
+    ev.value = 1;
+    for (unsigned int code = 0; code < KEY_CNT; code++) {
+        // replaying the screenshot button would flip rsmouse
+        if (!state.keys.test(code) || code == 309)
+            continue;
+        ev.code = code;
+        relay_event(phys, ev);
+    }
+
+    ev.type = EV_ABS;
+    for (unsigned int code = 0; code < ABS_CNT; code++) {
+        if (!state.abs_seen.test(code))
+            continue;
+        ev.code = code;
+        ev.value = state.abs[code];
+        relay_event(phys, ev);
+    }
+}
+
 // public
 virt_ctlr_combined::virt_ctlr_combined(std::shared_ptr<phys_ctlr> physl,
                                        std::shared_ptr<phys_ctlr> physr,
                                        epoll_mgr &epoll_manager,
+                                       const virt_device_factory &create,
                                        struct mapping *mMapping,
                                        pthread_mutex_t *mapLock)
     : physl(physl), physr(physr), epoll_manager(epoll_manager),
-      subscriber(nullptr), virt_evdev(nullptr), uidev(nullptr), uifd(-1),
-      rumble_effects(), left_mac(physl->get_mac_addr()),
-      right_mac(physr->get_mac_addr()) {
-    int ret;
-
+      create(create), subscriber(nullptr), rumble_effects(2),
+      sequencer(epoll_manager,
+                [this](uint8_t amplitude) {
+                    rumble_effects.set_rumble(amplitude * 257);
+                }),
+      left_mac(physl->get_mac_addr()),
+      right_mac(physr->get_mac_addr()), player(0),
+      sl_sr(!physl->is_serial_ctlr() && !physr->is_serial_ctlr()) {
+    TRACE_SCOPE("virt_ctlr_combined::virt_ctlr_combined");
     this->mMapping = mMapping;
     this->mapLock = mapLock;
 
-    this->mouse = new virt_mouse();
+    this->mouse = new virt_mouse(create);
+    rumble_effects.attach(0, physl->get_fd(), physl->get_rumble_queue());
+    rumble_effects.attach(1, physr->get_fd(), physr->get_rumble_queue());
 
-    uifd = open("/dev/uinput", O_RDWR);
-    if (uifd < 0) {
-        ALOGE("Failed to open uinput; errno=%d", errno);
+    dev.sink = nullptr;
+    if (!create(wanted_caps(), &dev)) {
+        ALOGE("Failed to create combined joy-con device");
         exit(1);
     }
+    sink = dev.sink;
 
-    // Create a virtual evdev on which the uinput will be based
-    virt_evdev = libevdev_new();
-    if (!virt_evdev) {
-        ALOGE("Failed to create virtual evdev");
-        exit(1);
-    }
-
-    libevdev_set_name(virt_evdev, "Nintendo Switch Combined Joy-Cons");
-
-    // Make sure that all of this configuration remains in sync with the
-    // hid-nintendo driver.
-    libevdev_enable_event_type(virt_evdev, EV_KEY);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_SELECT, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_Z, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_THUMBL, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_START, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_MODE, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_THUMBR, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_SOUTH, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_EAST, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_NORTH, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_WEST, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TL, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TR, NULL);
-    // Only define these if analog emulation is disabled via prop
-    if (!mMapping->analog) {
-        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TL2, NULL);
-        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TR2, NULL);
-    }
-
-    // Map the S triggers to these misc. buttons if not connected via serial.
-    if (!physl->is_serial_ctlr() && !physr->is_serial_ctlr()) {
-        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TRIGGER_HAPPY1,
-                                   NULL);
-        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TRIGGER_HAPPY2,
-                                   NULL);
-        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TRIGGER_HAPPY3,
-                                   NULL);
-        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TRIGGER_HAPPY4,
-                                   NULL);
-    }
-
-    struct input_absinfo absconfig = {0};
-    absconfig.minimum = -32767;
-    absconfig.maximum = 32767;
-    absconfig.fuzz = 250;
-    absconfig.flat = 500;
-    libevdev_enable_event_type(virt_evdev, EV_ABS);
-    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_X, &absconfig);
-    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_Y, &absconfig);
-    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_RX, &absconfig);
-    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_RY, &absconfig);
-
-    // Emulate analog triggers (if prop set) and HAT for android
-    struct input_absinfo absconfig_fake = {0};
-    absconfig_fake.minimum = 0;
-    absconfig_fake.maximum = 1;
-    absconfig_fake.fuzz = 0;
-    absconfig_fake.flat = 0;
-
-    if (mMapping->analog) {
-        libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_Z, &absconfig_fake);
-        libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_RZ, &absconfig_fake);
-    }
-
-    absconfig_fake.minimum = -1;
-
-    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_HAT0X, &absconfig_fake);
-    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_HAT0Y, &absconfig_fake);
-    libevdev_enable_event_type(virt_evdev, EV_FF);
-    libevdev_enable_event_code(virt_evdev, EV_FF, FF_RUMBLE, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_FF, FF_PERIODIC, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_FF, FF_SQUARE, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_FF, FF_TRIANGLE, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_FF, FF_SINE, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_FF, FF_GAIN, NULL);
-
-    // Set the product information to a left joy-con's product info (but with
-    // virtual bus type)
-    libevdev_set_id_vendor(virt_evdev, 0x057e);
-    libevdev_set_id_product(virt_evdev, 0x2008);
-    // Pretend this isn't virtual so games don't ignore it
-    // https://chromium.googlesource.com/chromiumos/platform2/+/master/vm_tools/sommelier/sommelier-gaming.cc#49
-    libevdev_set_id_bustype(virt_evdev, BUS_USB);
-    libevdev_set_id_version(virt_evdev, 0x0000);
-
-    // Enable LED events
-    libevdev_enable_event_type(virt_evdev, EV_LED);
-    libevdev_enable_event_code(virt_evdev, EV_LED, 0, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_LED, 1, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_LED, 2, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_LED, 3, NULL);
-
-    ret = libevdev_uinput_create_from_device(
-        virt_evdev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uidev);
-    if (ret) {
-        ALOGE("Failed to create libevdev_uinput; %d", ret);
-        exit(1);
-    }
-
-    int flags = fcntl(get_uinput_fd(), F_GETFL, 0);
-    fcntl(get_uinput_fd(), F_SETFL, flags | O_NONBLOCK);
-
-    subscriber = std::make_shared<epoll_subscriber>(
-        std::vector({get_uinput_fd()}),
-        [=](int event_fd) { handle_events(event_fd); });
-    epoll_manager.add_subscriber(subscriber);
+    subscribe();
 }
 
 virt_ctlr_combined::~virt_ctlr_combined() {
@@ -413,9 +356,7 @@ virt_ctlr_combined::~virt_ctlr_combined() {
 
     delete this->mouse;
 
-    libevdev_uinput_destroy(uidev);
-    close(uifd);
-    libevdev_free(virt_evdev);
+    destroy_virt_device(&dev);
 }
 
 void virt_ctlr_combined::handle_events(int fd) {
@@ -434,15 +375,14 @@ bool virt_ctlr_combined::contains_phys_ctlr(
     return physl == ctlr || physr == ctlr;
 }
 
-bool virt_ctlr_combined::contains_phys_ctlr(char const *devpath) const {
-    return (physl && physl->get_devpath() == devpath) ||
-           (physr && physr->get_devpath() == devpath);
+bool virt_ctlr_combined::contains_phys_ctlr(const ctlr_id &id) const {
+    return (physl && physl->get_id() == id) || (physr && physr->get_id() == id);
 }
 
 bool virt_ctlr_combined::contains_fd(int fd) const {
     return (physl && physl->get_fd() == fd) ||
            (physr && physr->get_fd() == fd) ||
-           libevdev_uinput_get_fd(uidev) == fd;
+           sink->get_fd() == fd;
 }
 
 std::vector<std::shared_ptr<phys_ctlr>> virt_ctlr_combined::get_phys_ctlrs() {
@@ -455,16 +395,20 @@ std::vector<std::shared_ptr<phys_ctlr>> virt_ctlr_combined::get_phys_ctlrs() {
 }
 
 int virt_ctlr_combined::get_uinput_fd() {
-    return libevdev_uinput_get_fd(uidev);
+    return sink->get_fd();
 }
 
 void virt_ctlr_combined::remove_phys_ctlr(
     const std::shared_ptr<phys_ctlr> phys) {
     if (phys == physl) {
         ALOGI("Removing left joy-con from virtual combined controller");
+        reconcile(physl, left_state, nullptr);
+        rumble_effects.detach(0);
         physl = nullptr;
     } else if (phys == physr) {
         ALOGI("Removing right joy-con from virtual combined controller");
+        reconcile(physr, right_state, nullptr);
+        rumble_effects.detach(1);
         physr = nullptr;
     } else {
         ALOGE("Attempted to remove non-existant controller from combined "
@@ -488,18 +432,81 @@ void virt_ctlr_combined::add_phys_ctlr(std::shared_ptr<phys_ctlr> phys) {
     }
 
     // re-add all the ff_effects to the reconnected controller
-    for (auto &kv : rumble_effects) {
-        struct ff_effect *effect;
+    rumble_effects.attach(phys == physl ? 0 : 1, phys->get_fd(),
+                          phys->get_rumble_queue());
+}
 
-        if (phys == physl)
-            effect = &kv.second.first;
-        else
-            effect = &kv.second.second;
-        effect->id = -1;
+bool virt_ctlr_combined::handover_phys_ctlr(
+    const std::shared_ptr<phys_ctlr> old,
+    std::shared_ptr<phys_ctlr> replacement) {
+    if (old == physl &&
+        replacement->get_model() == phys_ctlr::Model::Left_Joycon) {
+        ALOGI("Handing left joy-con over to new device");
+        reconcile(physl, left_state, replacement->get_evdev());
+        physl = replacement;
+    } else if (old == physr &&
+               replacement->get_model() == phys_ctlr::Model::Right_Joycon) {
+        ALOGI("Handing right joy-con over to new device");
+        reconcile(physr, right_state, replacement->get_evdev());
+        physr = replacement;
+    } else {
+        return false;
+    }
+
+    rumble_effects.attach(replacement == physl ? 0 : 1, replacement->get_fd(),
+                          replacement->get_rumble_queue());
+    return true;
+}
+
+void virt_ctlr_combined::reconfigure() {
+    virt_caps caps = wanted_caps();
+    struct virt_device fresh;
+    uint64_t start_ns = monotonic_ns();
+
+    if (caps == dev.caps)
+        return;
 
-        if (ioctl(phys->get_fd(), EVIOCSFF, effect) == -1)
-            ALOGE("Failed to reupload ff_ffect: %s", strerror(errno));
+    if (!create(caps, &fresh)) {
+        ALOGE("Failed to rebuild combined joy-con device; keeping old device");
+        return;
     }
+
+    // The effects belong to the clients' fds on the old device, which go
+    // away with it; they upload again to the new one and get new ids. Erase
+    // (and so stop) the old ones so they can't hold slots on the joy-cons
+    // or be played by whoever gets their ids next.
+    rumble_effects.erase_all();
+
+    epoll_manager.remove_subscriber(subscriber);
+    destroy_virt_device(&dev);
+    dev = fresh;
+    sink = dev.sink;
+    subscribe();
+
+    if (player)
+        set_player_leds_to_player(player);
+    if (physl)
+        replay_state(physl);
+    if (physr)
+        replay_state(physr);
+    emit(EV_SYN, SYN_REPORT, 0);
+
+    ALOGI("Rebuilt combined joy-con device in %" PRIu64 " us",
+          (monotonic_ns() - start_ns) / 1000);
+}
+
+bool virt_ctlr_combined::play_rumble_pattern(
+    const std::vector<rumble_step> &steps, int repeat) {
+    sequencer.play(steps, repeat);
+    return true;
+}
+
+void virt_ctlr_combined::handle_motion(const ctlr_id &id,
+                                       const imu_sample &sample) {
+    // Aim with the right joy-con, or the left one while it's alone
+    std::shared_ptr<phys_ctlr> aim = physr ? physr : physl;
+    if (aim && aim->get_id() == id)
+        mouse->relay_motion(sample);
 }
 
 enum phys_ctlr::Model virt_ctlr_combined::needs_model() {
@@ -514,15 +521,29 @@ enum phys_ctlr::Model virt_ctlr_combined::needs_model() {
 
 bool virt_ctlr_combined::no_ctlrs_left() { return !physl && !physr; }
 
-bool virt_ctlr_combined::mac_belongs(const std::string &mac) const {
-    return mac != "" && (mac == left_mac || mac == right_mac);
+bool virt_ctlr_combined::mac_belongs(uint64_t mac) const {
+    return mac && (mac == left_mac || mac == right_mac);
+}
+
+std::vector<uint64_t> virt_ctlr_combined::get_macs() const {
+    std::vector<uint64_t> macs;
+    if (left_mac)
+        macs.push_back(left_mac);
+    if (right_mac)
+        macs.push_back(right_mac);
+    return macs;
+}
+
+size_t virt_ctlr_combined::mem_footprint() const {
+    return sizeof(*this) + mouse->mem_footprint();
 }
 
 bool virt_ctlr_combined::set_player_led(int index, bool on) {
     if (index > 3)
         return false;
 
-    libevdev_uinput_write_event(uidev, EV_LED, index, on);
+    sink->write_event(EV_LED, index, on);
+    count(ctlr_stats::LedWrites);
     return true;
 }
 
@@ -535,13 +556,16 @@ bool virt_ctlr_combined::set_all_player_leds(bool on) {
 }
 
 bool virt_ctlr_combined::set_player_leds_to_player(int player) {
-    if (player < 1 || player > 4) {
+    uint8_t pattern = player_slots::led_pattern(player);
+
+    if (!pattern) {
         ALOGE("%d is not a valid player led value", player);
         return false;
     }
+    this->player = player;
 
-    for (int i = 0; i < player; i++) {
-        set_player_led(i, true);
+    for (int i = 0; i < 4; i++) {
+        set_player_led(i, pattern & (1 << i));
     }
     return true;
 }
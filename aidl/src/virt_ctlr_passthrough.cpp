@@ -1,4 +1,5 @@
 #include "virt_ctlr_passthrough.h"
+#include "trace.h"
 
 #include <iostream>
 #include <libevdev/libevdev-uinput.h>
@@ -12,6 +13,7 @@
 // public
 virt_ctlr_passthrough::virt_ctlr_passthrough(std::shared_ptr<phys_ctlr> phys)
     : phys(phys) {
+    TRACE_SCOPE("virt_ctlr_passthrough::virt_ctlr_passthrough");
 
     // Allow other processes to use the input now.
     if (fchmod(phys->get_fd(),
@@ -42,8 +44,8 @@ bool virt_ctlr_passthrough::contains_phys_ctlr(
     return phys == ctlr;
 }
 
-bool virt_ctlr_passthrough::contains_phys_ctlr(char const *devpath) const {
-    return phys->get_devpath() == devpath;
+bool virt_ctlr_passthrough::contains_phys_ctlr(const ctlr_id &id) const {
+    return phys->get_id() == id;
 }
 
 bool virt_ctlr_passthrough::contains_fd(int fd) const {
@@ -70,3 +72,10 @@ void virt_ctlr_passthrough::add_phys_ctlr(std::shared_ptr<phys_ctlr> phys) {
 enum phys_ctlr::Model virt_ctlr_passthrough::needs_model() {
     return phys_ctlr::Model::Unknown;
 }
+
+std::vector<uint64_t> virt_ctlr_passthrough::get_macs() const {
+    std::vector<uint64_t> macs;
+    if (phys->get_mac_addr())
+        macs.push_back(phys->get_mac_addr());
+    return macs;
+}
@@ -1,6 +1,11 @@
 #include "virt_ctlr_pro.h"
+#include "clock.h"
+#include "player_slots.h"
+#include "stage_profiler.h"
+#include "trace.h"
 
 #include <android-base/logging.h>
+#include <cinttypes>
 #include <cstring>
 #include <fcntl.h>
 #include <iostream>
@@ -14,89 +19,92 @@
 #include <vector>
 
 // private
+void virt_ctlr_pro::emit(unsigned int type, unsigned int code, int value) {
+    PROFILE_MARK(Transform);
+    sink->write_event(type, code, value);
+    PROFILE_MARK(Write);
+    record(flight::kind::Output, type, code, value);
+    count(ctlr_stats::EventsWritten);
+    if (type == EV_SYN && code == SYN_REPORT)
+        count(ctlr_stats::Frames);
+}
+
+void virt_ctlr_pro::relay_event(struct input_event const &ev) {
+    if (mMapping->rsmouse)
+        this->mouse->relay_mouse_event(ev);
+    this->mouse->relay_button_event(ev);
+    PROFILE_MARK(Mouse);
+
+    if (mMapping->analog) {
+        /* remap the ZL and ZR buttons to analog trigger on android */
+        if (ev.type == EV_KEY && ev.code == BTN_TL2) {
+            emit(EV_ABS, ABS_Z, ev.value);
+            return;
+        } else if (ev.type == EV_KEY && ev.code == BTN_TR2) {
+            emit(EV_ABS, ABS_RZ, ev.value);
+            return;
+        }
+    }
+
+    // toggle rsmouse with screenshot button
+    if (ev.code == 309 && ev.value)
+        mMapping->rsmouse = !mMapping->rsmouse;
+
+    // EV_KEY mapping
+    if (ev.type == EV_KEY) {
+        uint32_t code;
+        bool remapped = lookup_layout(mMapping, mapLock, ev.code, &code);
+        PROFILE_MARK(Layout);
+        if (remapped) {
+            emit(EV_KEY, code, ev.value);
+            return;
+        }
+
+        switch (ev.code) {
+        case BTN_DPAD_UP:
+            emit(EV_ABS, ABS_HAT0Y, -ev.value);
+            return;
+        case BTN_DPAD_DOWN:
+            emit(EV_ABS, ABS_HAT0Y, ev.value);
+            return;
+        case BTN_DPAD_LEFT:
+            emit(EV_ABS, ABS_HAT0X, -ev.value);
+            return;
+        case BTN_DPAD_RIGHT:
+            emit(EV_ABS, ABS_HAT0X, ev.value);
+            return;
+        default:
+            break;
+        }
+    }
+    emit(ev.type, ev.code, ev.value);
+}
+
 void virt_ctlr_pro::relay_events(std::shared_ptr<phys_ctlr> phys) {
+    TRACE_SCOPE("virt_ctlr_pro::relay_events");
     struct input_event ev;
-    struct libevdev *evdev = phys->get_evdev();
 
-    int ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+    PROFILE_BEGIN();
+    int ret = phys->next_event(LIBEVDEV_READ_FLAG_NORMAL, &ev);
+    PROFILE_MARK(Read);
     while (ret == LIBEVDEV_READ_STATUS_SYNC ||
            ret == LIBEVDEV_READ_STATUS_SUCCESS) {
         if (ret == LIBEVDEV_READ_STATUS_SYNC) {
             ALOGI("handle sync");
+            phys->get_stats()->add(ctlr_stats::SynDropped);
             while (ret == LIBEVDEV_READ_STATUS_SYNC) {
-                libevdev_uinput_write_event(uidev, ev.type, ev.code, ev.value);
-                ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_SYNC, &ev);
+                phys->count_event(ev);
+                emit(ev.type, ev.code, ev.value);
+                ret = phys->next_event(LIBEVDEV_READ_FLAG_SYNC, &ev);
             }
         } else if (ret == LIBEVDEV_READ_STATUS_SUCCESS) {
-            if (mMapping->rsmouse)
-                this->mouse->relay_mouse_event(ev);
-
-            if (mMapping->analog) {
-                /* remap the ZL and ZR buttons to analog trigger on android */
-                if (ev.type == EV_KEY && ev.code == BTN_TL2) {
-                    libevdev_uinput_write_event(uidev, EV_ABS, ABS_Z, ev.value);
-                    ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL,
-                                              &ev);
-                    continue;
-                } else if (ev.type == EV_KEY && ev.code == BTN_TR2) {
-                    libevdev_uinput_write_event(uidev, EV_ABS, ABS_RZ,
-                                                ev.value);
-                    ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL,
-                                              &ev);
-                    continue;
-                }
-            }
-
-            // toggle rsmouse with screenshot button
-            if (ev.code == 309 && ev.value)
-                mMapping->rsmouse = !mMapping->rsmouse;
-
-            // EV_KEY mapping
-            if (ev.type == EV_KEY) {
-                pthread_mutex_lock(mapLock);
-                std::map<uint32_t, uint32_t>::iterator event =
-                    mMapping->layout.find(ev.code);
-                if (event != mMapping->layout.end()) {
-                    libevdev_uinput_write_event(uidev, EV_KEY, event->second,
-                                                ev.value);
-                    ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL,
-                                              &ev);
-                    continue;
-                }
-                pthread_mutex_unlock(mapLock);
-
-                switch (ev.code) {
-                case BTN_DPAD_UP:
-                    libevdev_uinput_write_event(uidev, EV_ABS, ABS_HAT0Y,
-                                                -ev.value);
-                    ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL,
-                                              &ev);
-                    continue;
-                case BTN_DPAD_DOWN:
-                    libevdev_uinput_write_event(uidev, EV_ABS, ABS_HAT0Y,
-                                                ev.value);
-                    ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL,
-                                              &ev);
-                    continue;
-                case BTN_DPAD_LEFT:
-                    libevdev_uinput_write_event(uidev, EV_ABS, ABS_HAT0X,
-                                                -ev.value);
-                    ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL,
-                                              &ev);
-                    continue;
-                case BTN_DPAD_RIGHT:
-                    libevdev_uinput_write_event(uidev, EV_ABS, ABS_HAT0X,
-                                                ev.value);
-                    ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL,
-                                              &ev);
-                    continue;
-                default:
-                    break;
-                }
-            }
-            libevdev_uinput_write_event(uidev, ev.type, ev.code, ev.value);
+            phys->count_event(ev);
+            relay_event(ev);
+            if (ev.type == EV_SYN && ev.code == SYN_REPORT)
+                record_relay_latency(ev);
         }
-        ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+        ret = phys->next_event(LIBEVDEV_READ_FLAG_NORMAL, &ev);
+        PROFILE_MARK(Read);
     }
 }
 
@@ -105,55 +113,33 @@ void virt_ctlr_pro::handle_uinput_event() {
     int ret;
 
     while ((ret = read(get_uinput_fd(), &ev, sizeof(ev))) == sizeof(ev)) {
+        PROFILE_BEGIN_FF();
         switch (ev.type) {
-        case EV_FF: {
-            struct input_event redirected = ev;
-
-            if (!rumble_effects.count(ev.code)) {
-                if (ev.code < FF_GAIN)
-                    ALOGE("ff_effect with id=%d is not in map", ev.code);
-            } else {
-                redirected.code = rumble_effects[ev.code].id;
-            }
-
+        case EV_FF:
             /* Just forward this FF event on to the actual devices */
-            if (write(phys->get_fd(), &redirected, sizeof(redirected)) !=
-                sizeof(redirected))
-                ALOGE("Failed to forward EV_FF to phys");
+            rumble_effects.play(ev);
+            count(ctlr_stats::FfForwarded);
+            record(flight::kind::Ff, ev.type, ev.code, ev.value);
             break;
-        }
 
         case EV_UINPUT:
             switch (ev.code) {
             case UI_FF_UPLOAD: {
                 struct uinput_ff_upload upload = {0};
-                struct ff_effect effect = {0};
-                bool allocate_new_effect;
 
                 upload.request_id = ev.value;
                 if (ioctl(get_uinput_fd(), UI_BEGIN_FF_UPLOAD, &upload))
                     ALOGE("Failed to get uinput_ff_upload: %s",
                           strerror(errno));
 
-                effect = upload.effect;
-                /* Check if already allocated or it needs an update */
-                allocate_new_effect = !rumble_effects.count(effect.id);
-                if (allocate_new_effect)
-                    effect.id = -1;
-
                 /* upload the effect to the real device */
-                upload.retval = 0;
-                if (ioctl(phys->get_fd(), EVIOCSFF, &effect) == -1)
-                    upload.retval = errno;
-
-                upload.effect = effect;
+                upload.retval = rumble_effects.upload(upload.effect);
+                record(flight::kind::Ff, flight::TYPE_UINPUT,
+                       UI_FF_UPLOAD, upload.effect.id);
 
                 if (upload.retval)
                     ALOGE("UI_FF_UPLOAD failed: %s", strerror(upload.retval));
 
-                if (allocate_new_effect)
-                    rumble_effects[effect.id] = effect;
-
                 if (ioctl(get_uinput_fd(), UI_END_FF_UPLOAD, &upload))
                     ALOGE("Failed to end uinput_ff_upload: %s",
                           strerror(errno));
@@ -167,16 +153,9 @@ void virt_ctlr_pro::handle_uinput_event() {
                 if (ioctl(get_uinput_fd(), UI_BEGIN_FF_ERASE, &erase))
                     ALOGE("Failed to get uinput_ff_erase: %s", strerror(errno));
 
-                erase.retval = 0;
-                if (ioctl(phys->get_fd(), EVIOCRMFF, erase.effect_id) == -1)
-                    erase.retval = errno;
-
-                if (erase.retval)
-                    ALOGE("UI_FF_ERASE failed: %s", strerror(erase.retval));
-                else if (!rumble_effects.count(erase.effect_id))
-                    ALOGE("WARNING: effect_id not in rumble_effects map");
-                else
-                    rumble_effects.erase(erase.effect_id);
+                erase.retval = rumble_effects.erase(erase.effect_id);
+                record(flight::kind::Ff, flight::TYPE_UINPUT,
+                       UI_FF_ERASE, erase.effect_id);
 
                 if (ioctl(get_uinput_fd(), UI_END_FF_ERASE, &erase))
                     ALOGE("Failed to end uinput_ff_erase: %s", strerror(errno));
@@ -191,7 +170,7 @@ void virt_ctlr_pro::handle_uinput_event() {
 
         case EV_LED:
             if (ev.value == 0) {
-                libevdev_uinput_write_event(uidev, EV_LED, ev.code, !ev.value);
+                sink->write_event(EV_LED, ev.code, !ev.value);
             }
             break;
 
@@ -199,6 +178,7 @@ void virt_ctlr_pro::handle_uinput_event() {
             ALOGE("Unhandled uinput type=%hu", ev.type);
             break;
         }
+        PROFILE_MARK(Ff);
     }
     if (ret < 0 && errno != EAGAIN) {
         ALOGE("Failed reading uinput fd; ret=%s", strerror(errno));
@@ -207,133 +187,69 @@ void virt_ctlr_pro::handle_uinput_event() {
     }
 }
 
-// public
-virt_ctlr_pro::virt_ctlr_pro(std::shared_ptr<phys_ctlr> phys,
-                             epoll_mgr &epoll_manager, struct mapping *mMapping,
-                             pthread_mutex_t *mapLock)
-    : phys(phys), epoll_manager(epoll_manager), subscriber(nullptr),
-      virt_evdev(nullptr), uidev(nullptr), uifd(-1), rumble_effects(),
-      mac(phys->get_mac_addr()) {
-    int ret;
-
-    this->mMapping = mMapping;
-    this->mapLock = mapLock;
-
-    this->mouse = new virt_mouse();
-
-    uifd = open("/dev/uinput", O_RDWR);
-    if (uifd < 0) {
-        ALOGE("Failed to open uinput; errno=%d", errno);
-        exit(1);
-    }
+virt_caps virt_ctlr_pro::wanted_caps() const {
+    return virt_caps::pro(mMapping->analog,
+                          phys->get_model() != phys_ctlr::Model::Sio);
+}
 
-    // Create a virtual evdev on which the uinput will be based
-    virt_evdev = libevdev_new();
-    if (!virt_evdev) {
-        ALOGE("Failed to create virtual evdev");
-        exit(1);
-    }
+void virt_ctlr_pro::subscribe() {
+    subscriber = std::make_shared<epoll_subscriber>(
+        std::vector({get_uinput_fd()}),
+        [=](int event_fd) { handle_events(event_fd); });
+    epoll_manager.add_subscriber(subscriber);
+}
 
-    libevdev_set_name(virt_evdev, "Nintendo Switch Virtual Pro Controller");
-
-    // Make sure that all of this configuration remains in sync with the
-    // hid-nintendo driver.
-    libevdev_enable_event_type(virt_evdev, EV_KEY);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_SELECT, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_Z, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_THUMBL, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_START, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_MODE, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_THUMBR, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_SOUTH, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_EAST, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_NORTH, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_WEST, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_DPAD_UP, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_DPAD_DOWN, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_DPAD_LEFT, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_DPAD_RIGHT, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TL, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TR, NULL);
-    // Only define these if analog emulation is disabled via prop
-    if (!mMapping->analog) {
-        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TL2, NULL);
-        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TR2, NULL);
+void virt_ctlr_pro::replay_state() {
+    struct libevdev *evdev = phys->get_evdev();
+    struct input_event ev = {};
+
+    // Bring a freshly made device up to what is currently held
+    for (unsigned int type : {EV_KEY, EV_ABS}) {
+        unsigned int max = type == EV_KEY ? KEY_MAX : ABS_MAX;
+
+        ev.type = type;
+        for (unsigned int code = 0; code <= max; code++) {
+            if (!libevdev_has_event_code(evdev, type, code))
+                continue;
+
+            ev.code = code;
+            ev.value = libevdev_get_event_value(evdev, type, code);
+            // released keys are already released, and replaying the
+            // screenshot button would flip rsmouse
+            if (type == EV_KEY && (!ev.value || code == 309))
+                continue;
+            relay_event(ev);
+        }
     }
+    emit(EV_SYN, SYN_REPORT, 0);
+}
 
-    struct input_absinfo absconfig = {0};
-    absconfig.minimum = -32767;
-    absconfig.maximum = 32767;
-    absconfig.fuzz = 250;
-    absconfig.flat = 500;
-    libevdev_enable_event_type(virt_evdev, EV_ABS);
-    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_X, &absconfig);
-    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_Y, &absconfig);
-    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_RX, &absconfig);
-    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_RY, &absconfig);
-
-    // HAT for dpad
-    struct input_absinfo dpad_absconfig = {0};
-    dpad_absconfig.minimum = -1;
-    dpad_absconfig.maximum = 1;
-    dpad_absconfig.fuzz = 0;
-    dpad_absconfig.flat = 0;
-
-    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_HAT0X, &dpad_absconfig);
-    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_HAT0Y, &dpad_absconfig);
-
-    // Emulate analog triggers for android
-    if (mMapping->analog) {
-        struct input_absinfo absconfig_fake = {0};
-        absconfig_fake.minimum = 0;
-        absconfig_fake.maximum = 1;
-        absconfig_fake.fuzz = 0;
-        absconfig_fake.flat = 0;
-
-        libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_Z, &absconfig_fake);
-        libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_RZ, &absconfig_fake);
-    }
+// public
+virt_ctlr_pro::virt_ctlr_pro(std::shared_ptr<phys_ctlr> phys,
+                             epoll_mgr &epoll_manager,
+                             const virt_device_factory &create,
+                             struct mapping *mMapping, pthread_mutex_t *mapLock)
+    : phys(phys), epoll_manager(epoll_manager), create(create),
+      subscriber(nullptr), rumble_effects(1),
+      sequencer(epoll_manager,
+                [this](uint8_t amplitude) {
+                    rumble_effects.set_rumble(amplitude * 257);
+                }),
+      mac(phys->get_mac_addr()), player(0) {
+    TRACE_SCOPE("virt_ctlr_pro::virt_ctlr_pro");
+    this->mMapping = mMapping;
+    this->mapLock = mapLock;
 
-    libevdev_enable_event_type(virt_evdev, EV_FF);
-    libevdev_enable_event_code(virt_evdev, EV_FF, FF_RUMBLE, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_FF, FF_PERIODIC, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_FF, FF_SQUARE, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_FF, FF_TRIANGLE, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_FF, FF_SINE, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_FF, FF_GAIN, NULL);
-
-    // Set the product information to a non-existent product info (but with
-    // virtual bus type)
-    libevdev_set_id_vendor(virt_evdev, 0x057e);
-    libevdev_set_id_product(virt_evdev, 0x2008);
-    // Pretend this isn't virtual so games don't ignore it
-    // https://chromium.googlesource.com/chromiumos/platform2/+/master/vm_tools/sommelier/sommelier-gaming.cc#49
-    libevdev_set_id_bustype(virt_evdev, BUS_USB);
-    libevdev_set_id_version(virt_evdev, 0x0000);
-
-    if (phys->get_model() != phys_ctlr::Model::Sio) {
-        // Enable LED events
-        libevdev_enable_event_type(virt_evdev, EV_LED);
-        libevdev_enable_event_code(virt_evdev, EV_LED, 0, NULL);
-        libevdev_enable_event_code(virt_evdev, EV_LED, 1, NULL);
-        libevdev_enable_event_code(virt_evdev, EV_LED, 2, NULL);
-        libevdev_enable_event_code(virt_evdev, EV_LED, 3, NULL);
-    }
+    this->mouse = new virt_mouse(create);
+    rumble_effects.attach(0, phys->get_fd(), phys->get_rumble_queue());
 
-    ret = libevdev_uinput_create_from_device(
-        virt_evdev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uidev);
-    if (ret) {
-        ALOGE("Failed to create libevdev_uinput; %d", ret);
+    if (!create(wanted_caps(), &dev)) {
+        ALOGE("Failed to create virtual pro controller");
         exit(1);
     }
+    sink = dev.sink;
 
-    int flags = fcntl(get_uinput_fd(), F_GETFL, 0);
-    fcntl(get_uinput_fd(), F_SETFL, flags | O_NONBLOCK);
-
-    subscriber = std::make_shared<epoll_subscriber>(
-        std::vector({get_uinput_fd()}),
-        [=](int event_fd) { handle_events(event_fd); });
-    epoll_manager.add_subscriber(subscriber);
+    subscribe();
 }
 
 virt_ctlr_pro::~virt_ctlr_pro() {
@@ -341,9 +257,7 @@ virt_ctlr_pro::~virt_ctlr_pro() {
 
     delete this->mouse;
 
-    libevdev_uinput_destroy(uidev);
-    close(uifd);
-    libevdev_free(virt_evdev);
+    destroy_virt_device(&dev);
 }
 
 void virt_ctlr_pro::handle_events(int fd) {
@@ -360,12 +274,12 @@ bool virt_ctlr_pro::contains_phys_ctlr(
     return phys == ctlr;
 }
 
-bool virt_ctlr_pro::contains_phys_ctlr(char const *devpath) const {
-    return phys->get_devpath() == devpath;
+bool virt_ctlr_pro::contains_phys_ctlr(const ctlr_id &id) const {
+    return phys->get_id() == id;
 }
 
 bool virt_ctlr_pro::contains_fd(int fd) const {
-    return phys->get_fd() == fd || libevdev_uinput_get_fd(uidev) == fd;
+    return phys->get_fd() == fd || sink->get_fd() == fd;
 }
 
 std::vector<std::shared_ptr<phys_ctlr>> virt_ctlr_pro::get_phys_ctlrs() {
@@ -374,16 +288,58 @@ std::vector<std::shared_ptr<phys_ctlr>> virt_ctlr_pro::get_phys_ctlrs() {
     return ctlrs;
 }
 
-int virt_ctlr_pro::get_uinput_fd() { return libevdev_uinput_get_fd(uidev); }
+int virt_ctlr_pro::get_uinput_fd() { return sink->get_fd(); }
 
+// A virtual procon lives and dies with its one controller; ctlr_mgr tears it
+// down on unplug and pairs a replugged one afresh, so these never get called
 void virt_ctlr_pro::remove_phys_ctlr(const std::shared_ptr<phys_ctlr> phys) {
-    ALOGE("Don't support removing controllers to virtual procon");
-    exit(EXIT_FAILURE);
+    ALOGE("Don't support removing controllers from virtual procon");
 }
 
 void virt_ctlr_pro::add_phys_ctlr(std::shared_ptr<phys_ctlr> phys) {
     ALOGE("Don't support re-adding controllers to virtual procon");
-    exit(EXIT_FAILURE);
+}
+
+void virt_ctlr_pro::reconfigure() {
+    virt_caps caps = wanted_caps();
+    struct virt_device fresh;
+    uint64_t start_ns = monotonic_ns();
+
+    if (caps == dev.caps)
+        return;
+
+    if (!create(caps, &fresh)) {
+        ALOGE("Failed to rebuild virtual pro controller; keeping old device");
+        return;
+    }
+
+    // The effects belong to the clients' fds on the old device; they upload
+    // again to the new one. Erase (and so stop) the old ones.
+    rumble_effects.erase_all();
+
+    epoll_manager.remove_subscriber(subscriber);
+    destroy_virt_device(&dev);
+    dev = fresh;
+    sink = dev.sink;
+    subscribe();
+
+    if (player)
+        set_player_leds_to_player(player);
+    replay_state();
+
+    ALOGI("Rebuilt virtual pro controller in %" PRIu64 " us",
+          (monotonic_ns() - start_ns) / 1000);
+}
+
+bool virt_ctlr_pro::play_rumble_pattern(
+    const std::vector<rumble_step> &steps, int repeat) {
+    sequencer.play(steps, repeat);
+    return true;
+}
+
+void virt_ctlr_pro::handle_motion(const ctlr_id &id,
+                                  const imu_sample &sample) {
+    mouse->relay_motion(sample);
 }
 
 enum phys_ctlr::Model virt_ctlr_pro::needs_model() {
@@ -391,11 +347,23 @@ enum phys_ctlr::Model virt_ctlr_pro::needs_model() {
     return model;
 }
 
+std::vector<uint64_t> virt_ctlr_pro::get_macs() const {
+    std::vector<uint64_t> macs;
+    if (mac)
+        macs.push_back(mac);
+    return macs;
+}
+
+size_t virt_ctlr_pro::mem_footprint() const {
+    return sizeof(*this) + mouse->mem_footprint();
+}
+
 bool virt_ctlr_pro::set_player_led(int index, bool on) {
     if (index > 3)
         return false;
 
-    libevdev_uinput_write_event(uidev, EV_LED, index, on);
+    sink->write_event(EV_LED, index, on);
+    count(ctlr_stats::LedWrites);
     return true;
 }
 
@@ -408,13 +376,16 @@ bool virt_ctlr_pro::set_all_player_leds(bool on) {
 }
 
 bool virt_ctlr_pro::set_player_leds_to_player(int player) {
-    if (player < 1 || player > 4) {
+    uint8_t pattern = player_slots::led_pattern(player);
+
+    if (!pattern) {
         ALOGE("%d is not a valid player led value", player);
         return false;
     }
+    this->player = player;
 
-    for (int i = 0; i < player; i++) {
-        set_player_led(i, true);
+    for (int i = 0; i < 4; i++) {
+        set_player_led(i, pattern & (1 << i));
     }
     return true;
 }
@@ -0,0 +1,235 @@
+#include "virt_device.h"
+
+#include <fcntl.h>
+#include <linux/uinput.h>
+#include <utils/Log.h>
+
+static void enable_gamepad_caps(struct libevdev *virt_evdev,
+                                const virt_caps &caps) {
+    // Make sure that all of this configuration remains in sync with the
+    // hid-nintendo driver.
+    libevdev_enable_event_type(virt_evdev, EV_KEY);
+    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_SELECT, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_Z, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_THUMBL, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_START, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_MODE, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_THUMBR, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_SOUTH, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_EAST, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_NORTH, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_WEST, NULL);
+    if (caps.kind == virt_caps::Kind::Pro) {
+        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_DPAD_UP, NULL);
+        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_DPAD_DOWN, NULL);
+        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_DPAD_LEFT, NULL);
+        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_DPAD_RIGHT, NULL);
+    }
+    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TL, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TR, NULL);
+    // Only define these if analog emulation is disabled via prop
+    if (!caps.analog) {
+        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TL2, NULL);
+        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TR2, NULL);
+    }
+
+    // Map the S triggers to these misc. buttons if not connected via serial.
+    if (caps.sl_sr) {
+        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TRIGGER_HAPPY1,
+                                   NULL);
+        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TRIGGER_HAPPY2,
+                                   NULL);
+        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TRIGGER_HAPPY3,
+                                   NULL);
+        libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_TRIGGER_HAPPY4,
+                                   NULL);
+    }
+
+    struct input_absinfo absconfig = {0};
+    absconfig.minimum = -32767;
+    absconfig.maximum = 32767;
+    absconfig.fuzz = 250;
+    absconfig.flat = 500;
+    libevdev_enable_event_type(virt_evdev, EV_ABS);
+    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_X, &absconfig);
+    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_Y, &absconfig);
+    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_RX, &absconfig);
+    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_RY, &absconfig);
+
+    // Emulate analog triggers (if prop set) and HAT for android
+    struct input_absinfo absconfig_fake = {0};
+    absconfig_fake.minimum = 0;
+    absconfig_fake.maximum = 1;
+    absconfig_fake.fuzz = 0;
+    absconfig_fake.flat = 0;
+
+    if (caps.analog) {
+        libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_Z, &absconfig_fake);
+        libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_RZ, &absconfig_fake);
+    }
+
+    absconfig_fake.minimum = -1;
+
+    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_HAT0X, &absconfig_fake);
+    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_HAT0Y, &absconfig_fake);
+
+    libevdev_enable_event_type(virt_evdev, EV_FF);
+    libevdev_enable_event_code(virt_evdev, EV_FF, FF_RUMBLE, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_FF, FF_PERIODIC, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_FF, FF_SQUARE, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_FF, FF_TRIANGLE, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_FF, FF_SINE, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_FF, FF_GAIN, NULL);
+
+    // Set the product information to a non-existent product info (but with
+    // virtual bus type)
+    libevdev_set_id_vendor(virt_evdev, 0x057e);
+    libevdev_set_id_product(virt_evdev, 0x2008);
+    // Pretend this isn't virtual so games don't ignore it
+    // https://chromium.googlesource.com/chromiumos/platform2/+/master/vm_tools/sommelier/sommelier-gaming.cc#49
+    libevdev_set_id_bustype(virt_evdev, BUS_USB);
+    libevdev_set_id_version(virt_evdev, 0x0000);
+
+    if (caps.leds) {
+        // Enable LED events
+        libevdev_enable_event_type(virt_evdev, EV_LED);
+        libevdev_enable_event_code(virt_evdev, EV_LED, 0, NULL);
+        libevdev_enable_event_code(virt_evdev, EV_LED, 1, NULL);
+        libevdev_enable_event_code(virt_evdev, EV_LED, 2, NULL);
+        libevdev_enable_event_code(virt_evdev, EV_LED, 3, NULL);
+    }
+}
+
+static void enable_mouse_caps(struct libevdev *virt_evdev) {
+    libevdev_enable_property(virt_evdev, INPUT_PROP_POINTER);
+
+    libevdev_enable_event_type(virt_evdev, EV_KEY);
+    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_MOUSE, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_LEFT, NULL);
+
+    libevdev_enable_event_type(virt_evdev, EV_REL);
+    libevdev_enable_event_code(virt_evdev, EV_REL, REL_X, NULL);
+    libevdev_enable_event_code(virt_evdev, EV_REL, REL_Y, NULL);
+
+    libevdev_set_id_vendor(virt_evdev, 0x057e);
+    libevdev_set_id_product(virt_evdev, 0x2010);
+
+    libevdev_set_id_bustype(virt_evdev, BUS_USB);
+    libevdev_set_id_version(virt_evdev, 0x0000);
+}
+
+static void enable_imu_caps(struct libevdev *virt_evdev,
+                            const virt_caps &caps) {
+    struct input_absinfo accel = {0};
+    struct input_absinfo gyro = {0};
+
+    libevdev_enable_property(virt_evdev, INPUT_PROP_ACCELEROMETER);
+
+    accel.minimum = -32767;
+    accel.maximum = 32767;
+    accel.fuzz = 10;
+    accel.resolution = IMU_ACCEL_RES_PER_G;
+    gyro.minimum = -32767000;
+    gyro.maximum = 32767000;
+    gyro.fuzz = 10;
+    gyro.resolution = IMU_GYRO_RES_PER_DPS;
+    libevdev_enable_event_type(virt_evdev, EV_ABS);
+    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_X, &accel);
+    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_Y, &accel);
+    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_Z, &accel);
+    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_RX, &gyro);
+    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_RY, &gyro);
+    libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_RZ, &gyro);
+
+    if (caps.fused) {
+        struct input_absinfo angle = {0};
+        angle.minimum = -18000;
+        angle.maximum = 18000;
+        angle.resolution = 100;
+        libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_TILT_X, &angle);
+        libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_TILT_Y, &angle);
+        libevdev_enable_event_code(virt_evdev, EV_ABS, ABS_WHEEL, &angle);
+    }
+
+    libevdev_enable_event_type(virt_evdev, EV_MSC);
+    libevdev_enable_event_code(virt_evdev, EV_MSC, MSC_TIMESTAMP, NULL);
+
+    libevdev_set_id_vendor(virt_evdev, 0x057e);
+    libevdev_set_id_product(virt_evdev, 0x2011);
+
+    libevdev_set_id_bustype(virt_evdev, BUS_USB);
+    libevdev_set_id_version(virt_evdev, 0x0000);
+}
+
+bool create_virt_device(const virt_caps &caps, struct virt_device *dev) {
+    int ret;
+
+    dev->caps = caps;
+    dev->uidev = nullptr;
+    dev->sink = nullptr;
+    dev->pooled = false;
+
+    // Create a virtual evdev on which the uinput will be based
+    dev->evdev = libevdev_new();
+    if (!dev->evdev) {
+        ALOGE("Failed to create virtual evdev");
+        return false;
+    }
+
+    switch (caps.kind) {
+    case virt_caps::Kind::Pro:
+        libevdev_set_name(dev->evdev, "Nintendo Switch Virtual Pro Controller");
+        enable_gamepad_caps(dev->evdev, caps);
+        break;
+    case virt_caps::Kind::Combined:
+        libevdev_set_name(dev->evdev, "Nintendo Switch Combined Joy-Cons");
+        enable_gamepad_caps(dev->evdev, caps);
+        break;
+    case virt_caps::Kind::Mouse:
+        libevdev_set_name(dev->evdev, "Joycond Virtual Mouse");
+        enable_mouse_caps(dev->evdev);
+        break;
+    case virt_caps::Kind::Imu:
+        if (caps.host == virt_caps::Host::Left_Joycon)
+            libevdev_set_name(dev->evdev,
+                              "Nintendo Switch Combined Joy-Cons IMU (L)");
+        else if (caps.host == virt_caps::Host::Right_Joycon)
+            libevdev_set_name(dev->evdev,
+                              "Nintendo Switch Combined Joy-Cons IMU (R)");
+        else
+            libevdev_set_name(dev->evdev,
+                              "Nintendo Switch Virtual Pro Controller IMU");
+        enable_imu_caps(dev->evdev, caps);
+        break;
+    }
+
+    ret = libevdev_uinput_create_from_device(
+        dev->evdev, LIBEVDEV_UINPUT_OPEN_MANAGED, &dev->uidev);
+    if (ret) {
+        ALOGE("Failed to create libevdev_uinput; %d", ret);
+        libevdev_free(dev->evdev);
+        dev->evdev = nullptr;
+        return false;
+    }
+
+    dev->sink = new uinput_sink(dev->uidev);
+
+    if (caps.is_gamepad()) {
+        int fd = libevdev_uinput_get_fd(dev->uidev);
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+
+    return true;
+}
+
+void destroy_virt_device(struct virt_device *dev) {
+    delete dev->sink;
+    if (dev->uidev)
+        libevdev_uinput_destroy(dev->uidev);
+    if (dev->evdev)
+        libevdev_free(dev->evdev);
+    dev->uidev = nullptr;
+    dev->evdev = nullptr;
+    dev->sink = nullptr;
+}
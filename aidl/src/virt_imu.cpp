@@ -0,0 +1,162 @@
+#include "virt_imu.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+// private
+struct imu_sample virt_imu::make_sample(const struct input_event &syn) {
+    struct imu_sample sample;
+
+    // MSC_TIMESTAMP is a wrapping 32-bit microsecond counter; fall back to
+    // the event time if the driver doesn't send one
+    if (has_timestamp)
+        timestamp_us += uint32_t(timestamp - uint32_t(timestamp_us));
+    else
+        timestamp_us = syn.input_event_sec * 1000000ull + syn.input_event_usec;
+
+    sample.timestamp_us = timestamp_us;
+    for (int i = 0; i < 3; i++) {
+        sample.accel[i] = values[i] * scale[i];
+        sample.gyro[i] = values[3 + i] * scale[3 + i];
+    }
+    return sample;
+}
+
+void virt_imu::handle_event(const struct input_event &ev) {
+    switch (ev.type) {
+    case EV_ABS:
+        if (ev.code >= ABS_X && ev.code <= ABS_Z) {
+            values[ev.code - ABS_X] = ev.value;
+            dirty |= 1u << (ev.code - ABS_X);
+        } else if (ev.code >= ABS_RX && ev.code <= ABS_RZ) {
+            values[3 + ev.code - ABS_RX] = ev.value;
+            dirty |= 1u << (3 + ev.code - ABS_RX);
+        }
+        break;
+    case EV_MSC:
+        if (ev.code == MSC_TIMESTAMP) {
+            timestamp = ev.value;
+            timestamp_dirty = true;
+            has_timestamp = true;
+        }
+        break;
+    case EV_SYN:
+        if (ev.code != SYN_REPORT)
+            break;
+        if (listener || fuse) {
+            struct imu_sample sample = make_sample(ev);
+            if (listener)
+                listener(sample);
+            if (fuse)
+                fusion.add(sample);
+        }
+        if (++frames < decimation)
+            break;
+        frames = 0;
+
+        if (fuse) {
+            float euler[3];
+
+            fusion.flush();
+            fusion.get_euler(euler);
+            dev.sink->write_event(EV_ABS, ABS_TILT_X, int(euler[0] * 100));
+            dev.sink->write_event(EV_ABS, ABS_TILT_Y, int(euler[1] * 100));
+            dev.sink->write_event(EV_ABS, ABS_WHEEL, int(euler[2] * 100));
+        }
+
+        for (int i = 0; i < AXES; i++) {
+            if (!(dirty & (1u << i)))
+                continue;
+            int code = i < 3 ? ABS_X + i : ABS_RX + i - 3;
+            dev.sink->write_event(EV_ABS, code, int(values[i] * rescale[i]));
+        }
+        if (timestamp_dirty)
+            dev.sink->write_event(EV_MSC, MSC_TIMESTAMP, timestamp);
+        dev.sink->write_event(EV_SYN, SYN_REPORT, 0);
+        dirty = 0;
+        timestamp_dirty = false;
+        break;
+    }
+}
+
+void virt_imu::handle_events() {
+    struct input_event ev;
+
+    int ret = libevdev_next_event(src, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+    while (ret == LIBEVDEV_READ_STATUS_SYNC ||
+           ret == LIBEVDEV_READ_STATUS_SUCCESS) {
+        if (ret == LIBEVDEV_READ_STATUS_SYNC) {
+            while (ret == LIBEVDEV_READ_STATUS_SYNC) {
+                handle_event(ev);
+                ret = libevdev_next_event(src, LIBEVDEV_READ_FLAG_SYNC, &ev);
+            }
+        } else {
+            handle_event(ev);
+        }
+        ret = libevdev_next_event(src, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+    }
+}
+
+// public
+virt_imu::virt_imu(epoll_mgr &epoll_manager, const virt_device_factory &create,
+                   const std::string &devnode, const virt_caps &caps,
+                   unsigned int decimation)
+    : epoll_manager(epoll_manager), subscriber(nullptr), fd(-1), src(nullptr),
+      decimation(decimation ? decimation : 1), frames(0), values(), dirty(0),
+      timestamp(0), timestamp_dirty(false), has_timestamp(false), scale(),
+      rescale(), timestamp_us(0), listener(nullptr), fuse(caps.fused),
+      fusion() {
+    dev.sink = nullptr;
+
+    fd = open(devnode.c_str(), O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        ALOGE("Failed to open IMU %s; errno=%d", devnode.c_str(), errno);
+        return;
+    }
+    if (libevdev_new_from_fd(fd, &src)) {
+        ALOGE("Failed to create evdev from IMU %s", devnode.c_str());
+        return;
+    }
+    libevdev_grab(src, LIBEVDEV_GRAB);
+
+    for (int i = 0; i < AXES; i++) {
+        int code = i < 3 ? ABS_X + i : ABS_RX + i - 3;
+        int res = i < 3 ? IMU_ACCEL_RES_PER_G : IMU_GYRO_RES_PER_DPS;
+        const struct input_absinfo *abs = libevdev_get_abs_info(src, code);
+
+        rescale[i] = 1.0;
+        if (!abs)
+            continue;
+        values[i] = abs->value;
+        scale[i] = 1.0f / (abs->resolution ? abs->resolution : 1);
+        if (abs->resolution && abs->resolution != res)
+            rescale[i] = double(res) / abs->resolution;
+    }
+
+    if (!create(caps, &dev)) {
+        ALOGE("Failed to create virtual IMU");
+        dev.sink = nullptr;
+        return;
+    }
+
+    subscriber = std::make_shared<epoll_subscriber>(
+        std::vector({fd}), [=](int event_fd) { handle_events(); });
+    epoll_manager.add_subscriber(subscriber);
+
+    ALOGI("Relaying IMU %s every %u reports", devnode.c_str(),
+          this->decimation);
+}
+
+virt_imu::~virt_imu() {
+    if (subscriber)
+        epoll_manager.remove_subscriber(subscriber);
+    if (dev.sink)
+        destroy_virt_device(&dev);
+    if (src)
+        libevdev_free(src);
+    if (fd >= 0)
+        close(fd);
+}
@@ -19,39 +19,16 @@
 using android::base::GetProperty;
 using android::base::GetUintProperty;
 
-virt_mouse::virt_mouse() {
-    int ret;
-
-    // Create a virtual evdev on which the uinput will be based
-    virt_evdev = libevdev_new();
-    if (!virt_evdev) {
-        ALOGE("Failed to create virtual evdev");
-        exit(1);
-    }
-
-    libevdev_set_name(virt_evdev, "Joycond Virtual Mouse");
-    libevdev_enable_property(virt_evdev, INPUT_PROP_POINTER);
-
-    libevdev_enable_event_type(virt_evdev, EV_KEY);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_MOUSE, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_KEY, BTN_LEFT, NULL);
-
-    libevdev_enable_event_type(virt_evdev, EV_REL);
-    libevdev_enable_event_code(virt_evdev, EV_REL, REL_X, NULL);
-    libevdev_enable_event_code(virt_evdev, EV_REL, REL_Y, NULL);
-
-    libevdev_set_id_vendor(virt_evdev, 0x057e);
-    libevdev_set_id_product(virt_evdev, 0x2010);
-
-    libevdev_set_id_bustype(virt_evdev, BUS_USB);
-    libevdev_set_id_version(virt_evdev, 0x0000);
-
-    ret = libevdev_uinput_create_from_device(
-        virt_evdev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uidev);
-    if (ret) {
-        ALOGE("Failed to create libevdev_uinput; %d", ret);
+virt_mouse::virt_mouse(const virt_device_factory &create)
+    : gyro(std::stof(GetProperty(PROP_GYRO_SENSE_X, DEFAULT_GYRO_SENSE_X)),
+           std::stof(GetProperty(PROP_GYRO_SENSE_Y, DEFAULT_GYRO_SENSE_Y))),
+      gyro_enabled(false), thumbl(false), thumbr(false) {
+    pthread_mutex_init(&write_lock, NULL);
+    if (!create(virt_caps::mouse(), &dev)) {
+        ALOGE("Failed to create virtual mouse");
         exit(1);
     }
+    sink = dev.sink;
 
     ALOGI("Successfully registered virtual mouse vid: 0x057e pid: 0x2010");
 
@@ -69,12 +46,25 @@ virt_mouse::~virt_mouse() {
     ready.store(false);
     pthread_join(mouseThread, NULL);
 
-    libevdev_uinput_destroy(uidev);
-    libevdev_free(virt_evdev);
+    destroy_virt_device(&dev);
+    pthread_mutex_destroy(&write_lock);
+}
+
+size_t virt_mouse::mem_footprint() const {
+    pthread_attr_t attr;
+    size_t stack_size = 0;
+
+    if (!pthread_getattr_np(mouseThread, &attr)) {
+        pthread_attr_getstacksize(&attr, &stack_size);
+        pthread_attr_destroy(&attr);
+    }
+    return sizeof(*this) + stack_size;
 }
 
 void virt_mouse::sync_event(struct input_event ev) {
-    libevdev_uinput_write_event(uidev, ev.type, ev.code, ev.value);
+    pthread_mutex_lock(&write_lock);
+    sink->write_event(ev.type, ev.code, ev.value);
+    pthread_mutex_unlock(&write_lock);
 
     return;
 }
@@ -90,12 +80,16 @@ void virt_mouse::relay_mouse_event(struct input_event ev) {
                       std::stof(GetProperty(PROP_SENSE_Y, DEFAULT_SENSE_Y)));
         break;
     case BTN_TR2:
-        libevdev_uinput_write_event(uidev, EV_KEY, BTN_MOUSE, ev.value);
-        libevdev_uinput_write_event(uidev, EV_SYN, SYN_REPORT, 0);
+        pthread_mutex_lock(&write_lock);
+        sink->write_event(EV_KEY, BTN_MOUSE, ev.value);
+        sink->write_event(EV_SYN, SYN_REPORT, 0);
+        pthread_mutex_unlock(&write_lock);
         break;
     case BTN_TL2:
-        libevdev_uinput_write_event(uidev, EV_KEY, BTN_LEFT, ev.value);
-        libevdev_uinput_write_event(uidev, EV_SYN, SYN_REPORT, 0);
+        pthread_mutex_lock(&write_lock);
+        sink->write_event(EV_KEY, BTN_LEFT, ev.value);
+        sink->write_event(EV_SYN, SYN_REPORT, 0);
+        pthread_mutex_unlock(&write_lock);
         break;
     default:
         /* Do nothing */
@@ -105,31 +99,65 @@ void virt_mouse::relay_mouse_event(struct input_event ev) {
     return;
 }
 
-void *virt_mouse::__mouseLoop(void *args) {
-    float _sense_x;
-    float _sense_y;
+void virt_mouse::relay_button_event(struct input_event const &ev) {
+    if (ev.type != EV_KEY)
+        return;
 
+    if (ev.code == BTN_THUMBL)
+        thumbl = ev.value;
+    else if (ev.code == BTN_THUMBR)
+        thumbr = ev.value;
+    else
+        return;
+
+    // Toggle on the press that completes the chord, not on key repeats
+    if (ev.value == 1 && thumbl && thumbr) {
+        gyro_enabled = !gyro_enabled;
+        gyro.reset();
+        ALOGI("Gyro aiming %s", gyro_enabled ? "enabled" : "disabled");
+    }
+}
+
+void virt_mouse::relay_motion(const imu_sample &sample) {
+    int dx, dy;
+
+    // Keep learning the bias even while disabled so it's ready when enabled
+    if (!gyro.update(sample, &dx, &dy) || !gyro_enabled)
+        return;
+
+    pthread_mutex_lock(&write_lock);
+    sink->write_event(EV_REL, REL_X, dx);
+    sink->write_event(EV_REL, REL_Y, dy);
+    sink->write_event(EV_SYN, SYN_REPORT, 0);
+    pthread_mutex_unlock(&write_lock);
+}
+
+void virt_mouse::tick() {
+    // reduce atomic blocks and ensure consistent values for process
+    float _sense_x = sense_x.load();
+    float _sense_y = sense_y.load();
+
+    // write value if x or y is past dead zone else 0
+    if (std::fabs(_sense_x) <=
+            std::stof(GetProperty(PROP_DEAD_X, DEFAULT_DEAD_X)) &&
+        std::fabs(_sense_y) <=
+            std::stof(GetProperty(PROP_DEAD_Y, DEFAULT_DEAD_Y))) {
+        _sense_x = 0;
+        _sense_y = 0;
+    }
+
+    pthread_mutex_lock(&write_lock);
+    sink->write_event(EV_REL, REL_X, _sense_x);
+    sink->write_event(EV_REL, REL_Y, _sense_y);
+    sink->write_event(EV_SYN, SYN_REPORT, 0);
+    pthread_mutex_unlock(&write_lock);
+}
+
+void *virt_mouse::__mouseLoop(void *args) {
     virt_mouse *const self = static_cast<virt_mouse *>(args);
 
     while (self->ready.load()) {
-        // reduce atomic blocks and ensure consistent values for process
-        _sense_x = self->sense_x.load();
-        _sense_y = self->sense_y.load();
-
-        // write value if x or y is past dead zone else 0
-        if (std::fabsf(_sense_x) >
-                std::stof(GetProperty(PROP_DEAD_X, DEFAULT_DEAD_X)) ||
-            std::fabsf(_sense_y) >
-                std::stof(GetProperty(PROP_DEAD_Y, DEFAULT_DEAD_Y))) {
-            libevdev_uinput_write_event(self->uidev, EV_REL, REL_X, _sense_x);
-            libevdev_uinput_write_event(self->uidev, EV_REL, REL_Y, _sense_y);
-        } else {
-            libevdev_uinput_write_event(self->uidev, EV_REL, REL_X, 0);
-            libevdev_uinput_write_event(self->uidev, EV_REL, REL_Y, 0);
-        }
-
-        libevdev_uinput_write_event(self->uidev, EV_SYN, SYN_REPORT, 0);
-
+        self->tick();
         usleep(GetUintProperty(PROP_POLL, uint32_t(DEFAULT_POLL)));
     }
 
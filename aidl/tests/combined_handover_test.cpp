@@ -0,0 +1,239 @@
+// A combined joy-con pair keeps its virtual device when one half moves from
+// Bluetooth onto the rails, and nothing the BT half held stays stuck, even
+// when the layout changed since it was pressed.
+
+#include <gtest/gtest.h>
+#include <libevdev/libevdev.h>
+#include <linux/input.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <sys/sysmacros.h>
+#include <utility>
+#include <vector>
+
+#include "ctlr_mgr.h"
+#include "epoll_mgr.h"
+#include "fake_io.h"
+
+static const uint64_t LEFT_MAC = 0x98b6e9000021;
+static const uint64_t RIGHT_MAC = 0x98b6e9000022;
+
+// Keeps the last value written for every code
+class recording_sink : public null_sink {
+  private:
+    std::map<std::pair<unsigned int, unsigned int>, int> values;
+
+  public:
+    void write_event(unsigned int type, unsigned int code,
+                     int value) override {
+        null_sink::write_event(type, code, value);
+        values[{type, code}] = value;
+    }
+    int value(unsigned int type, unsigned int code) const {
+        auto it = values.find({type, code});
+        return it == values.end() ? 0 : it->second;
+    }
+};
+
+static struct input_event make_event(unsigned int type, unsigned int code,
+                                     int value) {
+    struct input_event ev = {};
+
+    ev.type = type;
+    ev.code = code;
+    ev.value = value;
+    return ev;
+}
+
+class combined_handover : public ::testing::Test {
+  protected:
+    epoll_mgr epoll_manager;
+    struct mapping mMapping;
+    pthread_mutex_t mapLock;
+    // the uinput pool's thread makes devices too
+    std::mutex gamepads_lock;
+    std::vector<recording_sink *> gamepads;
+    std::vector<virt_caps> gamepad_caps;
+    std::unique_ptr<ctlr_mgr> ctlr_manager;
+
+    void SetUp() override {
+        mMapping.combined = true;
+        mMapping.analog = true;
+        mMapping.rsmouse = false;
+        pthread_mutex_init(&mapLock, NULL);
+        ctlr_manager = std::make_unique<ctlr_mgr>(
+            epoll_manager, &mMapping, &mapLock,
+            [this](const virt_caps &caps, struct virt_device *dev) {
+                create_null_device(caps, dev);
+                if (caps.kind == virt_caps::Kind::Combined) {
+                    std::lock_guard<std::mutex> guard(gamepads_lock);
+                    delete dev->sink;
+                    gamepads.push_back(new recording_sink());
+                    gamepad_caps.push_back(caps);
+                    dev->sink = gamepads.back();
+                }
+                return true;
+            });
+    }
+
+    void TearDown() override {
+        ctlr_manager.reset();
+        pthread_mutex_destroy(&mapLock);
+    }
+
+    // minor is the N of the eventN the controller would have been
+    memory_source *plug(int minor, phys_ctlr::Model model, uint64_t mac,
+                        const char *name = nullptr) {
+        auto *src = new memory_source(model, mac);
+
+        if (name)
+            libevdev_set_name(src->get_evdev(), name);
+        ctlr_manager->add_ctlr(ctlr_id{makedev(13, minor), 0}, "",
+                               libevdev_get_name(src->get_evdev()),
+                               std::unique_ptr<event_source>(src));
+        return src;
+    }
+
+    void unplug(int minor) {
+        ctlr_manager->remove_ctlr(ctlr_id{makedev(13, minor), 0});
+    }
+
+    // Feeds stream to src and runs the poll loop until it's all read
+    void send(memory_source *src,
+              const std::vector<struct input_event> &stream) {
+        src->load(stream);
+        for (int i = 0; i < 64 && !src->done(); i++)
+            epoll_manager.loop();
+        ASSERT_TRUE(src->done());
+    }
+};
+
+TEST_F(combined_handover, bt_to_serial_releases_state_and_keeps_device) {
+    memory_source *left = plug(64, phys_ctlr::Model::Left_Joycon, LEFT_MAC);
+    plug(65, phys_ctlr::Model::Right_Joycon, RIGHT_MAC);
+    ASSERT_EQ(gamepads.size(), 1u);
+    recording_sink *gamepad = gamepads[0];
+
+    // Hold a button, the dpad and the stick on the BT joy-con
+    send(left, {make_event(EV_KEY, BTN_SELECT, 1),
+                make_event(EV_KEY, BTN_DPAD_UP, 1),
+                make_event(EV_ABS, ABS_X, 20000),
+                make_event(EV_ABS, ABS_Y, -12000),
+                make_event(EV_SYN, SYN_REPORT, 0)});
+    EXPECT_EQ(gamepad->value(EV_KEY, BTN_SELECT), 1);
+    EXPECT_EQ(gamepad->value(EV_ABS, ABS_HAT0Y), -1);
+    EXPECT_EQ(gamepad->value(EV_ABS, ABS_X), 20000);
+    EXPECT_EQ(gamepad->value(EV_ABS, ABS_Y), -12000);
+
+    // It slides onto the rails and shows up again as a serial joy-con with
+    // nothing pressed, before the BT node goes away
+    memory_source *serial = plug(66, phys_ctlr::Model::Left_Joycon, LEFT_MAC,
+                                 "Nintendo Switch Left Joy-Con Serial");
+    EXPECT_EQ(gamepad->value(EV_KEY, BTN_SELECT), 0);
+    EXPECT_EQ(gamepad->value(EV_ABS, ABS_HAT0Y), 0);
+    EXPECT_EQ(gamepad->value(EV_ABS, ABS_X), 0);
+    EXPECT_EQ(gamepad->value(EV_ABS, ABS_Y), 0);
+
+    unplug(64);
+    ASSERT_EQ(gamepads.size(), 1u);
+
+    // The serial joy-con drives the same device, without SL/SR
+    uint64_t writes = gamepad->get_writes();
+    send(serial, {make_event(EV_KEY, BTN_SELECT, 1),
+                  make_event(EV_KEY, BTN_TR, 1),
+                  make_event(EV_SYN, SYN_REPORT, 0)});
+    EXPECT_EQ(gamepad->value(EV_KEY, BTN_SELECT), 1);
+    EXPECT_EQ(gamepad->value(EV_KEY, BTN_TRIGGER_HAPPY1), 0);
+    EXPECT_EQ(gamepad->get_writes(), writes + 2);
+    EXPECT_EQ(gamepads.size(), 1u);
+}
+
+TEST_F(combined_handover, bt_to_serial_moves_axes_to_new_position) {
+    memory_source *left = plug(64, phys_ctlr::Model::Left_Joycon, LEFT_MAC);
+    plug(65, phys_ctlr::Model::Right_Joycon, RIGHT_MAC);
+    ASSERT_EQ(gamepads.size(), 1u);
+    recording_sink *gamepad = gamepads[0];
+
+    send(left, {make_event(EV_KEY, BTN_Z, 1),
+                make_event(EV_ABS, ABS_X, 20000),
+                make_event(EV_SYN, SYN_REPORT, 0)});
+
+    // The new node already reports the stick off centre and capture held, so
+    // those carry over rather than being released and pressed again
+    auto *src = new memory_source(phys_ctlr::Model::Left_Joycon, LEFT_MAC);
+    libevdev_set_name(src->get_evdev(), "Nintendo Switch Left Joy-Con Serial");
+    libevdev_set_event_value(src->get_evdev(), EV_ABS, ABS_X, 5000);
+    libevdev_set_event_value(src->get_evdev(), EV_KEY, BTN_Z, 1);
+    ctlr_manager->add_ctlr(ctlr_id{makedev(13, 66), 0}, "",
+                           libevdev_get_name(src->get_evdev()),
+                           std::unique_ptr<event_source>(src));
+
+    EXPECT_EQ(gamepad->value(EV_ABS, ABS_X), 5000);
+    EXPECT_EQ(gamepad->value(EV_KEY, BTN_Z), 1);
+    EXPECT_EQ(gamepads.size(), 1u);
+}
+
+TEST_F(combined_handover, bt_to_serial_releases_held_sl_sr) {
+    memory_source *left = plug(64, phys_ctlr::Model::Left_Joycon, LEFT_MAC);
+    plug(65, phys_ctlr::Model::Right_Joycon, RIGHT_MAC);
+    ASSERT_EQ(gamepads.size(), 1u);
+    recording_sink *gamepad = gamepads[0];
+
+    // SL and SR on a joy-con off the rails
+    send(left, {make_event(EV_KEY, BTN_TR, 1),
+                make_event(EV_KEY, BTN_TR2, 1),
+                make_event(EV_SYN, SYN_REPORT, 0)});
+    EXPECT_EQ(gamepad->value(EV_KEY, BTN_TRIGGER_HAPPY1), 1);
+    EXPECT_EQ(gamepad->value(EV_KEY, BTN_TRIGGER_HAPPY2), 1);
+
+    // On the rails it can't press them, but letting go still has to happen
+    plug(66, phys_ctlr::Model::Left_Joycon, LEFT_MAC,
+         "Nintendo Switch Left Joy-Con Serial");
+    EXPECT_EQ(gamepad->value(EV_KEY, BTN_TRIGGER_HAPPY1), 0);
+    EXPECT_EQ(gamepad->value(EV_KEY, BTN_TRIGGER_HAPPY2), 0);
+}
+
+TEST_F(combined_handover, layout_swap_while_held_releases_what_was_pressed) {
+    memory_source *left = plug(64, phys_ctlr::Model::Left_Joycon, LEFT_MAC);
+    plug(65, phys_ctlr::Model::Right_Joycon, RIGHT_MAC);
+    ASSERT_EQ(gamepads.size(), 1u);
+    recording_sink *gamepad = gamepads[0];
+
+    mMapping.layout[BTN_SELECT] = BTN_START;
+    mMapping.layout[BTN_Z] = BTN_MODE;
+    send(left, {make_event(EV_KEY, BTN_SELECT, 1),
+                make_event(EV_KEY, BTN_Z, 1),
+                make_event(EV_SYN, SYN_REPORT, 0)});
+    EXPECT_EQ(gamepad->value(EV_KEY, BTN_START), 1);
+    EXPECT_EQ(gamepad->value(EV_KEY, BTN_MODE), 1);
+
+    // The service swaps the layout while both are held
+    mMapping.layout.clear();
+
+    send(left, {make_event(EV_KEY, BTN_SELECT, 0),
+                make_event(EV_SYN, SYN_REPORT, 0)});
+    EXPECT_EQ(gamepad->value(EV_KEY, BTN_START), 0);
+
+    plug(66, phys_ctlr::Model::Left_Joycon, LEFT_MAC,
+         "Nintendo Switch Left Joy-Con Serial");
+    EXPECT_EQ(gamepad->value(EV_KEY, BTN_MODE), 0);
+}
+
+TEST_F(combined_handover, sl_sr_follow_where_the_pair_started) {
+    plug(64, phys_ctlr::Model::Left_Joycon, LEFT_MAC,
+         "Nintendo Switch Left Joy-Con Serial");
+    plug(65, phys_ctlr::Model::Right_Joycon, RIGHT_MAC,
+         "Nintendo Switch Right Joy-Con Serial");
+    ASSERT_EQ(gamepad_caps.size(), 1u);
+    EXPECT_FALSE(gamepad_caps[0].sl_sr);
+
+    // A rebuild for another setting doesn't add them either
+    mMapping.analog = false;
+    ctlr_manager->request_reconfigure();
+    epoll_manager.loop();
+    ASSERT_EQ(gamepad_caps.size(), 2u);
+    EXPECT_FALSE(gamepad_caps[1].analog);
+    EXPECT_FALSE(gamepad_caps[1].sl_sr);
+}
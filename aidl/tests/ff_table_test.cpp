@@ -0,0 +1,46 @@
+// An effect upload that no device takes leaves the table as it was.
+
+#include <gtest/gtest.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "ff_table.h"
+
+static struct ff_effect make_rumble(int id, uint16_t strong) {
+    struct ff_effect effect = {};
+
+    effect.type = FF_RUMBLE;
+    effect.id = id;
+    effect.u.rumble.strong_magnitude = strong;
+    return effect;
+}
+
+// An eventfd takes no EVIOCSFF, so every upload to it fails
+TEST(ff_table, upload_failing_on_every_side_rolls_back) {
+    int left = eventfd(0, EFD_CLOEXEC);
+    int right = eventfd(0, EFD_CLOEXEC);
+    ff_table table(2);
+
+    table.attach(0, left, nullptr);
+    table.attach(1, right, nullptr);
+    EXPECT_NE(table.upload(make_rumble(3, 0x4000)), 0);
+    EXPECT_EQ(table.size(), 0);
+
+    // Nothing is left behind to erase
+    EXPECT_EQ(table.erase(3), 0);
+    EXPECT_EQ(table.size(), 0);
+
+    close(left);
+    close(right);
+}
+
+// With no device attached there is nothing to fail; the effect is kept for
+// when one comes along
+TEST(ff_table, upload_without_sides_is_kept) {
+    ff_table table(1);
+
+    EXPECT_EQ(table.upload(make_rumble(0, 0x4000)), 0);
+    EXPECT_EQ(table.size(), 1);
+    EXPECT_EQ(table.erase(0), 0);
+    EXPECT_EQ(table.size(), 0);
+}
@@ -0,0 +1,59 @@
+// What the gyro pointer learns as bias, and what it turns into motion.
+
+#include <gtest/gtest.h>
+
+#include "gyro_pointer.h"
+
+static const uint64_t PERIOD_US = 5000;
+
+// Feeds count samples at 200 Hz and returns the summed deltas
+static void feed(gyro_pointer &pointer, uint64_t *now_us, int count,
+                 float yaw_dps, float pitch_dps, float accel_g, int *sum_x,
+                 int *sum_y) {
+    *sum_x = *sum_y = 0;
+    for (int i = 0; i < count; i++) {
+        imu_sample sample = {*now_us, {0, 0, accel_g}, {0, pitch_dps, yaw_dps}};
+        int dx = 0, dy = 0;
+
+        if (pointer.update(sample, &dx, &dy)) {
+            *sum_x += dx;
+            *sum_y += dy;
+        }
+        *now_us += PERIOD_US;
+    }
+}
+
+TEST(gyro_pointer, learns_bias_at_rest) {
+    gyro_pointer pointer(20, 20);
+    uint64_t now_us = 0;
+    int x, y;
+
+    // A second of holding still with a drifting sensor...
+    feed(pointer, &now_us, 200, 2.0f, -1.0f, 1.0f, &x, &y);
+    // ...after which the drift no longer moves the pointer
+    feed(pointer, &now_us, 400, 2.0f, -1.0f, 1.0f, &x, &y);
+    EXPECT_LE(std::abs(x), 1);
+    EXPECT_LE(std::abs(y), 1);
+}
+
+TEST(gyro_pointer, slow_steady_turn_is_not_bias) {
+    gyro_pointer pointer(20, 20);
+    uint64_t now_us = 0;
+    int x, y;
+
+    // 10 degrees a second for two seconds: 20 degrees at 20 counts each,
+    // less the first sample, which has no interval to integrate
+    feed(pointer, &now_us, 400, 10.0f, 0, 1.0f, &x, &y);
+    EXPECT_NEAR(x, -399 * 10 * 20 * (PERIOD_US / 1e6), 1);
+    EXPECT_EQ(y, 0);
+}
+
+TEST(gyro_pointer, no_bias_while_accelerating) {
+    gyro_pointer pointer(20, 20);
+    uint64_t now_us = 0;
+    int x, y;
+
+    // Swung around hard enough to pull 1.5 g, turning slowly the whole time
+    feed(pointer, &now_us, 400, 2.0f, 0, 1.5f, &x, &y);
+    EXPECT_NEAR(x, -399 * 2 * 20 * (PERIOD_US / 1e6), 1);
+}
@@ -0,0 +1,80 @@
+// The orientation imu_fusion settles on for a controller at rest, turning,
+// or tilted.
+
+#include <cmath>
+#include <gtest/gtest.h>
+
+#include "imu_fusion.h"
+
+static const uint64_t PERIOD_US = 5000;
+
+// Feeds count samples at 200 Hz and fuses whatever is left queued
+static void feed(imu_fusion &fusion, uint64_t *now_us, int count,
+                 const float accel[3], const float gyro[3]) {
+    for (int i = 0; i < count; i++) {
+        imu_sample sample = {*now_us,
+                             {accel[0], accel[1], accel[2]},
+                             {gyro[0], gyro[1], gyro[2]}};
+
+        fusion.add(sample);
+        *now_us += PERIOD_US;
+    }
+    fusion.flush();
+}
+
+static const float LEVEL[3] = {0, 0, 1};
+static const float STILL[3] = {0, 0, 0};
+
+TEST(imu_fusion_test, stays_level_at_rest) {
+    imu_fusion fusion;
+    uint64_t now_us = 1000000;
+    float euler[3];
+
+    feed(fusion, &now_us, 400, LEVEL, STILL);
+    fusion.get_euler(euler);
+    EXPECT_NEAR(euler[0], 0, 0.5);
+    EXPECT_NEAR(euler[1], 0, 0.5);
+    EXPECT_NEAR(euler[2], 0, 0.5);
+}
+
+TEST(imu_fusion_test, integrates_a_yaw_turn) {
+    const float turn[3] = {0, 0, 90};
+    imu_fusion fusion;
+    uint64_t now_us = 1000000;
+    float euler[3];
+
+    // 200 intervals, one second at 90 deg/s
+    feed(fusion, &now_us, 201, LEVEL, turn);
+    fusion.get_euler(euler);
+    EXPECT_NEAR(euler[0], 0, 1);
+    EXPECT_NEAR(euler[1], 0, 1);
+    EXPECT_NEAR(euler[2], 90, 2);
+}
+
+TEST(imu_fusion_test, converges_on_gravity_when_tilted) {
+    const float rad = float(M_PI) / 180.0f;
+    const float tilted[3] = {0, std::sin(30 * rad), std::cos(30 * rad)};
+    imu_fusion fusion;
+    uint64_t now_us = 1000000;
+    float euler[3];
+
+    // Only the accel says it's rolled, so give the filter time to follow
+    feed(fusion, &now_us, 6000, tilted, STILL);
+    fusion.get_euler(euler);
+    EXPECT_NEAR(std::fabs(euler[0]), 30, 2);
+    EXPECT_NEAR(euler[1], 0, 2);
+}
+
+TEST(imu_fusion_test, skips_a_stalled_stream) {
+    const float turn[3] = {0, 0, 90};
+    imu_fusion fusion;
+    uint64_t now_us = 1000000;
+    float euler[3];
+
+    // A second between two reports is a stall, not a second of turning
+    feed(fusion, &now_us, 1, LEVEL, turn);
+    now_us += 1000000;
+    feed(fusion, &now_us, 1, LEVEL, turn);
+    fusion.get_euler(euler);
+    EXPECT_NEAR(euler[2], 0, 0.5);
+}
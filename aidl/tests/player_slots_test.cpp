@@ -0,0 +1,158 @@
+// Player slot allocation under lots of controllers coming and going.
+
+#include <gtest/gtest.h>
+#include <map>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "player_slots.h"
+
+static const uint64_t MAC = 0x98b6e9000000;
+
+// Connects and disconnects macs at random, checking every acquire against
+// what the slots' previous owners lead to expect: the lowest free slot, or
+// with sticky reservations, a returning MAC's own slot if nobody took it,
+// and otherwise the lowest free slot no absent MAC last had, if any.
+static void churn(int capacity, bool sticky, int macs, int steps) {
+    player_slots slots(capacity, sticky);
+    std::mt19937 rng(capacity * 2 + sticky);
+    std::map<uint64_t, int> connected;
+    std::vector<uint64_t> last_holder(capacity, 0);
+    std::map<uint64_t, int> last_slot;
+    int evictions = 0, returns = 0;
+
+    for (int step = 0; step < steps; step++) {
+        uint64_t mac = MAC | (rng() % macs + 1);
+        auto it = connected.find(mac);
+
+        if (it != connected.end()) {
+            slots.release(it->second);
+            connected.erase(it);
+            ASSERT_EQ(slots.in_use(), int(connected.size()));
+            continue;
+        }
+
+        std::set<int> free_slots, unclaimed;
+        int own = -1;
+        for (int slot = 0; slot < capacity; slot++) {
+            bool taken = false;
+            for (auto &c : connected)
+                taken |= c.second == slot;
+            if (taken)
+                continue;
+            free_slots.insert(slot);
+            // a MAC's claim is on the last slot it had, if nobody took it
+            uint64_t holder = last_holder[slot];
+            bool claimed = holder && last_slot[holder] == slot &&
+                           !connected.count(holder);
+            if (claimed && holder == mac)
+                own = slot;
+            else if (!claimed)
+                unclaimed.insert(slot);
+        }
+
+        int slot = slots.acquire(mac);
+        if (free_slots.empty()) {
+            ASSERT_EQ(slot, -1);
+            continue;
+        }
+        ASSERT_TRUE(free_slots.count(slot)) << "slot " << slot;
+
+        if (!sticky) {
+            ASSERT_EQ(slot, *free_slots.begin());
+        } else if (own >= 0) {
+            ASSERT_EQ(slot, own);
+            returns++;
+        } else if (!unclaimed.empty()) {
+            ASSERT_EQ(slot, *unclaimed.begin());
+        } else {
+            ASSERT_EQ(slot, *free_slots.begin());
+            evictions++;
+        }
+
+        last_holder[slot] = mac;
+        last_slot[mac] = slot;
+        connected[mac] = slot;
+        ASSERT_EQ(slots.in_use(), int(connected.size()));
+    }
+
+    if (sticky) {
+        EXPECT_GT(returns, 0);
+        EXPECT_GT(evictions, 0);
+    }
+}
+
+TEST(player_slots, churn_non_sticky) {
+    churn(4, false, 40, 5000);
+    churn(player_slots::MAX_SLOTS, false, 48, 5000);
+}
+
+TEST(player_slots, churn_sticky) {
+    churn(4, true, 40, 5000);
+    churn(player_slots::MAX_SLOTS, true, 48, 5000);
+}
+
+TEST(player_slots, sticky_slot_comes_back) {
+    player_slots slots(4, true);
+
+    ASSERT_EQ(slots.acquire(MAC | 1), 0);
+    ASSERT_EQ(slots.acquire(MAC | 2), 1);
+    slots.release(0);
+    slots.release(1);
+
+    // A newcomer skips both reserved slots, and their owners get them back
+    EXPECT_EQ(slots.acquire(MAC | 3), 2);
+    EXPECT_EQ(slots.acquire(MAC | 2), 1);
+    EXPECT_EQ(slots.acquire(MAC | 1), 0);
+}
+
+TEST(player_slots, full_house_evicts_lowest_reservation) {
+    player_slots slots(2, true);
+
+    ASSERT_EQ(slots.acquire(MAC | 1), 0);
+    ASSERT_EQ(slots.acquire(MAC | 2), 1);
+    slots.release(0);
+    slots.release(1);
+
+    // Every free slot is reserved, so the newcomer takes slot 0's away
+    EXPECT_EQ(slots.acquire(MAC | 3), 0);
+    slots.release(0);
+    EXPECT_EQ(slots.acquire(MAC | 2), 1);
+    EXPECT_EQ(slots.acquire(MAC | 1), 0);
+    EXPECT_EQ(slots.acquire(MAC | 3), -1);
+}
+
+TEST(player_slots, no_mac_never_reserves) {
+    player_slots slots(2, true);
+
+    ASSERT_EQ(slots.acquire(0), 0);
+    slots.release(0);
+    EXPECT_EQ(slots.acquire(MAC | 1), 0);
+}
+
+TEST(player_slots, invalid_capacity_falls_back_to_max) {
+    int max = player_slots::MAX_SLOTS;
+
+    EXPECT_EQ(player_slots(0, false).get_capacity(), max);
+    EXPECT_EQ(player_slots(16, true).get_capacity(), max);
+}
+
+TEST(player_slots, led_patterns_are_distinct) {
+    std::set<uint8_t> seen;
+
+    for (int player = 1; player <= player_slots::MAX_SLOTS; player++) {
+        uint8_t pattern = player_slots::led_pattern(player);
+        EXPECT_NE(pattern, 0) << "player " << player;
+        EXPECT_EQ(pattern & ~0xf, 0) << "player " << player;
+        EXPECT_TRUE(seen.insert(pattern).second) << "player " << player;
+    }
+    EXPECT_EQ(player_slots::led_pattern(0), 0);
+    EXPECT_EQ(player_slots::led_pattern(player_slots::MAX_SLOTS + 1), 0);
+
+    // The first four light up one more LED each, like on the Switch
+    EXPECT_EQ(player_slots::led_pattern(1), 0b0001);
+    EXPECT_EQ(player_slots::led_pattern(2), 0b0011);
+    EXPECT_EQ(player_slots::led_pattern(3), 0b0111);
+    EXPECT_EQ(player_slots::led_pattern(4), 0b1111);
+}
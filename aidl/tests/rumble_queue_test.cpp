@@ -0,0 +1,38 @@
+// Rumble still goes out when the controller's fd can't be watched for
+// writes; the queue's timer does the writing instead.
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <linux/input.h>
+#include <memory>
+#include <unistd.h>
+
+#include "ctlr_stats.h"
+#include "epoll_mgr.h"
+#include "rumble_queue.h"
+
+// The write end of a pipe never gets subscribed, so watch_writable fails
+TEST(rumble_queue, unwatchable_fd_falls_back_to_timer) {
+    int fds[2];
+    ASSERT_EQ(pipe2(fds, O_NONBLOCK | O_CLOEXEC), 0);
+
+    epoll_mgr epoll_manager;
+    auto counters = std::make_shared<ctlr_stats>(false, "rumble_test", 0);
+    struct input_event ev;
+    {
+        rumble_queue queue(epoll_manager, fds[1], 1, counters);
+
+        queue.push(2, 1);
+        for (int i = 0; i < 8 && read(fds[0], &ev, sizeof(ev)) < 0; i++)
+            epoll_manager.loop();
+    }
+
+    EXPECT_EQ(ev.type, EV_FF);
+    EXPECT_EQ(ev.code, 2);
+    EXPECT_EQ(ev.value, 1);
+    EXPECT_EQ(counters->read().counts[ctlr_stats::FfForwarded], 1u);
+    EXPECT_EQ(counters->read().counts[ctlr_stats::FfDropped], 0u);
+
+    close(fds[0]);
+    close(fds[1]);
+}
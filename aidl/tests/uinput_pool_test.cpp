@@ -0,0 +1,120 @@
+// The uinput pool builds what it's asked for ahead of time, hands it out
+// without building it again, and a controller that was announced pairs into
+// devices that were already there.
+
+#include <atomic>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "ctlr_mgr.h"
+#include "epoll_mgr.h"
+#include "fake_io.h"
+#include "uinput_pool.h"
+
+static const uint64_t PRO_MAC = 0x98b6e9000031;
+
+static std::atomic<int> created;
+static std::atomic<int> destroyed;
+
+class counting_sink : public null_sink {
+  public:
+    ~counting_sink() { destroyed++; }
+};
+
+static bool create_counted_device(const virt_caps &caps,
+                                  struct virt_device *dev) {
+    create_null_device(caps, dev);
+    delete dev->sink;
+    dev->sink = new counting_sink();
+    created++;
+    return true;
+}
+
+// The refill thread works on its own time
+static bool wait_for(const std::atomic<int> &count, int wanted) {
+    for (int i = 0; i < 1000 && count.load() < wanted; i++)
+        usleep(1000);
+    return count.load() >= wanted;
+}
+
+class uinput_pool_test : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        created = 0;
+        destroyed = 0;
+    }
+};
+
+TEST_F(uinput_pool_test, builds_targets_and_frees_surplus) {
+    uinput_pool pool(true, create_counted_device);
+    struct virt_device dev;
+
+    pool.set_targets({virt_caps::pro(true, true), virt_caps::mouse()});
+    ASSERT_TRUE(wait_for(created, 2));
+
+    ASSERT_TRUE(pool.claim(virt_caps::pro(true, true), &dev));
+    EXPECT_TRUE(dev.pooled);
+    usleep(20000);
+    EXPECT_EQ(created.load(), 2);
+
+    // Nobody wants the mouse anymore
+    pool.set_targets({});
+    ASSERT_TRUE(wait_for(destroyed, 1));
+    destroy_virt_device(&dev);
+    EXPECT_EQ(destroyed.load(), 2);
+}
+
+TEST_F(uinput_pool_test, miss_creates_a_fresh_device) {
+    uinput_pool pool(true, create_counted_device);
+    struct virt_device dev;
+
+    pool.set_targets({virt_caps::mouse()});
+    ASSERT_TRUE(wait_for(created, 1));
+
+    ASSERT_TRUE(pool.claim(virt_caps::combined(true, false), &dev));
+    EXPECT_FALSE(dev.pooled);
+    EXPECT_EQ(created.load(), 2);
+    destroy_virt_device(&dev);
+}
+
+TEST_F(uinput_pool_test, expected_procon_pairs_into_pooled_devices) {
+    epoll_mgr epoll_manager;
+    struct mapping mMapping;
+    pthread_mutex_t mapLock;
+
+    mMapping.combined = true;
+    mMapping.analog = true;
+    mMapping.rsmouse = false;
+    pthread_mutex_init(&mapLock, NULL);
+    {
+        ctlr_mgr ctlr_manager(epoll_manager, &mMapping, &mapLock,
+                              create_counted_device);
+
+        // The HID device showed up; a gamepad and its mouse get built
+        ctlr_manager.expect_ctlr(PRO_MAC, phys_ctlr::Model::Procon);
+        epoll_manager.loop();
+        ASSERT_TRUE(wait_for(created, 2));
+
+        auto *src = new memory_source(phys_ctlr::Model::Procon, PRO_MAC);
+        ctlr_manager.add_ctlr(ctlr_id{makedev(13, 64), 0}, "",
+                              libevdev_get_name(src->get_evdev()),
+                              std::unique_ptr<event_source>(src));
+        EXPECT_EQ(created.load(), 2);
+
+        char buf[8192] = {};
+        int fd = memfd_create("dump", MFD_CLOEXEC);
+        ASSERT_GE(fd, 0);
+        ctlr_manager.dump(fd);
+        ASSERT_GT(pread(fd, buf, sizeof(buf) - 1, 0), 0);
+        close(fd);
+        EXPECT_NE(std::string(buf).find("hits: 2 misses: 0"),
+                  std::string::npos);
+    }
+    pthread_mutex_destroy(&mapLock);
+}
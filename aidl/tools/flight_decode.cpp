@@ -0,0 +1,100 @@
+// Host-side decoder for joycond flight recorder dumps. Grab one by running
+// `dumpsys android.hardware.nintendo.joycond.IJoycond/default --flight`
+// through adb exec-out into a file, then run joycond_flight_decode on it or
+// pipe it in on stdin.
+// Times are printed in seconds before the dump was taken.
+
+#define JOYCOND_FLIGHT_DECODER
+#include "flight_recorder.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static const char *kind_name(flight::kind kind) {
+    switch (kind) {
+    case flight::kind::Input:
+        return "input";
+    case flight::kind::Output:
+        return "output";
+    case flight::kind::Ff:
+        return "ff";
+    case flight::kind::Hotplug:
+        return "hotplug";
+    case flight::kind::Pairing:
+        return "pairing";
+    case flight::kind::Player:
+        return "player";
+    }
+    return "?";
+}
+
+static const char *type_name(uint8_t type) {
+    switch (type) {
+    case 0x00:
+        return "EV_SYN";
+    case 0x01:
+        return "EV_KEY";
+    case 0x02:
+        return "EV_REL";
+    case 0x03:
+        return "EV_ABS";
+    case 0x04:
+        return "EV_MSC";
+    case 0x11:
+        return "EV_LED";
+    case 0x15:
+        return "EV_FF";
+    case flight::TYPE_UINPUT:
+        return "EV_UINPUT";
+    default:
+        return nullptr;
+    }
+}
+
+int main(int argc, char **argv) {
+    struct flight::header hdr;
+    FILE *in = argc > 1 ? fopen(argv[1], "rb") : stdin;
+
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 ||
+        memcmp(hdr.magic, "JCFR", sizeof(hdr.magic))) {
+        fprintf(stderr, "not a joycond flight recorder dump\n");
+        return 1;
+    }
+    if (hdr.version != flight::VERSION ||
+        hdr.record_size != sizeof(flight::record)) {
+        fprintf(stderr, "unsupported dump version %u (record size %u)\n",
+                hdr.version, hdr.record_size);
+        return 1;
+    }
+
+    std::vector<flight::record> records(hdr.count);
+    size_t got = fread(records.data(), sizeof(flight::record), hdr.count, in);
+    if (got != hdr.count)
+        fprintf(stderr, "dump truncated: %zu of %u records\n", got, hdr.count);
+
+    for (size_t i = 0; i < got; i++) {
+        const flight::record &r = records[i];
+        uint64_t ns = flight::stamp_ns(r.stamp);
+        double rel = (double(ns) - double(hdr.dump_ns)) / 1e9;
+        const char *type = type_name(r.type);
+
+        printf("%12.6f %-8s src %3u ", rel,
+               kind_name(flight::stamp_kind(r.stamp)), r.source);
+        if (type)
+            printf("%-9s", type);
+        else
+            printf("0x%02x     ", r.type);
+        printf(" code %5u value %" PRId32 "\n", r.code, r.value);
+    }
+
+    if (in != stdin)
+        fclose(in);
+    return 0;
+}
@@ -0,0 +1,451 @@
+// Replays controller captures (see PROP_CAPTURE_DIR) through uinput. Each
+// trace becomes a uinput device with the recorded name, ids, MAC and
+// capabilities, created at the point in the timeline its capture started,
+// so the running daemon picks it up, pairs it and relays it exactly as it
+// would the real controller.
+//
+//   joycond_trace_replay [--in-process] [--speed FACTOR] [--hold SECONDS]
+//                        trace.jct...
+//   joycond_trace_replay --info trace.jct...
+//
+// --speed 2 plays twice as fast, --speed 0 as fast as possible. Force
+// feedback uploads from the daemon are acknowledged and otherwise ignored.
+//
+// With --in-process the traces go through this process's own ctlr_mgr and
+// virtual controllers instead, a frame at a time, with the virtual devices
+// writing into null sinks; no uinput or running daemon is needed. The
+// mapping is the default one (combined, analog, rsmouse, no layout), and
+// the counters of every controller are printed at the end.
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <libevdev/libevdev-uinput.h>
+#include <libevdev/libevdev.h>
+#include <linux/uinput.h>
+#include <memory>
+#include <poll.h>
+#include <string>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "clock.h"
+#include "ctlr_mgr.h"
+#include "epoll_mgr.h"
+#include "fake_io.h"
+#include "input_trace.h"
+
+using namespace input_trace;
+
+// Hands a trace to a phys_ctlr in process, up to where the timeline has
+// released it. The fd stays readable while there is something to read.
+class trace_source : public event_source {
+  private:
+    const input_trace_reader &trace;
+    struct libevdev *evdev;
+    int fd;
+    size_t next;
+    size_t released;
+
+  public:
+    trace_source(const input_trace_reader &trace, struct libevdev *evdev)
+        : trace(trace), evdev(evdev),
+          fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), next(0), released(0) {}
+    ~trace_source() {
+        libevdev_free(evdev);
+        close(fd);
+    }
+
+    void release(size_t upto) {
+        uint64_t one = 1;
+
+        released = upto;
+        if (write(fd, &one, sizeof(one)) != sizeof(one))
+            fprintf(stderr, "failed to signal trace: %s\n", strerror(errno));
+    }
+    bool drained() const { return next == released; }
+
+    struct libevdev *get_evdev() override { return evdev; }
+    int get_fd() override { return fd; }
+    // Stamped with the time they're read, so relay latency means something
+    int next_event(unsigned int flags, struct input_event *ev) override {
+        uint64_t count;
+
+        if (next == released) {
+            if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                fprintf(stderr, "failed to read trace eventfd: %s\n",
+                        strerror(errno));
+            return -EAGAIN;
+        }
+
+        const event &e = trace.get_events()[next++];
+        uint64_t now_us = monotonic_ns() / 1000;
+        ev->input_event_sec = now_us / 1000000;
+        ev->input_event_usec = now_us % 1000000;
+        ev->type = e.type;
+        ev->code = e.code;
+        ev->value = e.value;
+        if (ev->type == EV_KEY || ev->type == EV_ABS)
+            libevdev_set_event_value(evdev, ev->type, ev->code, ev->value);
+        return LIBEVDEV_READ_STATUS_SUCCESS;
+    }
+    void grab(bool grab) override {}
+};
+
+struct replay_device {
+    std::unique_ptr<input_trace_reader> trace;
+    size_t next;
+    struct libevdev *evdev;
+    struct libevdev_uinput *uidev;
+    // in-process only; owned by the ctlr_mgr's phys_ctlr
+    trace_source *source;
+};
+
+static void print_info(const char *path, const input_trace_reader &trace) {
+    const header &hdr = trace.get_header();
+    size_t count = trace.get_event_count();
+    uint64_t span_ns = 0;
+
+    if (count)
+        span_ns = trace.get_events()[count - 1].time_ns - hdr.start_ns;
+    printf("%s: \"%s\" %04x:%04x bus %u mac %012" PRIx64 "\n", path,
+           hdr.name, hdr.vendor, hdr.product, hdr.bustype, hdr.mac);
+    printf("  %zu events over %.3f s\n", count, span_ns / 1e9);
+}
+
+// A libevdev with the recorded name, ids, MAC and capabilities
+static struct libevdev *describe(const header &hdr) {
+    char uniq[18];
+    struct libevdev *evdev = libevdev_new();
+
+    libevdev_set_name(evdev, hdr.name);
+    libevdev_set_id_bustype(evdev, hdr.bustype);
+    libevdev_set_id_vendor(evdev, hdr.vendor);
+    libevdev_set_id_product(evdev, hdr.product);
+    libevdev_set_id_version(evdev, hdr.id_version);
+    // hid-nintendo reports the MAC as uniq, which is where joycond reads it;
+    // kernels without UI_SET_UNIQ leave it empty and the MAC reads as 0
+    snprintf(uniq, sizeof(uniq), "%02x:%02x:%02x:%02x:%02x:%02x",
+             int(hdr.mac >> 40) & 0xff, int(hdr.mac >> 32) & 0xff,
+             int(hdr.mac >> 24) & 0xff, int(hdr.mac >> 16) & 0xff,
+             int(hdr.mac >> 8) & 0xff, int(hdr.mac) & 0xff);
+    libevdev_set_uniq(evdev, uniq);
+
+    for (int prop = 0; prop < PROP_BITS; prop++)
+        if (test_bit(hdr.props, prop))
+            libevdev_enable_property(evdev, prop);
+    for (int code = 0; code < KEY_BITS; code++)
+        if (test_bit(hdr.keys, code))
+            libevdev_enable_event_code(evdev, EV_KEY, code, NULL);
+    for (int code = 0; code < ABS_BITS; code++) {
+        if (!test_bit(hdr.axes, code))
+            continue;
+        const absinfo &a = hdr.abs[code];
+        struct input_absinfo abs = {a.value, a.minimum, a.maximum,
+                                    a.fuzz,  a.flat,    a.resolution};
+        libevdev_enable_event_code(evdev, EV_ABS, code, &abs);
+    }
+    for (int code = 0; code < FF_BITS; code++)
+        if (test_bit(hdr.ff, code))
+            libevdev_enable_event_code(evdev, EV_FF, code, NULL);
+    for (int code = 0; code < LED_BITS; code++)
+        if (test_bit(hdr.leds, code))
+            libevdev_enable_event_code(evdev, EV_LED, code, NULL);
+    for (int code = 0; code < MSC_BITS; code++)
+        if (test_bit(hdr.msc, code))
+            libevdev_enable_event_code(evdev, EV_MSC, code, NULL);
+    return evdev;
+}
+
+static bool create_device(struct replay_device *dev) {
+    struct libevdev *evdev = describe(dev->trace->get_header());
+
+    int ret = libevdev_uinput_create_from_device(
+        evdev, LIBEVDEV_UINPUT_OPEN_MANAGED, &dev->uidev);
+    if (ret) {
+        fprintf(stderr, "failed to create uinput device: %s\n",
+                strerror(-ret));
+        libevdev_free(evdev);
+        return false;
+    }
+
+    int fd = libevdev_uinput_get_fd(dev->uidev);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    dev->evdev = evdev;
+    return true;
+}
+
+// Acknowledge rumble uploads and erases so the daemon's ioctls don't sit
+// out the uinput request timeout
+static void serve_ff(struct replay_device *dev) {
+    int fd = libevdev_uinput_get_fd(dev->uidev);
+    struct input_event ev;
+
+    while (read(fd, &ev, sizeof(ev)) == sizeof(ev)) {
+        if (ev.type != EV_UINPUT)
+            continue;
+        if (ev.code == UI_FF_UPLOAD) {
+            struct uinput_ff_upload upload = {};
+            upload.request_id = ev.value;
+            ioctl(fd, UI_BEGIN_FF_UPLOAD, &upload);
+            upload.retval = 0;
+            ioctl(fd, UI_END_FF_UPLOAD, &upload);
+        } else if (ev.code == UI_FF_ERASE) {
+            struct uinput_ff_erase erase = {};
+            erase.request_id = ev.value;
+            ioctl(fd, UI_BEGIN_FF_ERASE, &erase);
+            erase.retval = 0;
+            ioctl(fd, UI_END_FF_ERASE, &erase);
+        }
+    }
+}
+
+// Sleeps until deadline_ns, answering FF requests on the way
+static void wait_until(std::vector<replay_device> &devices,
+                       uint64_t deadline_ns) {
+    std::vector<struct pollfd> fds;
+
+    for (auto &dev : devices)
+        if (dev.uidev)
+            fds.push_back({libevdev_uinput_get_fd(dev.uidev), POLLIN, 0});
+
+    for (;;) {
+        uint64_t now = monotonic_ns();
+        if (now >= deadline_ns)
+            break;
+
+        uint64_t left = deadline_ns - now;
+        struct timespec timeout = {time_t(left / 1000000000),
+                                   long(left % 1000000000)};
+        if (ppoll(fds.data(), fds.size(), &timeout, NULL) <= 0)
+            continue;
+        for (auto &dev : devices)
+            if (dev.uidev)
+                serve_ff(&dev);
+    }
+}
+
+static bool created(const replay_device &dev) {
+    return dev.uidev || dev.source;
+}
+
+static uint64_t next_time(const replay_device &dev) {
+    if (!created(dev))
+        return dev.trace->get_header().start_ns;
+    return dev.trace->get_events()[dev.next].time_ns;
+}
+
+static bool finished(const replay_device &dev) {
+    return created(dev) && dev.next >= dev.trace->get_event_count();
+}
+
+// Drives the daemon core on this thread; the only thing on its epoll_mgr
+// besides the controllers is a timer for pacing
+class in_process {
+  private:
+    epoll_mgr epoll_manager;
+    struct mapping mMapping;
+    pthread_mutex_t mapLock;
+    std::unique_ptr<ctlr_mgr> ctlr_manager;
+    int timer_fd;
+    std::shared_ptr<epoll_subscriber> timer_subscriber;
+    bool timer_fired;
+
+  public:
+    in_process() : timer_fired(false) {
+        mMapping.combined = true;
+        mMapping.analog = true;
+        mMapping.rsmouse = true;
+        pthread_mutex_init(&mapLock, NULL);
+        ctlr_manager = std::make_unique<ctlr_mgr>(
+            epoll_manager, &mMapping, &mapLock, create_null_device);
+
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        timer_subscriber = std::make_shared<epoll_subscriber>(
+            std::vector({timer_fd}), [this](int fd) {
+                uint64_t expirations;
+                if (read(fd, &expirations, sizeof(expirations)) > 0)
+                    timer_fired = true;
+            });
+        epoll_manager.add_subscriber(timer_subscriber);
+    }
+
+    ~in_process() {
+        epoll_manager.remove_subscriber(timer_subscriber);
+        close(timer_fd);
+        ctlr_manager.reset();
+        pthread_mutex_destroy(&mapLock);
+    }
+
+    // The trace's position in the merged list makes up its minor number
+    void plug(struct replay_device *dev, int index) {
+        const header &hdr = dev->trace->get_header();
+
+        dev->source = new trace_source(*dev->trace, describe(hdr));
+        ctlr_manager->add_ctlr(ctlr_id{makedev(13, 64 + index), 0}, "",
+                               hdr.name,
+                               std::unique_ptr<event_source>(dev->source));
+    }
+
+    void unplug(int index) {
+        ctlr_manager->remove_ctlr(ctlr_id{makedev(13, 64 + index), 0});
+    }
+
+    // Releases the next frame of dev and lets the daemon read it
+    void play_frame(struct replay_device *dev) {
+        const event *events = dev->trace->get_events();
+        size_t count = dev->trace->get_event_count();
+
+        while (dev->next < count &&
+               !(events[dev->next].type == EV_SYN &&
+                 events[dev->next].code == SYN_REPORT))
+            dev->next++;
+        dev->next = std::min(dev->next + 1, count);
+        dev->source->release(dev->next);
+
+        // One pass does it unless the controller is between owners
+        for (int i = 0; i < 4 && !dev->source->drained(); i++)
+            epoll_manager.loop();
+    }
+
+    // Runs the poll loop until deadline_ns
+    void run_until(uint64_t deadline_ns) {
+        struct itimerspec its = {};
+
+        if (deadline_ns <= monotonic_ns())
+            return;
+        its.it_value.tv_sec = deadline_ns / 1000000000;
+        its.it_value.tv_nsec = deadline_ns % 1000000000;
+        timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+        timer_fired = false;
+        while (!timer_fired)
+            epoll_manager.loop();
+    }
+
+    void print_stats() const {
+        uint64_t count, p50, p99, p999;
+
+        printf("%-40s %6s %10s %10s %8s\n", "controller", "player", "read",
+               "written", "frames");
+        for (const auto &snap : ctlr_manager->get_stats())
+            printf("%-40s %6d %10" PRIu64 " %10" PRIu64 " %8" PRIu64 "\n",
+                   snap.name.c_str(), snap.player,
+                   snap.counts[ctlr_stats::EventsRead],
+                   snap.counts[ctlr_stats::EventsWritten],
+                   snap.counts[ctlr_stats::Frames]);
+        for (int player = 1;
+             ctlr_manager->get_relay_latency(player, &count, &p50, &p99,
+                                             &p999);
+             player++)
+            if (count)
+                printf("player %d relay latency: %" PRIu64 " frames, p50 %.1f "
+                       "us, p99 %.1f us, p999 %.1f us\n",
+                       player, count, p50 / 1e3, p99 / 1e3, p999 / 1e3);
+    }
+};
+
+int main(int argc, char **argv) {
+    std::vector<replay_device> devices;
+    double speed = 1.0;
+    double hold = 1.0;
+    bool info = false;
+    bool local = false;
+    int i;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "--info"))
+            info = true;
+        else if (!strcmp(argv[i], "--in-process"))
+            local = true;
+        else if (!strcmp(argv[i], "--speed") && i + 1 < argc)
+            speed = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--hold") && i + 1 < argc)
+            hold = atof(argv[++i]);
+        else
+            break;
+    }
+    if (i == argc) {
+        fprintf(stderr,
+                "usage: %s [--info] [--in-process] [--speed FACTOR] "
+                "[--hold SECONDS] trace.jct...\n",
+                argv[0]);
+        return 1;
+    }
+
+    for (; i < argc; i++) {
+        replay_device dev = {std::make_unique<input_trace_reader>(argv[i]), 0,
+                             nullptr, nullptr, nullptr};
+        if (!dev.trace->is_valid())
+            return 1;
+        if (info)
+            print_info(argv[i], *dev.trace);
+        devices.push_back(std::move(dev));
+    }
+    if (info)
+        return 0;
+
+    std::unique_ptr<in_process> daemon;
+    if (local)
+        daemon = std::make_unique<in_process>();
+
+    // Merge the traces into one timeline starting at the first capture
+    uint64_t base_ns = UINT64_MAX;
+    for (auto &dev : devices)
+        base_ns = std::min(base_ns, dev.trace->get_header().start_ns);
+    uint64_t start_ns = monotonic_ns();
+
+    for (;;) {
+        replay_device *due = nullptr;
+        for (auto &dev : devices)
+            if (!finished(dev) && (!due || next_time(dev) < next_time(*due)))
+                due = &dev;
+        if (!due)
+            break;
+
+        if (speed > 0) {
+            uint64_t deadline_ns =
+                start_ns + uint64_t((next_time(*due) - base_ns) / speed);
+            if (daemon)
+                daemon->run_until(deadline_ns);
+            else
+                wait_until(devices, deadline_ns);
+        }
+
+        if (!created(*due)) {
+            if (daemon)
+                daemon->plug(due, due - devices.data());
+            else if (!create_device(due))
+                return 1;
+            continue;
+        }
+        if (daemon) {
+            daemon->play_frame(due);
+            continue;
+        }
+        const event &ev = due->trace->get_events()[due->next++];
+        libevdev_uinput_write_event(due->uidev, ev.type, ev.code, ev.value);
+    }
+
+    // Let the daemon catch up before the devices disappear
+    if (daemon) {
+        daemon->run_until(monotonic_ns() + uint64_t(hold * 1e9));
+        daemon->print_stats();
+        for (size_t index = 0; index < devices.size(); index++)
+            daemon->unplug(index);
+        return 0;
+    }
+    wait_until(devices, monotonic_ns() + uint64_t(hold * 1e9));
+    for (auto &dev : devices) {
+        libevdev_uinput_destroy(dev.uidev);
+        libevdev_free(dev.evdev);
+    }
+    return 0;
+}